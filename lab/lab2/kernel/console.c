@@ -81,6 +81,8 @@ int consoleread(int user_dst, uint64 dst, int n) {
     char cbuf;
 
     target = n;
+    if (user_dst)
+        uvmprefault(dst, n, 1);
     acquire(&cons.lock);
     while (n > 0) {
         // wait until interrupt handler has put some
@@ -2,14 +2,21 @@
 
 struct buf;
 struct context;
+struct copyseg;
 struct file;
 struct inode;
+struct kmem_cache;
+struct mm;
 struct pipe;
 struct proc;
+struct procinfo;
 struct spinlock;
 struct sleeplock;
+struct rwlock;
+struct seqlock;
 struct stat;
 struct superblock;
+struct sysinfo;
 
 // bio.c
 void binit(void);
@@ -26,6 +33,9 @@ void consputc(int);
 
 // exec.c
 int exec(char*, char**);
+int execfault(struct proc*, uint64);
+void execdone(struct proc*);
+void execstat(struct sysinfo*);
 
 // file.c
 struct file* filealloc(void);
@@ -55,6 +65,11 @@ int readi(struct inode*, int, uint64, uint, uint);
 void stati(struct inode*, struct stat*);
 int writei(struct inode*, int, uint64, uint, uint);
 void itrunc(struct inode*);
+int idenywrite(struct inode*);
+void iallowwrite(struct inode*);
+int igetwrite(struct inode*);
+void iputwrite(struct inode*);
+int ireclaim(void);
 
 // ramdisk.c
 void ramdiskinit(void);
@@ -63,9 +78,16 @@ void ramdiskrw(struct buf*);
 
 // kalloc.c
 void* kalloc(void);
+void* kalloc_order(int);
+void ksplit(void*);
+void* kalloc_zeroed(void);
+int kzero_idle(void);
+void kdup(void*);
+int krefcnt(void*);
 void kfree(void*);
 void kinit(void);
 uint64 freemem(void);
+void kallocstat(struct sysinfo*);
 
 // log.c
 void initlog(int, struct superblock*);
@@ -74,6 +96,7 @@ void begin_op(void);
 void end_op(void);
 
 // pipe.c
+void pipeinit(void);
 int pipealloc(struct file**, struct file**);
 void pipeclose(struct pipe*, int);
 int piperead(struct pipe*, uint64, int);
@@ -85,10 +108,11 @@ void panic(char*) __attribute__((noreturn));
 void printfinit(void);
 
 // proc.c
+extern int schedpolicy;
 int cpuid(void);
 void exit(int);
 int fork(void);
-int growproc(int);
+int growproc(int, int);
 void proc_mapstacks(pagetable_t);
 pagetable_t proc_pagetable(struct proc*);
 void proc_freepagetable(pagetable_t, uint64);
@@ -105,10 +129,24 @@ void sleep(void*, struct spinlock*);
 void userinit(void);
 int wait(uint64);
 void wakeup(void*);
+void wakeup_one(void*);
+int wakeup_n(void*, int);
+void waitqinit(void);
 void yield(void);
+struct proc* procswapbegin(int);
+void procswapend(struct proc*);
 int either_copyout(int user_dst, uint64 dst, void* src, uint64 len);
 int either_copyin(void* dst, int user_src, uint64 src, uint64 len);
 void procdump(void);
+uint64 nproc(void);
+int procinfo(uint64, int);
+void schedstat(struct sysinfo*);
+int preempt(void);
+int clone(uint64, uint64, uint64);
+int join(int, uint64);
+int mmlock(struct proc*);
+void mmunlock(struct proc*);
+void threadstale(struct proc*, int);
 
 // swtch.S
 void swtch(struct context*, struct context*);
@@ -116,16 +154,63 @@ void swtch(struct context*, struct context*);
 // spinlock.c
 void acquire(struct spinlock*);
 int holding(struct spinlock*);
+int holdinglocks(void);
 void initlock(struct spinlock*, char*);
 void release(struct spinlock*);
 void push_off(void);
 void pop_off(void);
+int spinlocked(struct spinlock*);
+int lockstat(uint64, int);
+
+// slab.c
+void slabinit(void);
+struct kmem_cache* kmem_cache_create(char*, uint, void (*)(void*));
+void* kmem_cache_alloc(struct kmem_cache*);
+void kmem_cache_free(struct kmem_cache*, void*);
+
+// mmap.c
+uint64 mmaplimit(struct proc*);
+uint64 mmap(struct file*, uint64, int, int, uint64);
+int munmap(uint64, uint64);
+void mmapclear(struct proc*, pagetable_t);
+int mmapfork(struct proc*, struct proc*);
+int mmapfault(struct proc*, uint64);
+int mmapshared(struct proc*, uint64);
+
+// swap.c
+void swapinit(struct superblock*);
+int swapreclaim(void);
+int swapfault(struct proc*, uint64);
+void swapdup(pte_t);
+void swapfree(pte_t);
+void swapstat(struct sysinfo*);
+
+// pagecache.c
+void pcinit(void);
+char* pcfill(struct inode*, uint, uint);
+void pcinval(struct inode*, uint, uint);
+int pcreclaim(void);
+void pcstat(struct sysinfo*);
 
 // sleeplock.c
 void acquiresleep(struct sleeplock*);
 void releasesleep(struct sleeplock*);
 int holdingsleep(struct sleeplock*);
 void initsleeplock(struct sleeplock*, char*);
+void sleeplockinit(void);
+int sleeplockstat(uint64, int);
+
+// rwlock.c
+void initrwlock(struct rwlock*, char*);
+void racquire(struct rwlock*);
+void rrelease(struct rwlock*);
+void wacquire(struct rwlock*);
+void wrelease(struct rwlock*);
+void initseqlock(struct seqlock*, char*);
+void seqacquire(struct seqlock*);
+void seqrelease(struct seqlock*);
+uint seqbegin(struct seqlock*);
+int seqretry(struct seqlock*, uint);
 
 // string.c
 int memcmp(const void*, const void*, uint);
@@ -135,6 +220,17 @@ char* safestrcpy(char*, const char*, int);
 int strlen(const char*);
 int strncmp(const char*, const char*, uint);
 char* strncpy(char*, const char*, int);
+void* bytememset(void*, int, uint);
+void* wordmemset(void*, int, uint);
+int bytememcmp(const void*, const void*, uint);
+int wordmemcmp(const void*, const void*, uint);
+void* bytememmove(void*, const void*, uint);
+void* wordmemmove(void*, const void*, uint);
+int bytestrlen(const char*);
+int wordstrlen(const char*);
+
+// stringtest.c
+void stringtest(void);
 
 // syscall.c
 void argint(int, int*);
@@ -144,12 +240,22 @@ int fetchstr(uint64, char*, int);
 int fetchaddr(uint64, uint64*);
 void syscall();
 
+// futex.c
+void futexinit(void);
+int futexwait(uint64, int);
+int futexwake(uint64, int);
+
+// timer.c
+void timerqinit(void);
+void timerslice(uint64);
+int timerintr(void);
+int timersleep(uint64);
+
 // trap.c
-extern uint ticks;
 void trapinit(void);
 void trapinithart(void);
-extern struct spinlock tickslock;
 void usertrapret(void);
+void trapstat(struct sysinfo*);
 
 // uart.c
 void uartinit(void);
@@ -159,6 +265,7 @@ void uartputc_sync(int);
 int uartgetc(void);
 
 // vm.c
+extern int nasid;
 void kvminit(void);
 void kvminithart(void);
 void kvmmap(pagetable_t, uint64, uint64, uint64, int);
@@ -166,16 +273,32 @@ int mappages(pagetable_t, uint64, uint64, uint64, int);
 pagetable_t uvmcreate(void);
 void uvmfirst(pagetable_t, uchar*, uint);
 uint64 uvmalloc(pagetable_t, uint64, uint64, int);
+uint64 uvmalloc_super(pagetable_t, uint64, uint64, int);
 uint64 uvmdealloc(pagetable_t, uint64, uint64);
+int uvmsplit(pagetable_t, uint64);
 int uvmcopy(pagetable_t, pagetable_t, uint64);
+void tlbstale(struct proc*);
+int uvmcopyrange(pagetable_t, pagetable_t, uint64, uint64, int);
+int uvmcow(pagetable_t, uint64);
+int uvmtrap(struct proc*, uint64, uint64);
+int uvmprefault(uint64, int, int);
+void uvmresident(struct mm*, long);
+void uvmacct(struct mm*, struct procinfo*);
+void uvmrecount(pagetable_t, struct mm*);
+void vmstat(struct sysinfo*);
 void uvmfree(pagetable_t, uint64);
 void uvmunmap(pagetable_t, uint64, uint64, int);
 void uvmclear(pagetable_t, uint64);
 pte_t* walk(pagetable_t, uint64, int);
+pte_t* walklevel(pagetable_t, uint64, int, int);
+pte_t* walkleaf(pagetable_t, uint64, uint64*);
 uint64 walkaddr(pagetable_t, uint64);
 int copyout(pagetable_t, uint64, char*, uint64);
 int copyin(pagetable_t, char*, uint64, uint64);
 int copyinstr(pagetable_t, char*, uint64, uint64);
+int copyin_batch(pagetable_t, struct copyseg*, int);
+uint64 useraddr(pagetable_t, uint64, int, uint64*);
+void vmprint(pagetable_t, struct mm*);
 
 // plic.c
 void plicinit(void);
@@ -186,6 +309,7 @@ void plic_complete(int);
 // virtio_disk.c
 void virtio_disk_init(void);
 void virtio_disk_rw(struct buf*, int);
+void virtio_disk_rwpages(uint, char**, int, int);
 void virtio_disk_intr(void);
 
 // number of elements in fixed-size array
@@ -5,12 +5,22 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
+#include "fs.h"
+#include "file.h"
 #include "defs.h"
 #include "elf.h"
+#include "sysinfo.h"
 
 static int loadseg(pde_t*, uint64, struct inode*, uint, uint);
 
+struct {
+    uint64 n;      // 已经回到用户态的 exec 次数
+    uint64 cycles; // exec 开始到执行第一条用户指令的总时间
+    uint64 pagein; // 按需从可执行文件读入的页数
+} execcount;
+
 int flags2perm(int flags) {
     int perm = 0;
     if (flags & 0x1)
@@ -20,16 +30,23 @@ int flags2perm(int flags) {
     return perm;
 }
 
+// 程序段不在 exec 时读入，而是记录在 seg[] 中，第一次访问时由 execfault()
+// 从可执行文件读入。进程持有可执行文件 inode 的引用直到下一次 exec 或 exit。
+// 有多个线程的进程不能 exec。
 int exec(char* path, char** argv) {
     char *s, *last;
-    int i, off;
-    uint64 argc, sz = 0, sp, ustack[MAXARG], stackbase;
+    int i, off, nseg = 0;
+    uint64 argc, sz = 0, sp, ustack[MAXARG], stackbase, start;
     struct elfhdr elf;
-    struct inode* ip;
+    struct inode *ip, *exe = 0, *oldexe;
     struct proghdr ph;
+    struct execseg seg[NEXECSEG];
     pagetable_t pagetable = 0, oldpagetable;
     struct proc* p = myproc();
 
+    if (__atomic_load_n(&p->mm->nthread, __ATOMIC_RELAXED) > 1)
+        return -1;
+    start = r_time();
     begin_op();
 
     if ((ip = namei(path)) == 0) {
@@ -61,21 +78,38 @@ int exec(char* path, char** argv) {
             goto bad;
         if (ph.vaddr % PGSIZE != 0)
             goto bad;
+        if (ph.vaddr < PGROUNDUP(sz) || ph.vaddr + ph.memsz > TRAPFRAMES)
+            goto bad;
+        if (nseg < NEXECSEG) {
+            // 只记录下来，缺页时再读入
+            seg[nseg].va = ph.vaddr;
+            seg[nseg].memsz = ph.memsz;
+            seg[nseg].filesz = ph.filesz;
+            seg[nseg].off = ph.off;
+            seg[nseg].perm = PTE_R | PTE_U | flags2perm(ph.flags);
+            nseg++;
+            sz = ph.vaddr + ph.memsz;
+            continue;
+        }
         uint64 sz1;
         // 分配虚拟内存
-        if ((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz, flags2perm(ph.flags))) == 0)
+        if ((sz1 = uvmalloc(pagetable, ph.vaddr, ph.vaddr + ph.memsz, flags2perm(ph.flags))) == 0)
             goto bad;
         sz = sz1;
         // 将程序段加载到虚拟内存中
         if (loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
             goto bad;
     }
-    iunlockput(ip);
+    // 代码页在缺页时才从文件读入，运行期间文件不能再被改写
+    if (idenywrite(ip) < 0)
+        goto bad;
+    iunlock(ip);
     end_op();
+    exe = ip;
     ip = 0;
 
     p = myproc();
-    uint64 oldsz = p->sz;
+    uint64 oldsz = p->mm->sz;
 
     // 构建用户栈
     // Allocate some pages at the next page boundary.
@@ -126,11 +160,25 @@ int exec(char* path, char** argv) {
 
     // Commit to the user image.
     oldpagetable = p->pagetable;
+    oldexe = p->mm->exe;
     p->pagetable = pagetable;
-    p->sz = sz;
+    tlbstale(p); // 作废旧页表的翻译缓存
+    p->mm->sz = sz;
+    p->mm->exe = exe;
+    memmove(p->mm->seg, seg, sizeof(seg));
+    p->mm->nseg = nseg;
+    uvmrecount(pagetable, p->mm);
+    p->execstart = start;
     p->trapframe->epc = elf.entry; // initial program counter = main
     p->trapframe->sp = sp;         // initial stack pointer
+    mmapclear(p, oldpagetable);
     proc_freepagetable(oldpagetable, oldsz);
+    if (oldexe) {
+        iallowwrite(oldexe);
+        begin_op();
+        iput(oldexe);
+        end_op();
+    }
 
     return argc; // this ends up in a0, the first argument to main(argc, argv)
 
@@ -141,9 +189,84 @@ bad:
         iunlockput(ip);
         end_op();
     }
+    if (exe) {
+        iallowwrite(exe);
+        begin_op();
+        iput(exe);
+        end_op();
+    }
     return -1;
 }
 
+// 用户地址 va 缺页，且 va 落在 exec 记录的程序段中：分配一页，读入段在文件
+// 中的内容，.bss 部分保持为零，然后按段的权限映射。
+// va 不在任何程序段中时返回 1，交给调用者按堆页处理；页已经映射(比如
+// 写只读的代码段)、读文件失败或内存不足时返回 -1。调用者持有 mmlock()。
+int execfault(struct proc* p, uint64 va) {
+    struct execseg* s;
+    uint64 off, n, sz;
+    char* mem;
+    int r;
+
+    va = PGROUNDDOWN(va);
+    for (s = p->mm->seg; s < &p->mm->seg[p->mm->nseg]; s++)
+        if (va >= s->va && va < s->va + s->memsz)
+            break;
+    if (s == &p->mm->seg[p->mm->nseg])
+        return 1;
+    if (walkleaf(p->pagetable, va, &sz) != 0)
+        return -1;
+
+    off = va - s->va;
+    n = 0;
+    if (off < s->filesz) {
+        n = s->filesz - off;
+        if (n > PGSIZE)
+            n = PGSIZE;
+    }
+    if (n > 0 && (s->perm & PTE_W) == 0) {
+        // 只读段的页经页缓存在运行同一文件的进程间共享
+        ilock(p->mm->exe);
+        mem = pcfill(p->mm->exe, s->off + off, n);
+        iunlock(p->mm->exe);
+        if (mem == 0)
+            return -1;
+    } else {
+        if ((mem = kalloc_zeroed()) == 0)
+            return -1;
+        if (n > 0) {
+            // 持有 inode 锁的 copyin/copyout 不处理缺页，这里不会重复加锁
+            ilock(p->mm->exe);
+            r = readi(p->mm->exe, 0, (uint64)mem, s->off + off, n);
+            iunlock(p->mm->exe);
+            if (r != n) {
+                kfree(mem);
+                return -1;
+            }
+        }
+    }
+    if (mappages(p->pagetable, va, PGSIZE, (uint64)mem, s->perm) != 0) {
+        kfree(mem);
+        return -1;
+    }
+    __atomic_add_fetch(&execcount.pagein, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+// exec 之后第一次返回用户态，由 usertrapret() 调用
+void execdone(struct proc* p) {
+    __atomic_add_fetch(&execcount.n, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&execcount.cycles, r_time() - p->execstart, __ATOMIC_RELAXED);
+    p->execstart = 0;
+}
+
+// 汇总 exec 的统计
+void execstat(struct sysinfo* info) {
+    info->execs = execcount.n;
+    info->execcycles = execcount.cycles;
+    info->pagein = execcount.pagein;
+}
+
 // Load a program segment into pagetable at virtual address va.
 // va must be page-aligned
 // and the pages from va to va+sz must already be mapped.
@@ -15,30 +15,31 @@
 #include "stat.h"
 #include "proc.h"
 
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
 struct devsw devsw[NDEV];
+
+// file 结构从 slab 缓存中分配，数量只受内存限制。
+// ftable.lock 保护所有 file 的 ref。
 struct {
     struct spinlock lock;
-    struct file file[NFILE];
+    struct kmem_cache* cache;
 } ftable;
 
 void fileinit(void) {
     initlock(&ftable.lock, "ftable");
+    ftable.cache = kmem_cache_create("file", sizeof(struct file), 0);
 }
 
 // Allocate a file structure.
 struct file* filealloc(void) {
     struct file* f;
 
-    acquire(&ftable.lock);
-    for (f = ftable.file; f < ftable.file + NFILE; f++) {
-        if (f->ref == 0) {
-            f->ref = 1;
-            release(&ftable.lock);
-            return f;
-        }
-    }
-    release(&ftable.lock);
-    return 0;
+    if ((f = kmem_cache_alloc(ftable.cache)) == 0)
+        return 0;
+    memset(f, 0, sizeof(*f));
+    f->ref = 1;
+    return f;
 }
 
 // Increment ref count for file f.
@@ -66,10 +67,13 @@ void fileclose(struct file* f) {
     f->ref = 0;
     f->type = FD_NONE;
     release(&ftable.lock);
+    kmem_cache_free(ftable.cache, f);
 
     if (ff.type == FD_PIPE) {
         pipeclose(ff.pipe, ff.writable);
     } else if (ff.type == FD_INODE || ff.type == FD_DEVICE) {
+        if (ff.type == FD_INODE && ff.writable)
+            iputwrite(ff.ip);
         begin_op();
         iput(ff.ip);
         end_op();
@@ -108,10 +112,24 @@ int fileread(struct file* f, uint64 addr, int n) {
             return -1;
         r = devsw[f->major].read(1, addr, n);
     } else if (f->type == FD_INODE) {
-        ilock(f->ip);
-        if ((r = readi(f->ip, 1, addr, f->off, n)) > 0)
-            f->off += r;
-        iunlock(f->ip);
+        // 持有 inode 锁时不处理缺页：readi 停在缺页处后放锁，
+        // 把下一块的用户页准备好再继续。
+        struct proc* p = myproc();
+        int m = 0;
+        for (;;) {
+            p->faultskip = 0;
+            ilock(f->ip);
+            if ((m = readi(f->ip, 1, addr + r, f->off, n - r)) > 0) {
+                f->off += m;
+                r += m;
+            }
+            iunlock(f->ip);
+            if (r == n || !p->faultskip ||
+                uvmprefault(addr + r, min(BSIZE, n - r), 1) < 0)
+                break;
+        }
+        if (r == 0 && m < 0)
+            r = -1;
     } else {
         panic("fileread");
     }
@@ -147,18 +165,26 @@ int filewrite(struct file* f, uint64 addr, int n) {
             if (n1 > max)
                 n1 = max;
 
+            myproc()->faultskip = 0;
             begin_op();
             ilock(f->ip);
-            if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
+            if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0) {
+                // 页缓存中被覆盖的页不再有效
+                pcinval(f->ip, f->off, r);
                 f->off += r;
+            }
             iunlock(f->ip);
             end_op();
 
+            if (r > 0)
+                i += r;
             if (r != n1) {
-                // error from writei
+                // 缺页时在锁外准备好下一块再继续，否则是 writei 出错
+                if (myproc()->faultskip &&
+                    uvmprefault(addr + i, min(BSIZE, n - i), 0) == 0)
+                    continue;
                 break;
             }
-            i += r;
         }
         ret = (i == n ? n : -1);
     } else {
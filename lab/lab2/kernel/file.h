@@ -18,6 +18,7 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  int writecount;     // 打开来写的 file 数，为负时是运行它的地址空间数；由 itable.lock 保护
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -27,6 +28,10 @@ struct inode {
   short nlink;
   uint size;
   uint addrs[NDIRECT+1];
+
+  struct inode *next; // itable 链表，由 itable.lock 保护
+  struct inode *lrunext; // 没有引用的 inode 的 LRU 链表，由 itable.lock 保护
+  struct inode *lruprev;
 };
 
 // map major device number to device functions.
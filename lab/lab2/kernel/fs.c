@@ -52,6 +52,7 @@ void fsinit(int dev) {
     if (sb.magic != FSMAGIC)
         panic("invalid file system");
     initlog(dev, &sb);
+    swapinit(&sb);
 }
 
 // Zero a block.
@@ -174,26 +175,98 @@ bfree(int dev, uint b) {
 // and ip->dev and ip->inum indicate which i-node an entry
 // holds, one must hold itable.lock while using any of those fields.
 //
+// 内存中的 inode 从 slab 缓存分配，itable 只是一条链表，所以被引用的
+// inode 的数量不再受 NINODE 限制。最后一个引用释放后，有效的 inode 留在
+// 链表中并挂上 LRU 链表，再次 iget() 时不用重新读盘；这样的 inode 最多
+// 保留 NINODE 个，多出的从最久没用的开始还给 slab 缓存。内存不足时
+// ireclaim() 把它们全部还掉。
+//
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
 struct {
     struct spinlock lock;
-    struct inode inode[NINODE];
+    struct inode* head;    // 所有内存中的 inode
+    struct inode* lruhead; // 其中 ref == 0 的，最近释放的在前
+    struct inode* lrutail;
+    int nlru;
+    struct kmem_cache* cache;
 } itable;
 
-void iinit() {
-    int i = 0;
+// slab 构造函数：对象进入缓存时初始化一次睡眠锁
+static void inode_ctor(void* obj) {
+    initsleeplock(&((struct inode*)obj)->lock, "inode");
+}
 
+void iinit() {
     initlock(&itable.lock, "itable");
-    for (i = 0; i < NINODE; i++) {
-        initsleeplock(&itable.inode[i].lock, "inode");
-    }
+    itable.cache = kmem_cache_create("inode", sizeof(struct inode), inode_ctor);
 }
 
 static struct inode* iget(uint dev, uint inum);
 
+// 以下都由调用者持有 itable.lock
+
+static void lruremove(struct inode* ip) {
+    if (ip->lruprev)
+        ip->lruprev->lrunext = ip->lrunext;
+    else
+        itable.lruhead = ip->lrunext;
+    if (ip->lrunext)
+        ip->lrunext->lruprev = ip->lruprev;
+    else
+        itable.lrutail = ip->lruprev;
+    ip->lrunext = ip->lruprev = 0;
+    itable.nlru--;
+}
+
+static void lrupush(struct inode* ip) {
+    ip->lruprev = 0;
+    ip->lrunext = itable.lruhead;
+    if (itable.lruhead)
+        itable.lruhead->lruprev = ip;
+    else
+        itable.lrutail = ip;
+    itable.lruhead = ip;
+    itable.nlru++;
+}
+
+// 从 itable 中摘下没有引用的 ip
+static void iunlink(struct inode* ip) {
+    struct inode** pp;
+
+    for (pp = &itable.head; *pp != ip; pp = &(*pp)->next)
+        ;
+    *pp = ip->next;
+}
+
+// 把 LRU 链表中最久没用的 inode 摘下来，没有时返回 0
+static struct inode* ievict(void) {
+    struct inode* ip;
+
+    if ((ip = itable.lrutail) == 0)
+        return 0;
+    lruremove(ip);
+    iunlink(ip);
+    return ip;
+}
+
+// 内存不足时调用：把没有引用的 inode 都还给 slab 缓存，返回个数。
+// 不能在 kalloc() 中调用，iget() 持有 itable.lock 分配。
+int ireclaim(void) {
+    struct inode* ip;
+    int n = 0;
+
+    acquire(&itable.lock);
+    while ((ip = ievict()) != 0) {
+        kmem_cache_free(itable.cache, ip);
+        n++;
+    }
+    release(&itable.lock);
+    return n;
+}
+
 // Allocate an inode on device dev.
 // Mark it as allocated by  giving it type type.
 // Returns an unlocked but allocated and referenced inode,
@@ -245,31 +318,31 @@ void iupdate(struct inode* ip) {
 // the inode and does not read it from disk.
 static struct inode*
 iget(uint dev, uint inum) {
-    struct inode *ip, *empty;
+    struct inode* ip;
 
     acquire(&itable.lock);
 
     // Is the inode already in the table?
-    empty = 0;
-    for (ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++) {
-        if (ip->ref > 0 && ip->dev == dev && ip->inum == inum) {
-            ip->ref++;
+    for (ip = itable.head; ip; ip = ip->next) {
+        if (ip->dev == dev && ip->inum == inum) {
+            if (ip->ref++ == 0)
+                lruremove(ip); // 缓存中没有引用的 inode，不用再读盘
             release(&itable.lock);
             return ip;
         }
-        if (empty == 0 && ip->ref == 0) // Remember empty slot.
-            empty = ip;
     }
 
-    // Recycle an inode entry.
-    if (empty == 0)
+    // Allocate a new in-memory inode. 内存不足时重用最久没用的 inode。
+    if ((ip = kmem_cache_alloc(itable.cache)) == 0 && (ip = ievict()) == 0)
         panic("iget: no inodes");
 
-    ip = empty;
     ip->dev = dev;
     ip->inum = inum;
     ip->ref = 1;
+    ip->writecount = 0;
     ip->valid = 0;
+    ip->next = itable.head;
+    itable.head = ip;
     release(&itable.lock);
 
     return ip;
@@ -285,16 +358,60 @@ idup(struct inode* ip) {
     return ip;
 }
 
+// 正在运行的可执行文件不能写，否则按需读入的代码页会新旧混杂：
+// exec 用 idenywrite() 记下一个运行它的地址空间，文件已经打开来写时失败；
+// 打开文件来写或截断用 igetwrite()，文件正在运行时失败。它们分别由
+// iallowwrite() 和 iputwrite() 撤销。
+int idenywrite(struct inode* ip) {
+    int r = -1;
+
+    acquire(&itable.lock);
+    if (ip->writecount <= 0) {
+        ip->writecount--;
+        r = 0;
+    }
+    release(&itable.lock);
+    return r;
+}
+
+void iallowwrite(struct inode* ip) {
+    acquire(&itable.lock);
+    ip->writecount++;
+    release(&itable.lock);
+}
+
+int igetwrite(struct inode* ip) {
+    int r = -1;
+
+    acquire(&itable.lock);
+    if (ip->writecount >= 0) {
+        ip->writecount++;
+        r = 0;
+    }
+    release(&itable.lock);
+    return r;
+}
+
+void iputwrite(struct inode* ip) {
+    acquire(&itable.lock);
+    ip->writecount--;
+    release(&itable.lock);
+}
+
 // Lock the given inode.
 // Reads the inode from disk if necessary.
+// 持有 inode 锁时 copyin/copyout 不处理缺页，见 vm.c 的 uvmaddr()。
 void ilock(struct inode* ip) {
     struct buf* bp;
     struct dinode* dip;
+    struct proc* p;
 
     if (ip == 0 || ip->ref < 1)
         panic("ilock");
 
     acquiresleep(&ip->lock);
+    if ((p = myproc()) != 0)
+        p->ilocks++;
 
     if (ip->valid == 0) {
         bp = bread(ip->dev, IBLOCK(ip->inum, sb));
@@ -314,9 +431,13 @@ void ilock(struct inode* ip) {
 
 // Unlock the given inode.
 void iunlock(struct inode* ip) {
+    struct proc* p;
+
     if (ip == 0 || !holdingsleep(&ip->lock) || ip->ref < 1)
         panic("iunlock");
 
+    if ((p = myproc()) != 0)
+        p->ilocks--;
     releasesleep(&ip->lock);
 }
 
@@ -350,6 +471,18 @@ void iput(struct inode* ip) {
     }
 
     ip->ref--;
+    if (ip->ref == 0) {
+        // 最后一个引用：有效的 inode 留着以后再用，超出 NINODE 个时
+        // 还掉最久没用的；无效的(比如刚刚释放了磁盘上的 inode)直接还掉
+        if (ip->valid) {
+            lrupush(ip);
+            ip = itable.nlru > NINODE ? ievict() : 0;
+        } else {
+            iunlink(ip);
+        }
+        if (ip)
+            kmem_cache_free(itable.cache, ip);
+    }
     release(&itable.lock);
 }
 
@@ -416,6 +549,8 @@ void itrunc(struct inode* ip) {
     struct buf* bp;
     uint* a;
 
+    pcinval(ip, 0, MAXFILE * BSIZE);
+
     for (i = 0; i < NDIRECT; i++) {
         if (ip->addrs[i]) {
             bfree(ip->dev, ip->addrs[i]);
@@ -469,8 +604,10 @@ int readi(struct inode* ip, int user_dst, uint64 dst, uint off, uint n) {
         bp = bread(ip->dev, addr);
         m = min(n - tot, BSIZE - off % BSIZE);
         if (either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
+            // 返回已经复制的字节数，一个字节也没有复制时返回 -1
             brelse(bp);
-            tot = -1;
+            if (tot == 0)
+                tot = -1;
             break;
         }
         brelse(bp);
@@ -0,0 +1,101 @@
+// futex
+//
+// 用户态的锁在没有竞争时只用原子指令，需要等待时才进入内核：
+// futex_wait(addr, val) 在 *addr 仍等于 val 时睡眠，futex_wake(addr, n)
+// 唤醒至多 n 个在 addr 上等待的线程。等待队列就是 sleep()/wakeup() 的，
+// chan 是 futex 的键：
+//  - 私有内存中的字以(地址空间, 虚拟地址)为键，共用页表的线程在同一个
+//    字上同步。不能用物理地址：fork() 之后这一页变成写时复制，下一次写会
+//    把字搬到新的物理页上，等待者就再也等不到唤醒。
+//  - MAP_SHARED 映射中的字以物理地址为键，映射同一文件页的进程共用
+//    页缓存中的这一页，也能在同一个字上同步。
+//
+// 检查 *addr 和入睡在 chan 所在桶的锁内完成；唤醒者先改 *addr、再获取
+// 同一个锁，不会错过等待者。等待者可能被提前唤醒(比如被 kill，或者页被
+// 释放后另作他用)，用户态要重新检查条件。
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "fcntl.h"
+#include "defs.h"
+
+#define NFUTEX 64 // 桶数
+
+extern struct proc proc[NPROC];
+
+struct spinlock futexlock[NFUTEX];
+
+void futexinit(void) {
+    for (int i = 0; i < NFUTEX; i++)
+        initlock(&futexlock[i], "futex");
+}
+
+static struct spinlock* futexq(uint64 key) {
+    return &futexlock[(key * 0x9e3779b97f4a7c15UL) >> 58]; // Fibonacci 哈希，取高 6 位
+}
+
+// 当前进程的用户字 addr 的键和物理地址，write 不为 0 时要求可写。
+// 私有的键是 (i + 1) * MAXVA + addr，mm 是 proc[i].mmown：各不相同，
+// 而且都在物理内存和内核的 chan 之上。*pin 同 useraddr()。
+// addr 没有 4 字节对齐或不可访问时返回 0。
+static uint64 futexkey(uint64 addr, int write, uint64* pa, uint64* pin) {
+    struct proc* p = myproc();
+    uint64 i;
+    int shared;
+
+    *pin = 0;
+    if (addr % sizeof(int) != 0 || addr >= MAXVA)
+        return 0;
+    mmlock(p);
+    shared = mmapshared(p, addr);
+    mmunlock(p);
+    if ((*pa = useraddr(p->pagetable, addr, write, pin)) == 0)
+        return 0;
+    if (shared)
+        return *pa;
+    i = ((char*)p->mm - (char*)proc) / sizeof(struct proc);
+    return (i + 1) * MAXVA + addr;
+}
+
+// *addr 等于 val 时睡眠到被 futexwake() 唤醒，返回 0。
+// *addr 已经改变、地址无效或被 kill 时返回 -1。只读的字上也可以等待。
+int futexwait(uint64 addr, int val) {
+    struct spinlock* lk;
+    uint64 key, pa, pin;
+    int r = 0;
+
+    if ((key = futexkey(addr, 0, &pa, &pin)) == 0)
+        return -1;
+    lk = futexq(key);
+    acquire(lk);
+    if (__atomic_load_n((int*)pa, __ATOMIC_RELAXED) != val || killed(myproc()))
+        r = -1;
+    if (pin != 0)
+        kfree((void*)pin); // 已经读过了，睡眠期间不必留住这一页
+    if (r == 0)
+        sleep((void*)key, lk);
+    release(lk);
+    return r;
+}
+
+// 唤醒至多 n 个在 addr 上等待的线程，返回唤醒的个数，地址无效或不可写时返回 -1
+int futexwake(uint64 addr, int n) {
+    struct spinlock* lk;
+    uint64 key, pa, pin;
+
+    if ((key = futexkey(addr, 1, &pa, &pin)) == 0)
+        return -1;
+    if (pin != 0)
+        kfree((void*)pin);
+    if (n <= 0)
+        return 0;
+    lk = futexq(key);
+    acquire(lk);
+    n = wakeup_n((void*)key, n);
+    release(lk);
+    return n;
+}
@@ -2,6 +2,10 @@
 //
 // 用于用户进程、内核栈、页表页、以及管道缓冲区。
 // 分配整个 4096 字节的页面。
+//
+// 每个 CPU 拥有自己的空闲页缓存，kalloc/kfree 通常只碰本 CPU 的锁；
+// 缓存与全局空闲池之间按批(KBATCH 页)搬运。本 CPU 缓存和全局池都空时，
+// 从其他 CPU 的缓存偷取一批。
 
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
@@ -12,7 +16,18 @@
 #include "memlayout.h"
 #include "spinlock.h"
 #include "riscv.h"
+#include "sysinfo.h"
 #include "defs.h"
+#include "proc.h"
+
+#define KBATCH 32              // 每次在 CPU 缓存与全局池之间搬运的页数
+#define KCACHE_MAX (2 * KBATCH) // CPU 缓存超过该值时归还一批到全局池
+#define KZERO_MAX 256           // 预先清零的页池的容量
+#define KZERO_IDLE 4            // 空闲循环每次清零的页数
+
+#define NPAGE ((PHYSTOP - KERNBASE) / PGSIZE)
+#define PA2PG(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+#define PG2PA(i) (KERNBASE + (uint64)(i) * PGSIZE)
 
 void freerange(void* pa_start, void* pa_end);
 
@@ -21,47 +36,388 @@ extern char end[]; // first address after kernel.
 
 struct run {
     struct run* next;
+    struct run* prev; // 只在伙伴系统的空闲链表中使用
+};
+
+// 每个 CPU 的空闲页缓存，只存放单页
+struct kmem {
+    struct spinlock lock;
+    struct run* freelist;
+    int nfree; // freelist 上的页数
+};
+
+struct kmem kcpu[NCPU];
+
+// 全局空闲池：二进制伙伴分配器。
+// 阶为 k 的块包含 2^k 个连续页，起始地址按 2^k 页对齐。
+struct {
+    struct spinlock lock;
+    struct run* free[MAXORDER + 1];
+    uint64 nfree[MAXORDER + 1]; // 各阶空闲块数
+} buddy;
+
+// 每个物理页的元数据，order 和 flags 只在持有 buddy.lock 时修改；
+// 已分配块的持有者(kfree、ksplit)可以不加锁读取首页的 order 和 flags
+struct kpage {
+    uchar order; // 块的阶，只在块首页有效
+    uchar flags;
+    int ref;     // 引用计数，写时复制共享时大于 1；用原子操作更新
 };
+#define KPG_FREE 0x1 // 空闲块的首页，挂在 buddy.free[order] 上
+#define KPG_HEAD 0x2 // kalloc_order() 分配出去的多页块的首页
+
+struct kpage kpage[NPAGE];
 
+// 分配器锁的统计，只由所属 CPU 在关中断时更新
+struct kstat {
+    uint64 nlock;    // 获取分配器锁的次数
+    uint64 ncontend; // 获取时锁已被其他 CPU 持有的次数
+    uint64 nsteal;   // 从其他 CPU 缓存偷取的次数
+} kstat[NCPU];
+
+// 预先清零的空闲页池，由空闲的 CPU 在调度循环里填充，kalloc_zeroed() 从中取页。
+// 池中的页仍算作空闲内存，内存紧张时 kalloc() 也会从这里取。
 struct {
     struct spinlock lock;
     struct run* freelist;
-} kmem;
+    int nfree;
+    uint64 nhit;  // kalloc_zeroed() 直接拿到清零页的次数
+    uint64 nmiss; // 池为空、只好同步清零的次数
+} kzero;
+
+// 页计数，用原子操作增量维护，读取时不需要分配器的锁
+struct {
+    uint64 total; // 分配器管理的总页数，kinit 之后不再变化
+    uint64 free;  // 当前空闲页数
+    uint64 peak;  // 已用页数的最高水位
+} kcount;
+
+static void bfree(struct run* r, int order);
 
 void kinit() {
-    initlock(&kmem.lock, "kmem");
+    initlock(&buddy.lock, "kmem");
+    initlock(&kzero.lock, "kmem_zero");
+    for (int i = 0; i < NCPU; i++)
+        initlock(&kcpu[i].lock, "kmem_cpu");
     freerange(end, (void*)PHYSTOP);
 }
 
+// 启动时把空闲内存直接交给伙伴分配器，相邻页会合并成大块
 void freerange(void* pa_start, void* pa_end) {
     char* p;
     p = (char*)PGROUNDUP((uint64)pa_start);
+    acquire(&buddy.lock);
     for (; p + PGSIZE <= (char*)pa_end; p += PGSIZE) {
-        kfree(p);
+        kcount.total++;
+        kcount.free++;
+        bfree((struct run*)p, 0);
+    }
+    release(&buddy.lock);
+}
+
+// 获取 lk 并记录争用情况。
+// 调用者必须已关中断(push_off)，id 为当前 CPU。
+static void klock(struct spinlock* lk, int id) {
+    kstat[id].nlock++;
+    if (spinlocked(lk))
+        kstat[id].ncontend++;
+    acquire(lk);
+}
+
+// 把阶为 order 的空闲块 r 挂到伙伴空闲链表上。
+// 调用者持有 buddy.lock。
+static void bpush(struct run* r, int order) {
+    struct kpage* pg = &kpage[PA2PG(r)];
+
+    r->prev = 0;
+    r->next = buddy.free[order];
+    if (r->next)
+        r->next->prev = r;
+    buddy.free[order] = r;
+    buddy.nfree[order]++;
+    pg->order = order;
+    pg->flags = KPG_FREE;
+}
+
+// 把空闲块 r 从伙伴空闲链表上摘下。
+// 调用者持有 buddy.lock。
+static void bremove(struct run* r, int order) {
+    if (r->prev)
+        r->prev->next = r->next;
+    else
+        buddy.free[order] = r->next;
+    if (r->next)
+        r->next->prev = r->prev;
+    buddy.nfree[order]--;
+    kpage[PA2PG(r)].flags = 0;
+}
+
+// 分配一个阶为 order 的块，必要时拆分更大的块。
+// 调用者持有 buddy.lock。没有足够大的块时返回 0。
+static struct run* balloc(int order) {
+    struct run* r;
+    int k;
+
+    for (k = order; k <= MAXORDER && buddy.free[k] == 0; k++)
+        ;
+    if (k > MAXORDER)
+        return 0;
+    r = buddy.free[k];
+    bremove(r, k);
+    // 把多出来的后半部分依次还给低一阶的链表
+    while (k > order) {
+        k--;
+        bpush((struct run*)((char*)r + ((uint64)PGSIZE << k)), k);
+    }
+    kpage[PA2PG(r)].order = order;
+    return r;
+}
+
+// 释放阶为 order 的块 r，并与空闲的伙伴逐级合并。
+// 调用者持有 buddy.lock。
+static void bfree(struct run* r, int order) {
+    uint64 i = PA2PG(r);
+
+    while (order < MAXORDER) {
+        uint64 b = i ^ (1UL << order);
+        if (b >= NPAGE || (kpage[b].flags & KPG_FREE) == 0 || kpage[b].order != order)
+            break;
+        bremove((struct run*)PG2PA(b), order);
+        i &= ~(1UL << order);
+        order++;
+    }
+    bpush((struct run*)PG2PA(i), order);
+}
+
+// 从 m 的空闲链表头部摘下至多 n 页。
+// 返回摘下链表的头，*tail 为尾，*got 为页数。
+// 调用者持有 m->lock。
+static struct run* ktake(struct kmem* m, int n, struct run** tail, int* got) {
+    struct run *head, *r;
+    int i;
+
+    head = m->freelist;
+    if (head == 0 || n <= 0) {
+        *got = 0;
+        return 0;
+    }
+    r = head;
+    for (i = 1; i < n && r->next; i++)
+        r = r->next;
+    m->freelist = r->next;
+    m->nfree -= i;
+    r->next = 0;
+    *tail = r;
+    *got = i;
+    return head;
+}
+
+// 将 [head, tail] 共 n 页挂到 m 的空闲链表上。
+// 调用者持有 m->lock。
+static void kput(struct kmem* m, struct run* head, struct run* tail, int n) {
+    tail->next = m->freelist;
+    m->freelist = head;
+    m->nfree += n;
+}
+
+// 从伙伴分配器取至多 n 个单页，串成链表返回。
+static struct run* bbatch(int id, int n, struct run** tail, int* got) {
+    struct run *head = 0, *r;
+    int i;
+
+    klock(&buddy.lock, id);
+    for (i = 0; i < n && (r = balloc(0)) != 0; i++) {
+        r->next = head;
+        head = r;
+        if (i == 0)
+            *tail = r;
     }
+    release(&buddy.lock);
+    *got = i;
+    return head;
+}
+
+// 把链表 head 上的单页逐个还给伙伴分配器
+static void bdrain(int id, struct run* head) {
+    struct run* r;
+
+    klock(&buddy.lock, id);
+    while ((r = head) != 0) {
+        head = r->next;
+        bfree(r, 0);
+    }
+    release(&buddy.lock);
+}
+
+// CPU id 的缓存为空：先从伙伴分配器取一批，全局池也空就从兄弟 CPU 偷一批。
+// 返回一页，剩余的放进本 CPU 的缓存。没有空闲页时返回 0。
+static struct run* krefill(int id) {
+    struct run *head, *tail;
+    int got;
+
+    head = bbatch(id, KBATCH, &tail, &got);
+
+    for (int i = 1; head == 0 && i < NCPU; i++) {
+        struct kmem* victim = &kcpu[(id + i) % NCPU];
+        if (victim->nfree == 0)
+            continue;
+        klock(&victim->lock, id);
+        head = ktake(victim, (victim->nfree + 1) / 2, &tail, &got);
+        release(&victim->lock);
+        if (head)
+            kstat[id].nsteal++;
+    }
+
+    if (head == 0)
+        return 0;
+    if (got > 1) {
+        klock(&kcpu[id].lock, id);
+        kput(&kcpu[id], head->next, tail, got - 1);
+        release(&kcpu[id].lock);
+    }
+    return head;
+}
+
+// 把所有 CPU 缓存中的页还给伙伴分配器，让它们有机会合并成大块
+static void kdrain(int id) {
+    struct run *head, *tail;
+    int got;
+
+    for (int i = 0; i < NCPU; i++) {
+        klock(&kcpu[i].lock, id);
+        head = ktake(&kcpu[i], kcpu[i].nfree, &tail, &got);
+        release(&kcpu[i].lock);
+        if (head)
+            bdrain(id, head);
+    }
+}
+
+// 分配了 n 页：更新空闲页数和已用页数的最高水位
+static void kcount_alloc(uint64 n) {
+    uint64 used, peak;
+
+    used = kcount.total - __atomic_sub_fetch(&kcount.free, n, __ATOMIC_RELAXED);
+    peak = __atomic_load_n(&kcount.peak, __ATOMIC_RELAXED);
+    while (used > peak &&
+           !__atomic_compare_exchange_n(&kcount.peak, &peak, used, 0,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
 }
 
 // Free the page of physical memory pointed at by pa,
 // which normally should have been returned by a
 // call to kalloc().  (The exception is when
 // initializing the allocator; see kinit above.)
+// kalloc_order() 分配的多页块也用 kfree 释放整块。
 void kfree(void* pa) {
-    struct run* r;
+    struct run *r, *head, *tail;
+    struct kmem* c;
+    struct kpage* pg;
+    int id, got = 0;
 
     if (((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
         panic("kfree");
 
-#ifndef LAB_SYSCALL
+    r = (struct run*)pa;
+    pg = &kpage[PA2PG(pa)];
+
+    // 写时复制共享的页，只有最后一个引用释放时才真正回收
+    int ref = __atomic_sub_fetch(&pg->ref, 1, __ATOMIC_ACQ_REL);
+    if (ref > 0)
+        return;
+    if (ref < 0)
+        panic("kfree: ref");
+
+    if (pg->flags & KPG_HEAD) {
+        int order = pg->order;
+#ifdef KJUNK
+        memset(pa, 1, (uint64)PGSIZE << order);
+#endif
+        __atomic_add_fetch(&kcount.free, 1UL << order, __ATOMIC_RELAXED);
+        push_off();
+        id = cpuid();
+        klock(&buddy.lock, id);
+        pg->flags = 0;
+        bfree(r, order);
+        release(&buddy.lock);
+        pop_off();
+        return;
+    }
+
+#ifdef KJUNK
     // Fill with junk to catch dangling refs.
     memset(pa, 1, PGSIZE);
 #endif
 
-    r = (struct run*)pa;
+    // 先计数再入链表，这样并发的 kalloc 不会把 free 减到负数
+    __atomic_add_fetch(&kcount.free, 1, __ATOMIC_RELAXED);
 
-    acquire(&kmem.lock);
-    r->next = kmem.freelist;
-    kmem.freelist = r;
-    release(&kmem.lock);
+    push_off();
+    id = cpuid();
+    c = &kcpu[id];
+    klock(&c->lock, id);
+    kput(c, r, r, 1);
+    head = 0;
+    if (c->nfree > KCACHE_MAX)
+        head = ktake(c, KBATCH, &tail, &got);
+    release(&c->lock);
+
+    // 本 CPU 缓存过多，归还一批到伙伴分配器
+    if (head)
+        bdrain(id, head);
+    pop_off();
+}
+
+// 从本 CPU 缓存取一页，缓存为空时先补充。不更新页计数。
+static struct run* kget(void) {
+    struct run* r;
+    struct kmem* c;
+    int id;
+
+    push_off();
+    id = cpuid();
+    c = &kcpu[id];
+    klock(&c->lock, id);
+    r = c->freelist;
+    if (r) {
+        c->freelist = r->next;
+        c->nfree--;
+    }
+    release(&c->lock);
+    if (r == 0)
+        r = krefill(id);
+    pop_off();
+    return r;
+}
+
+// 从预清零池取一页，池为空时返回 0。不更新页计数。
+static struct run* kzero_get(void) {
+    struct run* r;
+
+    acquire(&kzero.lock);
+    r = kzero.freelist;
+    if (r) {
+        kzero.freelist = r->next;
+        kzero.nfree--;
+    }
+    release(&kzero.lock);
+    return r;
+}
+
+// 内存不足：回收没有进程映射的文件缓存页。返回是否腾出了空闲页。
+// 这里不换出进程的页：调用者可能在文件系统操作中、持有 inode 或缓冲区的
+// 睡眠锁，等待换出的写盘会和它们互相等待。换出只在 swapreclaim() 的
+// 安全点进行。
+static int kreclaim(void) {
+    return pcreclaim() > 0;
+}
+
+// 分配失败：记在当前进程上，uvmtrap() 只在缺页因此失败时才换出页再试。
+static void knomem(void) {
+    struct proc* p = myproc();
+
+    if (p)
+        p->nomem = 1;
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -70,30 +426,159 @@ void kfree(void* pa) {
 void* kalloc(void) {
     struct run* r;
 
-    acquire(&kmem.lock);
-    r = kmem.freelist;
-    if (r) {
-        kmem.freelist = r->next;
+    while ((r = kget()) == 0 && (r = kzero_get()) == 0) {
+        if (!kreclaim()) {
+            knomem();
+            return 0;
+        }
     }
-    release(&kmem.lock);
-#ifndef LAB_SYSCALL
-    if (r)
-        memset((char*)r, 5, PGSIZE); // fill with junk
+    kpage[PA2PG(r)].ref = 1;
+    kcount_alloc(1);
+#ifdef KJUNK
+    memset((char*)r, 5, PGSIZE); // fill with junk
 #endif
     return (void*)r;
 }
 
-// 统计剩余的物理内存页数
-uint64 freemem(void) {
+// 分配一个内容全为 0 的页。优先使用空闲时预先清零的页。
+void* kalloc_zeroed(void) {
     struct run* r;
-    uint64 free = 0;
 
-    acquire(&kmem.lock);
-    r = kmem.freelist;
-    while (r) {
-        free += PGSIZE;
-        r = r->next;
+    if ((r = kzero_get()) != 0) {
+        __atomic_add_fetch(&kzero.nhit, 1, __ATOMIC_RELAXED);
+        r->next = 0; // 池的链表指针写在页的开头
+    } else {
+        while ((r = kget()) == 0) {
+            if (!kreclaim()) {
+                knomem();
+                return 0;
+            }
+        }
+        __atomic_add_fetch(&kzero.nmiss, 1, __ATOMIC_RELAXED);
+        memset((char*)r, 0, PGSIZE);
+    }
+    kpage[PA2PG(r)].ref = 1;
+    kcount_alloc(1);
+    return (void*)r;
+}
+
+// 调度器没有可运行的进程时调用：清零几页放进预清零池。
+// 返回清零的页数，0 表示池已满或没有空闲页。
+int kzero_idle(void) {
+    struct run* r;
+    int n;
+
+    for (n = 0; n < KZERO_IDLE; n++) {
+        if (__atomic_load_n(&kzero.nfree, __ATOMIC_RELAXED) >= KZERO_MAX)
+            break;
+        if ((r = kget()) == 0)
+            break;
+        memset((char*)r, 0, PGSIZE);
+        acquire(&kzero.lock);
+        r->next = kzero.freelist;
+        kzero.freelist = r;
+        kzero.nfree++;
+        release(&kzero.lock);
+    }
+    return n;
+}
+
+// 分配 2^order 个物理上连续的页，起始地址按块大小对齐。
+// 用 kfree() 释放整块。分配失败时返回 0。
+void* kalloc_order(int order) {
+    struct run* r;
+    int id;
+
+    if (order == 0)
+        return kalloc();
+    if (order < 0 || order > MAXORDER)
+        return 0;
+
+    push_off();
+    id = cpuid();
+    klock(&buddy.lock, id);
+    if ((r = balloc(order)) != 0)
+        kpage[PA2PG(r)].flags = KPG_HEAD;
+    release(&buddy.lock);
+    if (r == 0) {
+        // 可能是 CPU 缓存里的零散页妨碍了合并，全部还回去再试一次
+        kdrain(id);
+        klock(&buddy.lock, id);
+        if ((r = balloc(order)) != 0)
+            kpage[PA2PG(r)].flags = KPG_HEAD;
+        release(&buddy.lock);
+    }
+    pop_off();
+    if (r == 0) {
+        knomem();
+        return 0;
+    }
+    kpage[PA2PG(r)].ref = 1;
+    kcount_alloc(1UL << order);
+#ifdef KJUNK
+    memset((char*)r, 5, (uint64)PGSIZE << order); // fill with junk
+#endif
+    return (void*)r;
+}
+
+// 把 kalloc_order() 分配的块 pa 拆成独立的页，之后逐页用 kfree() 释放。
+// 块只能有一个引用。
+void ksplit(void* pa) {
+    struct kpage* pg = &kpage[PA2PG(pa)];
+    int order, id;
+
+    if ((char*)pa < end || (uint64)pa >= PHYSTOP || (pg->flags & KPG_HEAD) == 0 ||
+        krefcnt(pa) != 1)
+        panic("ksplit");
+    push_off();
+    id = cpuid();
+    klock(&buddy.lock, id);
+    order = pg->order;
+    for (uint64 i = 0; i < (1UL << order); i++) {
+        pg[i].order = 0;
+        pg[i].flags = 0;
+        pg[i].ref = 1;
+    }
+    release(&buddy.lock);
+    pop_off();
+}
+
+// 为写时复制共享增加一个对物理页 pa 的引用，之后每个引用各自 kfree 一次
+void kdup(void* pa) {
+    if ((char*)pa < end || (uint64)pa >= PHYSTOP)
+        panic("kdup");
+    if (__atomic_fetch_add(&kpage[PA2PG(pa)].ref, 1, __ATOMIC_RELAXED) < 1)
+        panic("kdup: free page");
+}
+
+// 物理页 pa 当前的引用数
+int krefcnt(void* pa) {
+    return __atomic_load_n(&kpage[PA2PG(pa)].ref, __ATOMIC_ACQUIRE);
+}
+
+// 剩余的物理内存字节数
+uint64 freemem(void) {
+    return __atomic_load_n(&kcount.free, __ATOMIC_RELAXED) * PGSIZE;
+}
+
+// 汇总分配器的页计数、伙伴系统的碎片情况和各 CPU 的锁统计
+void kallocstat(struct sysinfo* info) {
+    uint64 free = __atomic_load_n(&kcount.free, __ATOMIC_RELAXED);
+
+    info->freemem = free * PGSIZE;
+    info->usedmem = (kcount.total - free) * PGSIZE;
+    info->peakmem = __atomic_load_n(&kcount.peak, __ATOMIC_RELAXED) * PGSIZE;
+    for (int k = 0; k <= MAXORDER; k++)
+        info->freeblk[k] = __atomic_load_n(&buddy.nfree[k], __ATOMIC_RELAXED);
+    info->zeropool = kzero.nfree;
+    info->zerohit = kzero.nhit;
+    info->zeromiss = kzero.nmiss;
+    info->kmem_lock = 0;
+    info->kmem_contend = 0;
+    info->kmem_steal = 0;
+    for (int i = 0; i < NCPU; i++) {
+        info->kmem_lock += kstat[i].nlock;
+        info->kmem_contend += kstat[i].ncontend;
+        info->kmem_steal += kstat[i].nsteal;
     }
-    release(&kmem.lock);
-    return free;
 }
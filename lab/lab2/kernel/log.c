@@ -144,7 +144,9 @@ void end_op(void) {
         // begin_op() may be waiting for log space,
         // and decrementing log.outstanding has decreased
         // the amount of reserved space.
-        wakeup(&log);
+        // 空出的位置只够一个 begin_op()，只唤醒一个等待者；
+        // 提交结束后才唤醒所有等待者。
+        wakeup_one(&log);
     }
     release(&log.lock);
 
@@ -17,16 +17,25 @@ int main() {
         printf("xv6 kernel is booting\n");
         printf("\n");
         kinit();            // physical page allocator
+#ifdef STRINGTEST
+        stringtest();       // check and time the string routines
+#endif
+        slabinit();         // small kernel object caches
         kvminit();          // create kernel page table
         kvminithart();      // turn on paging
         procinit();         // process table
+        waitqinit();        // sleep/wakeup queues
+        futexinit();        // user-space wait queues
         trapinit();         // trap vectors
         trapinithart();     // install kernel trap vector
         plicinit();         // set up interrupt controller
         plicinithart();     // ask PLIC for device interrupts
+        sleeplockinit();    // sleep lock statistics
         binit();            // buffer cache
         iinit();            // inode table
         fileinit();         // file table
+        pipeinit();         // pipe cache
+        pcinit();           // file page cache
         virtio_disk_init(); // emulated hard disk
         userinit();         // first user process
         __sync_synchronize();
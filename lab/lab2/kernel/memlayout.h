@@ -17,6 +17,10 @@
 // end -- start of kernel page allocation area
 // PHYSTOP -- end RAM used by the kernel
 
+// core local interruptor (CLINT)，写 MSIP 向一个 hart 发送软件中断
+#define CLINT 0x2000000L
+#define CLINT_MSIP(hartid) (CLINT + 4 * (hartid))
+
 // qemu puts UART registers here in physical memory.
 #define UART0 0x10000000L
 #define UART0_IRQ 10
@@ -54,6 +58,13 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   mmap 的映射
+//   THREADFRAME(i) (线程的 p->trapframe)
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+
+// 线程的 trapframe 在 TRAPFRAME 下方，按进程表中的下标各占一页。
+// 程序段和 mmap 的映射都在 TRAPFRAMES 之下。
+#define THREADFRAME(i) (TRAPFRAME - ((i) + 1) * PGSIZE)
+#define TRAPFRAMES THREADFRAME(NPROC - 1)
@@ -0,0 +1,236 @@
+// 文件映射 mmap/munmap
+//
+// 映射从 TRAPFRAMES 下方开始向低地址分配，堆不能长进映射区。mmap 只记录
+// 一个 vma，页在第一次访问时由 mmapfault() 从页缓存取来：映射同一文件的
+// 进程共用同一个物理页。MAP_SHARED 的可写映射直接写这个页，munmap 或
+// 进程退出时把写过(PTE_D)的页写回文件；MAP_PRIVATE 的可写映射以写时复制
+// 方式映射缓存页，第一次写时复制出私有的一份。
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "fs.h"
+#include "file.h"
+#include "fcntl.h"
+#include "defs.h"
+
+// 映射区的下界：最低的映射的起始地址，没有映射时为 TRAPFRAMES
+uint64 mmaplimit(struct proc* p) {
+    uint64 lim = TRAPFRAMES;
+
+    for (struct vma* v = p->mm->vma; v < &p->mm->vma[NVMA]; v++)
+        if (v->len > 0 && v->addr < lim)
+            lim = v->addr;
+    return lim;
+}
+
+// 把文件 f 从偏移 off 开始的 len 字节映射到进程的地址空间。
+// 返回映射的地址，失败时返回 -1。
+uint64 mmap(struct file* f, uint64 len, int prot, int flags, uint64 off) {
+    struct proc* p = myproc();
+    struct vma *v, *free = 0;
+    uint64 addr = -1;
+
+    if (len == 0 || off % PGSIZE != 0 || off + len > MAXFILE * BSIZE)
+        return -1;
+    if (flags != MAP_SHARED && flags != MAP_PRIVATE)
+        return -1;
+    if (f->type != FD_INODE || !f->readable)
+        return -1;
+    if (flags == MAP_SHARED && (prot & PROT_WRITE) && !f->writable)
+        return -1;
+
+    mmlock(p);
+    for (v = p->mm->vma; v < &p->mm->vma[NVMA]; v++) {
+        if (v->len == 0) {
+            free = v;
+            break;
+        }
+    }
+    len = PGROUNDUP(len);
+    if (free != 0 && mmaplimit(p) - PGROUNDUP(p->mm->sz) >= len) {
+        addr = mmaplimit(p) - len;
+        free->addr = addr;
+        free->len = len;
+        free->prot = prot;
+        free->flags = flags;
+        free->f = filedup(f);
+        free->off = off;
+    }
+    mmunlock(p);
+    return addr;
+}
+
+// 把 v 中 [addr, addr+len) 里被写过的页写回文件，不超出文件末尾
+static void mmapwriteback(pagetable_t pagetable, struct vma* v, uint64 addr, uint64 len) {
+    struct inode* ip = v->f->ip;
+    int max = ((MAXOPBLOCKS - 1 - 1 - 2) / 2) * BSIZE;
+    uint64 a, pa;
+    uint off, i, n;
+    pte_t* pte;
+
+    if (v->flags != MAP_SHARED || (v->prot & PROT_WRITE) == 0)
+        return;
+    for (a = addr; a < addr + len; a += PGSIZE) {
+        if ((pte = walk(pagetable, a, 0)) == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_D) == 0)
+            continue;
+        pa = PTE2PA(*pte);
+        off = v->off + (a - v->addr);
+        // 和 filewrite() 一样分成几次写，每次不超过日志的容量
+        for (i = 0; i < PGSIZE; i += n) {
+            n = PGSIZE - i;
+            if (n > max)
+                n = max;
+            begin_op();
+            ilock(ip);
+            if (off + i < ip->size) {
+                if (n > ip->size - (off + i))
+                    n = ip->size - (off + i);
+                writei(ip, 0, pa + i, off + i, n);
+            } else {
+                n = PGSIZE - i;
+            }
+            iunlock(ip);
+            end_op();
+        }
+        *pte &= ~PTE_D;
+    }
+}
+
+// 去掉 v 中 [addr, addr+len) 的映射，只能是 v 的开头或结尾的一段。
+// 映射全部去掉后释放 v 和它的文件引用。
+static void vmaunmap(pagetable_t pagetable, struct vma* v, uint64 addr, uint64 len) {
+    mmapwriteback(pagetable, v, addr, len);
+    uvmunmap(pagetable, addr, len / PGSIZE, 1);
+    if (addr == v->addr) {
+        v->addr += len;
+        v->off += len;
+    }
+    v->len -= len;
+    if (v->len == 0) {
+        fileclose(v->f);
+        v->f = 0;
+    }
+}
+
+// va 落在 MAP_SHARED 的映射中时返回 1，否则返回 0。调用者持有 mmlock()。
+int mmapshared(struct proc* p, uint64 va) {
+    for (struct vma* v = p->mm->vma; v < &p->mm->vma[NVMA]; v++)
+        if (v->len > 0 && va >= v->addr && va < v->addr + v->len)
+            return v->flags == MAP_SHARED;
+    return 0;
+}
+
+// 去掉 [addr, addr+len) 的映射。范围必须在同一个映射内，并且包含它的开头
+// 或结尾，不能在中间挖洞。成功返回 0，否则返回 -1。
+int munmap(uint64 addr, uint64 len) {
+    struct proc* p = myproc();
+    struct vma* v;
+    int r = -1;
+
+    if (addr % PGSIZE != 0 || len == 0)
+        return -1;
+    len = PGROUNDUP(len);
+    mmlock(p);
+    for (v = p->mm->vma; v < &p->mm->vma[NVMA]; v++)
+        if (v->len > 0 && addr >= v->addr && addr < v->addr + v->len)
+            break;
+    if (v < &p->mm->vma[NVMA] && addr + len <= v->addr + v->len &&
+        (addr == v->addr || addr + len == v->addr + v->len)) {
+        vmaunmap(p->pagetable, v, addr, len);
+        r = 0;
+    }
+    mmunlock(p);
+    return r;
+}
+
+// 去掉进程的所有映射。exit() 和 exec() 调用，exec() 传入旧的页表。
+void mmapclear(struct proc* p, pagetable_t pagetable) {
+    for (struct vma* v = p->mm->vma; v < &p->mm->vma[NVMA]; v++)
+        if (v->len > 0)
+            vmaunmap(pagetable, v, v->addr, v->len);
+}
+
+// fork() 调用：子进程继承父进程的映射。已经访问过的页两边共享，
+// MAP_PRIVATE 的可写页改为写时复制。调用者持有 np->lock 和 p 的 mmlock()，
+// 失败时只撤销已经建立的页表映射，不会睡眠。
+int mmapfork(struct proc* p, struct proc* np) {
+    struct vma* v;
+    int i;
+
+    for (i = 0; i < NVMA; i++) {
+        v = &p->mm->vma[i];
+        if (v->len > 0 &&
+            uvmcopyrange(p->pagetable, np->pagetable, v->addr, v->addr + v->len,
+                         v->flags == MAP_PRIVATE) < 0) {
+            while (--i >= 0) {
+                v = &p->mm->vma[i];
+                if (v->len > 0)
+                    uvmunmap(np->pagetable, v->addr, v->len / PGSIZE, 1);
+            }
+            return -1;
+        }
+    }
+    for (i = 0; i < NVMA; i++) {
+        np->mm->vma[i] = p->mm->vma[i];
+        if (p->mm->vma[i].len > 0)
+            filedup(p->mm->vma[i].f);
+    }
+    return 0;
+}
+
+// 映射区中的缺页：从页缓存取页映射上。va 不在任何映射中时返回 1，
+// 成功返回 0，否则返回 -1。调用者持有 mmlock()。
+int mmapfault(struct proc* p, uint64 va) {
+    struct vma* v;
+    struct inode* ip;
+    uint64 sz;
+    uint off, n;
+    char* mem;
+    int perm;
+
+    va = PGROUNDDOWN(va);
+    for (v = p->mm->vma; v < &p->mm->vma[NVMA]; v++)
+        if (v->len > 0 && va >= v->addr && va < v->addr + v->len)
+            break;
+    if (v == &p->mm->vma[NVMA])
+        return 1;
+    if ((v->prot & (PROT_READ | PROT_WRITE | PROT_EXEC)) == 0)
+        return -1;
+    if (walkleaf(p->pagetable, va, &sz) != 0)
+        return -1;
+
+    ip = v->f->ip;
+    off = v->off + (va - v->addr);
+    // 持有 inode 锁的 copyin/copyout 不处理缺页，这里不会重复加锁
+    ilock(ip);
+    if (off < ip->size) {
+        n = ip->size - off;
+        if (n > PGSIZE)
+            n = PGSIZE;
+        mem = pcfill(ip, off, n);
+    } else {
+        mem = kalloc_zeroed(); // 整页都在文件末尾之后
+    }
+    iunlock(ip);
+    if (mem == 0)
+        return -1;
+
+    // RISC-V 不允许只写不读的页
+    perm = PTE_U;
+    if (v->prot & (PROT_READ | PROT_WRITE))
+        perm |= PTE_R;
+    if (v->prot & PROT_EXEC)
+        perm |= PTE_X;
+    if (v->prot & PROT_WRITE)
+        perm |= v->flags == MAP_SHARED ? PTE_W : PTE_COW;
+    if (mappages(p->pagetable, va, PGSIZE, (uint64)mem, perm) != 0) {
+        kfree(mem);
+        return -1;
+    }
+    return 0;
+}
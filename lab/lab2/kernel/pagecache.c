@@ -0,0 +1,202 @@
+// 文件页缓存
+//
+// 按 (dev, inum, 文件偏移) 缓存文件的页。mmap 的文件页和 exec 按需读入的
+// 只读程序段(代码、只读数据)都从这里取，映射同一文件同一位置的进程共用
+// 同一个物理页，不再读文件、不再占用新的内存。缓存持有每页的一个引用
+// (kdup)，每个映射各自再持有一个。
+//
+// 一页中来自文件的字节数 n 也是键的一部分：文件末尾或程序段末尾的页只有
+// 前 n 个字节来自文件，其余为 0。
+//
+// write() 写文件时丢掉被覆盖的缓存页；已经映射了旧页的进程继续使用旧页。
+// 只被缓存引用的页在 kalloc() 内存不足时通过 pcreclaim() 回收。
+//
+// 查找远多于加入和丢弃，pcache.lock 是读写锁：多个 CPU 上的缺页可以同时
+// 查找，只有改变哈希链的操作独占。
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "rwlock.h"
+#include "riscv.h"
+#include "fs.h"
+#include "file.h"
+#include "defs.h"
+#include "sysinfo.h"
+
+#define NPCACHE 2048 // 最多缓存的页数
+#define NPCHASH 251  // 哈希桶数
+
+struct pcpage {
+    struct pcpage* next; // 哈希桶链表或空闲链表
+    uint dev;
+    uint inum;
+    uint off; // 页在文件中的偏移
+    uint n;   // 页中来自文件的字节数，其余为 0
+    char* pa;
+};
+
+struct {
+    struct rwlock lock;
+    struct pcpage pg[NPCACHE];
+    struct pcpage* hash[NPCHASH];
+    struct pcpage* free;
+    int n;       // 已缓存的页数
+    uint64 hit;  // 直接拿到缓存页的次数
+    uint64 miss; // 读了文件的次数
+} pcache;
+
+void pcinit(void) {
+    initrwlock(&pcache.lock, "pcache");
+    for (int i = 0; i < NPCACHE; i++) {
+        pcache.pg[i].next = pcache.free;
+        pcache.free = &pcache.pg[i];
+    }
+}
+
+static struct pcpage** pchash(uint dev, uint inum) {
+    return &pcache.hash[(dev * 31 + inum) % NPCHASH];
+}
+
+// 从缓存中去掉 *pp 并释放缓存对它的引用。调用者以写者持有 pcache.lock。
+static void pcdrop(struct pcpage** pp) {
+    struct pcpage* t = *pp;
+
+    *pp = t->next;
+    kfree(t->pa);
+    t->next = pcache.free;
+    pcache.free = t;
+    pcache.n--;
+}
+
+// 查找 ip 在文件偏移 off 处的缓存页。命中时为调用者增加一个引用并返回
+// 物理地址，调用者映射它、之后用 kfree 释放；不命中返回 0。
+static char* pcget(struct inode* ip, uint off, uint n) {
+    struct pcpage* t;
+    char* pa = 0;
+
+    racquire(&pcache.lock);
+    for (t = *pchash(ip->dev, ip->inum); t; t = t->next) {
+        if (t->dev == ip->dev && t->inum == ip->inum && t->off == off && t->n == n) {
+            kdup(t->pa);
+            pa = t->pa;
+            break;
+        }
+    }
+    rrelease(&pcache.lock);
+    __atomic_add_fetch(pa ? &pcache.hit : &pcache.miss, 1, __ATOMIC_RELAXED);
+    return pa;
+}
+
+// 释放只被缓存引用的页，最多 max 页。调用者以写者持有 pcache.lock。
+static int pcevict(int max) {
+    struct pcpage** pp;
+    int i, n = 0;
+
+    for (i = 0; i < NPCHASH && n < max; i++) {
+        for (pp = &pcache.hash[i]; *pp && n < max;) {
+            if (krefcnt((*pp)->pa) != 1) {
+                pp = &(*pp)->next;
+                continue;
+            }
+            pcdrop(pp);
+            n++;
+        }
+    }
+    return n;
+}
+
+// 把刚从文件读入的页 pa 加入缓存，缓存为它增加一个引用。
+// 缓存已满且没有可以回收的页时不缓存。
+static void pcput(struct inode* ip, uint off, uint n, char* pa) {
+    struct pcpage **h, *t;
+
+    wacquire(&pcache.lock);
+    h = pchash(ip->dev, ip->inum);
+    if (pcache.free == 0)
+        pcevict(1);
+    if ((t = pcache.free) != 0) {
+        pcache.free = t->next;
+        t->dev = ip->dev;
+        t->inum = ip->inum;
+        t->off = off;
+        t->n = n;
+        t->pa = pa;
+        kdup(pa);
+        t->next = *h;
+        *h = t;
+        pcache.n++;
+    }
+    wrelease(&pcache.lock);
+}
+
+// 返回 ip 在文件偏移 off 处的页，前 n 个字节是文件内容，其余为 0。
+// 调用者得到一个引用，映射它、之后用 kfree 释放。内存不足或读文件失败时返回 0。
+// 调用者持有 ip 的锁。
+char* pcfill(struct inode* ip, uint off, uint n) {
+    char* pa;
+
+    // 在 inode 锁内查找和加入缓存：同一页不会被读入两次，
+    // 也不会和 write() 的 pcinval() 交错
+    if ((pa = pcget(ip, off, n)) == 0 && (pa = kalloc_zeroed()) != 0) {
+        if (readi(ip, 0, (uint64)pa, off, n) == n) {
+            pcput(ip, off, n, pa);
+        } else {
+            kfree(pa);
+            pa = 0;
+        }
+    }
+    return pa;
+}
+
+// 文件 ip 中 [off, off+n) 的内容改变了：丢掉和它重叠的缓存页。
+// 调用者持有 ip 的锁。
+void pcinval(struct inode* ip, uint off, uint n) {
+    struct pcpage **pp, *t;
+
+    if (__atomic_load_n(&pcache.n, __ATOMIC_RELAXED) == 0)
+        return;
+    wacquire(&pcache.lock);
+    for (pp = pchash(ip->dev, ip->inum); *pp;) {
+        t = *pp;
+        if (t->dev == ip->dev && t->inum == ip->inum &&
+            t->off < off + n && off < t->off + PGSIZE)
+            pcdrop(pp);
+        else
+            pp = &t->next;
+    }
+    wrelease(&pcache.lock);
+}
+
+// 内存不足时由 kalloc() 调用：释放所有没有进程映射的缓存页。
+// 返回释放的页数。
+int pcreclaim(void) {
+    int n;
+
+    if (__atomic_load_n(&pcache.n, __ATOMIC_RELAXED) == 0)
+        return 0;
+    wacquire(&pcache.lock);
+    n = pcevict(NPCACHE);
+    wrelease(&pcache.lock);
+    return n;
+}
+
+// 汇总缓存页数、这些页上的映射数和命中情况
+void pcstat(struct sysinfo* info) {
+    struct pcpage* t;
+
+    info->pcpages = 0;
+    info->pcmaps = 0;
+    racquire(&pcache.lock);
+    for (int i = 0; i < NPCHASH; i++) {
+        for (t = pcache.hash[i]; t; t = t->next) {
+            info->pcpages++;
+            info->pcmaps += krefcnt(t->pa) - 1;
+        }
+    }
+    info->pchit = pcache.hit;
+    info->pcmiss = pcache.miss;
+    rrelease(&pcache.lock);
+}
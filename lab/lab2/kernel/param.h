@@ -2,14 +2,24 @@
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NINODE       50  // 最多缓存的没有引用的 i-node 数
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
 #define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       2000  // size of file system in blocks
+#define FSSIZE       (2000 + NSWAP * (PGSIZE / BSIZE))  // size of file system in blocks，含交换区
 #define MAXPATH      128   // maximum file path name
 #define USERSTACK    1     // user stack pages
+#define MAXORDER     10    // 伙伴分配器最大的块为 2^MAXORDER 页
+#define NEXECSEG     4     // 每个进程按需读入的程序段数，多出的段在 exec 时读入
+#define NVMA         16    // 每个进程的 mmap 映射数
+#define NSWAP        1024  // 交换区的页数，在磁盘上紧跟日志
+#define TIMEFREQ     10000000 // r_time() 的频率 (Hz)，qemu 为 10MHz
+#define TICKCYCLES   (TIMEFREQ / 10)  // 一个 tick 的 r_time() 周期数，0.1 秒
+#define SLICECYCLES  (TIMEFREQ / 100) // MLFQ 的时间片单位，10ms
+#define NMLFQ        3        // MLFQ 的优先级数，0 最高
+#define MLFQQUANTA   {2, 4, 8}  // 各级的时间片，单位为 SLICECYCLES
+#define MLFQBOOST    10       // 每隔多少个 tick 把所有进程提到最高级
 
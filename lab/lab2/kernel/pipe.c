@@ -21,6 +21,17 @@ struct pipe {
     int writeopen; // write fd is still open
 };
 
+struct kmem_cache* pipe_cache;
+
+// slab 构造函数：对象进入缓存时初始化一次锁
+static void pipe_ctor(void* obj) {
+    initlock(&((struct pipe*)obj)->lock, "pipe");
+}
+
+void pipeinit(void) {
+    pipe_cache = kmem_cache_create("pipe", sizeof(struct pipe), pipe_ctor);
+}
+
 int pipealloc(struct file** f0, struct file** f1) {
     struct pipe* pi;
 
@@ -28,13 +39,12 @@ int pipealloc(struct file** f0, struct file** f1) {
     *f0 = *f1 = 0;
     if ((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
         goto bad;
-    if ((pi = (struct pipe*)kalloc()) == 0)
+    if ((pi = (struct pipe*)kmem_cache_alloc(pipe_cache)) == 0)
         goto bad;
     pi->readopen = 1;
     pi->writeopen = 1;
     pi->nwrite = 0;
     pi->nread = 0;
-    initlock(&pi->lock, "pipe");
     (*f0)->type = FD_PIPE;
     (*f0)->readable = 1;
     (*f0)->writable = 0;
@@ -47,7 +57,7 @@ int pipealloc(struct file** f0, struct file** f1) {
 
 bad:
     if (pi)
-        kfree((char*)pi);
+        kmem_cache_free(pipe_cache, pi);
     if (*f0)
         fileclose(*f0);
     if (*f1)
@@ -66,7 +76,7 @@ void pipeclose(struct pipe* pi, int writable) {
     }
     if (pi->readopen == 0 && pi->writeopen == 0) {
         release(&pi->lock);
-        kfree((char*)pi);
+        kmem_cache_free(pipe_cache, pi);
     } else
         release(&pi->lock);
 }
@@ -75,6 +85,8 @@ int pipewrite(struct pipe* pi, uint64 addr, int n) {
     int i = 0;
     struct proc* pr = myproc();
 
+    // 持有 pi->lock 时 copyin 不能睡眠，先让用户页就位
+    uvmprefault(addr, n, 0);
     acquire(&pi->lock);
     while (i < n) {
         if (pi->readopen == 0 || killed(pr)) {
@@ -85,11 +97,26 @@ int pipewrite(struct pipe* pi, uint64 addr, int n) {
             wakeup(&pi->nread);
             sleep(&pi->nwrite, &pi->lock);
         } else {
-            char ch;
-            if (copyin(pr->pagetable, &ch, addr + i, 1) == -1)
+            // 一次复制缓冲区的全部空位，绕回到开头时分成两段
+            struct copyseg seg[2];
+            uint w = pi->nwrite % PIPESIZE;
+            int m = pi->nread + PIPESIZE - pi->nwrite, nseg = 1;
+            if (m > n - i)
+                m = n - i;
+            seg[0].dst = &pi->data[w];
+            seg[0].va = addr + i;
+            seg[0].len = m;
+            if (w + m > PIPESIZE) {
+                seg[0].len = PIPESIZE - w;
+                seg[1].dst = &pi->data[0];
+                seg[1].va = addr + i + seg[0].len;
+                seg[1].len = m - seg[0].len;
+                nseg = 2;
+            }
+            if (copyin_batch(pr->pagetable, seg, nseg) == -1)
                 break;
-            pi->data[pi->nwrite++ % PIPESIZE] = ch;
-            i++;
+            pi->nwrite += m;
+            i += m;
         }
     }
     wakeup(&pi->nread);
@@ -99,10 +126,10 @@ int pipewrite(struct pipe* pi, uint64 addr, int n) {
 }
 
 int piperead(struct pipe* pi, uint64 addr, int n) {
-    int i;
+    int i, m;
     struct proc* pr = myproc();
-    char ch;
 
+    uvmprefault(addr, n < PIPESIZE ? n : PIPESIZE, 1);
     acquire(&pi->lock);
     while (pi->nread == pi->nwrite && pi->writeopen) { // DOC: pipe-empty
         if (killed(pr)) {
@@ -111,12 +138,16 @@ int piperead(struct pipe* pi, uint64 addr, int n) {
         }
         sleep(&pi->nread, &pi->lock); // DOC: piperead-sleep
     }
-    for (i = 0; i < n; i++) { // DOC: piperead-copy
-        if (pi->nread == pi->nwrite)
-            break;
-        ch = pi->data[pi->nread++ % PIPESIZE];
-        if (copyout(pr->pagetable, addr + i, &ch, 1) == -1)
+    // 按缓冲区中连续的一段复制，绕回到开头时再复制一次
+    for (i = 0; i < n && pi->nread != pi->nwrite; i += m) { // DOC: piperead-copy
+        m = pi->nwrite - pi->nread;
+        if (m > PIPESIZE - pi->nread % PIPESIZE)
+            m = PIPESIZE - pi->nread % PIPESIZE;
+        if (m > n - i)
+            m = n - i;
+        if (copyout(pr->pagetable, addr + i, &pi->data[pi->nread % PIPESIZE], m) == -1)
             break;
+        pi->nread += m;
     }
     wakeup(&pi->nwrite); // DOC: piperead-wakeup
     release(&pi->lock);
@@ -5,8 +5,10 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "rwlock.h"
 #include "proc.h"
 #include "defs.h"
+#include "sysinfo.h"
 
 struct cpu cpus[NCPU]; // 表示每个CPU的状态信息
 
@@ -14,9 +16,21 @@ struct proc proc[NPROC]; // 进程表，保存所有进程的信息
 
 struct proc* initproc; // 指向初始进程
 
+#ifdef MLFQ
+int schedpolicy = SCHED_MLFQ;
+#else
+int schedpolicy = SCHED_RR;
+#endif
+
+static const int quanta[NMLFQ] = MLFQQUANTA;
+
 int nextpid = 1;
 struct spinlock pid_lock;
 
+// 槽位的占用(pid 和 UNUSED 与否)改变时 seq 加一，nproc() 等只读的
+// 遍历不用逐个获取 p->lock。写者先持有 p->lock。
+struct seqlock procseq;
+
 extern void forkret(void);
 static void freeproc(struct proc* p);
 
@@ -47,10 +61,252 @@ void procinit(void) {
 
     initlock(&pid_lock, "nextpid");
     initlock(&wait_lock, "wait_lock");
+    initseqlock(&procseq, "procseq");
+    for (int i = 0; i < NCPU; i++)
+        initlock(&cpus[i].rqlock, "runq");
     for (p = proc; p < &proc[NPROC]; p++) {
         initlock(&p->lock, "proc");
+        initlock(&p->mmown.lock, "mm");
+        p->mm = &p->mmown;
+        p->mmown.nthread = 1;
+        p->tfva = TRAPFRAME;
         p->state = UNUSED;
         p->kstack = KSTACK((int)(p - proc));
+        if (nasid > NPROC)
+            p->asid = (int)(p - proc) + 1;
+    }
+}
+
+// 运行队列
+//
+// 每个 CPU 有自己的运行队列，进程变为 RUNNABLE 时(fork、yield、wakeup、kill)
+// 由持有 p->lock 的代码放进队列：放回上次运行它的 CPU，fork 出的子进程放在
+// 父进程所在的 CPU。调度器只从自己的队列头部取进程，队列空了才从最长的
+// 队列偷一个。锁的顺序是先 p->lock 后 rqlock；调度器先从队列取出进程、
+// 放开 rqlock 之后才获取 p->lock。进程在队列中当且仅当它 RUNNABLE 且还没有
+// 被调度器取走，取走之后只有这个调度器会改变它的状态。
+//
+// 每 CPU 的队列比单一的全局队列快多少还没有测过。编译时定义 RUNQGLOBAL
+// 则所有进程都放进 CPU 0 的队列，其他 CPU 总是从那里偷，相当于一个全局
+// 队列(steal 计数这时就是其他 CPU 的调度次数)，可以用 schedbench 对比。
+//
+// 没有可运行的进程的 CPU 在 wfi 中睡眠，没有时钟中断叫醒它(见 timer.c)。
+// 进程放进它的队列时用处理器间中断(IPI)叫醒它；放进忙碌的 CPU 的队列时
+// 叫醒一个空闲的 CPU 来偷。
+//
+// MLFQ 调度时每个 CPU 有 NMLFQ 级队列，总是先运行高优先级的进程。新进程从
+// 最高级开始，在一级上累计用完这一级的时间片后降一级；睡眠前只运行了很短
+// 时间的进程是 I/O 密集的，升一级。每 MLFQBOOST 个 tick 所有进程回到最高级，
+// 低优先级的进程不会一直饿着。提升按时间算出第几次(boostgen())，不需要
+// 时钟中断：队列中的进程在调度器下次取进程时移到最高级，其他进程在下次
+// 进入队列或让出 CPU 时调整。
+
+// 到现在为止优先级提升的次数
+static uint boostgen(void) {
+    if (schedpolicy != SCHED_MLFQ)
+        return 0;
+    return r_time() / (MLFQBOOST * TICKCYCLES);
+}
+
+// 错过了优先级提升的进程回到最高级。调用者持有 p->lock，p 不在队列中。
+static void mlfqcatchup(struct proc* p) {
+    uint gen = boostgen();
+
+    if (p->boostgen != gen) {
+        p->boostgen = gen;
+        p->level = 0;
+        p->allot = 0;
+    }
+}
+
+// 进程结束一段运行(让出 CPU 或睡眠)时调整它的优先级。调用者持有 p->lock。
+static void mlfqcharge(struct proc* p, int sleeping) {
+    uint64 ran;
+
+    if (schedpolicy != SCHED_MLFQ)
+        return;
+    mlfqcatchup(p);
+    ran = r_time() - p->runstart;
+    if (sleeping && ran < SLICECYCLES) {
+        if (p->level > 0) {
+            p->level--;
+            p->allot = 0;
+        }
+        return;
+    }
+    p->allot += ran;
+    if (p->allot >= quanta[p->level] * SLICECYCLES) {
+        if (p->level < NMLFQ - 1)
+            p->level++;
+        p->allot = 0;
+    }
+}
+
+// 把各级队列中的进程移到最高一级的队列。调用者持有 c->rqlock。
+static void runqboost(struct cpu* c, uint gen) {
+    struct runq *q, *top = &c->rq[0];
+    struct proc* p;
+
+    for (q = c->rq; q < &c->rq[NMLFQ]; q++) {
+        for (p = q->head; p; p = p->rqnext) {
+            p->boostgen = gen;
+            p->level = 0;
+            p->allot = 0;
+        }
+        if (q == top || q->head == 0)
+            continue;
+        if (top->tail)
+            top->tail->rqnext = q->head;
+        else
+            top->head = q->head;
+        top->tail = q->tail;
+        q->head = q->tail = 0;
+    }
+    c->boostgen = gen;
+}
+
+// 向 CPU cpu 发送处理器间中断，它在 devintr() 中被清掉
+static void ipi(int cpu) {
+    *(volatile uint32*)CLINT_MSIP(cpu) = 1;
+}
+
+// 进程 p 加入了 CPU cpu 的队列，队列现在有 n 个进程：CPU 在睡眠就叫醒它；
+// p 要等 CPU 上的其他进程让出时叫醒一个空闲的 CPU 来偷。让出 CPU 的进程
+// 是它队列中唯一的进程时马上会再运行，不叫醒别的 CPU，免得它来回迁移。
+// 清掉 idle 的一方负责发送 IPI，同一个 CPU 只叫醒一次。
+static void runqkick(int cpu, struct proc* p, int n) {
+    struct proc* running = __atomic_load_n(&cpus[cpu].proc, __ATOMIC_RELAXED);
+
+    if (__atomic_exchange_n(&cpus[cpu].idle, 0, __ATOMIC_SEQ_CST)) {
+        ipi(cpu);
+        return;
+    }
+    if (n == 1 && (running == 0 || running == p))
+        return;
+    for (int i = 0; i < NCPU; i++) {
+        if (__atomic_load_n(&cpus[i].idle, __ATOMIC_RELAXED) &&
+            __atomic_exchange_n(&cpus[i].idle, 0, __ATOMIC_SEQ_CST)) {
+            ipi(i);
+            return;
+        }
+    }
+}
+
+// CPU self 找不到可运行的进程，准备在 wfi 中睡眠，调用者已关中断。
+// 先标记为空闲再看一眼各队列：之后放进队列的进程会看到标记、发送 IPI，
+// 之前放进去的在这里被发现。返回是否可以睡眠。
+static int runqidle(int self) {
+    struct cpu* c = &cpus[self];
+
+    __atomic_store_n(&c->idle, 1, __ATOMIC_SEQ_CST);
+    for (int i = 0; i < NCPU; i++) {
+        if (__atomic_load_n(&cpus[i].nrunq, __ATOMIC_SEQ_CST) > 0) {
+            __atomic_store_n(&c->idle, 0, __ATOMIC_RELAXED);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// 把进程 p 放到 CPU cpu 的运行队列末尾。调用者持有 p->lock。
+static void runqput(struct proc* p, int cpu) {
+    struct cpu* c;
+    struct runq* q;
+    int n;
+
+#ifdef RUNQGLOBAL
+    cpu = 0;
+#endif
+    c = &cpus[cpu];
+
+    mlfqcatchup(p);
+    p->readytime = r_time();
+    p->rqnext = 0;
+    acquire(&c->rqlock);
+    q = &c->rq[p->level];
+    if (q->tail)
+        q->tail->rqnext = p;
+    else
+        q->head = p;
+    q->tail = p;
+    n = ++c->nrunq;
+    release(&c->rqlock);
+    runqkick(cpu, p, n);
+}
+
+// 取出 CPU cpu 的运行队列中优先级最高、等得最久的进程，队列为空时返回 0
+static struct proc* runqget(int cpu) {
+    struct cpu* c = &cpus[cpu];
+    uint gen = boostgen();
+    struct runq* q;
+    struct proc* p = 0;
+
+    acquire(&c->rqlock);
+    if (c->boostgen != gen)
+        runqboost(c, gen);
+    for (q = c->rq; q < &c->rq[NMLFQ]; q++) {
+        if ((p = q->head) != 0) {
+            q->head = p->rqnext;
+            if (q->head == 0)
+                q->tail = 0;
+            c->nrunq--;
+            break;
+        }
+    }
+    release(&c->rqlock);
+    return p;
+}
+
+// CPU self 的队列空了：从最长的队列偷一个优先级最高的进程
+static struct proc* runqsteal(int self) {
+    int i, victim = -1, most = 0;
+    struct proc* p;
+
+    // 不加锁地看一眼各队列的长度，挑错了也只是白跑一趟
+    for (i = 0; i < NCPU; i++) {
+        if (i != self && __atomic_load_n(&cpus[i].nrunq, __ATOMIC_RELAXED) > most) {
+            most = cpus[i].nrunq;
+            victim = i;
+        }
+    }
+    if (victim < 0 || (p = runqget(victim)) == 0)
+        return 0;
+    cpus[self].steal++;
+    return p;
+}
+
+// 将进程 p 置为 RUNNABLE 并放进运行队列。调用者持有 p->lock。
+static void makerunnable(struct proc* p) {
+    p->state = RUNNABLE;
+    runqput(p, p->cpu);
+}
+
+// 时间片用完的时钟中断时调用：当前进程是否该让出 CPU。轮转调度总是让出；
+// MLFQ 在用完这一级的时间片，或者本 CPU 有更高优先级的进程等待时让出。
+int preempt(void) {
+    struct proc* p = myproc();
+    struct cpu* c = &cpus[p->cpu];
+
+    if (schedpolicy != SCHED_MLFQ)
+        return 1;
+    if (p->allot + r_time() - p->runstart >= quanta[p->level] * SLICECYCLES)
+        return 1;
+    for (int i = 0; i < p->level; i++)
+        if (__atomic_load_n(&c->rq[i].head, __ATOMIC_RELAXED) != 0)
+            return 1;
+    return 0;
+}
+
+// 汇总各 CPU 的调度统计
+void schedstat(struct sysinfo* info) {
+    info->nsched = 0;
+    info->schedwait = 0;
+    info->steal = 0;
+    info->schedpolicy = schedpolicy;
+    for (int i = 0; i < NCPU; i++) {
+        info->nsched += cpus[i].nsched;
+        info->schedwait += cpus[i].schedwait;
+        info->steal += cpus[i].steal;
     }
 }
 
@@ -92,7 +348,9 @@ int allocpid() {
 // 如果找到，则初始化内核运行所需的状态，
 // 并返回 p->lock 持有的状态。
 // 如果没有空闲的进程，或者内存分配失败，则返回 0。
-static struct proc* allocproc(void) {
+// share 不为 0 时新进程是 share 的线程，共用它的页表和地址空间，
+// trapframe 由调用者映射到 p->tfva。
+static struct proc* allocproc(struct proc* share) {
     struct proc* p;
 
     for (p = proc; p < &proc[NPROC]; p++) {
@@ -106,8 +364,16 @@ static struct proc* allocproc(void) {
     return 0;
 
 found:
+    seqacquire(&procseq);
     p->pid = allocpid();
     p->state = USED;
+    seqrelease(&procseq);
+    p->runtime = 0;
+    p->waittime = 0;
+    p->level = 0;
+    p->allot = 0;
+    p->boostgen = boostgen();
+    p->timer.cpu = -1;
 
     // Allocate a trapframe page.
     if ((p->trapframe = (struct trapframe*)kalloc()) == 0) {
@@ -116,12 +382,19 @@ found:
         return 0;
     }
 
-    // An empty user page table.
-    p->pagetable = proc_pagetable(p);
-    if (p->pagetable == 0) {
-        freeproc(p);
-        release(&p->lock);
-        return 0;
+    if (share) {
+        p->mm = share->mm;
+        p->tfva = THREADFRAME(p - proc);
+        p->pagetable = share->pagetable;
+        tlbstale(p); // 这个槽位的 ASID 在 TLB 中可能还有旧地址空间的表项
+    } else {
+        // An empty user page table.
+        p->pagetable = proc_pagetable(p);
+        if (p->pagetable == 0) {
+            freeproc(p);
+            release(&p->lock);
+            return 0;
+        }
     }
 
     // Set up new context to start executing at forkret,
@@ -138,17 +411,26 @@ static void freeproc(struct proc* p) {
     if (p->trapframe)
         kfree((void*)p->trapframe);
     p->trapframe = 0;
-    if (p->pagetable)
-        proc_freepagetable(p->pagetable, p->sz);
+    if (p->mm != &p->mmown)
+        p->mm = &p->mmown; // 线程：页表属于主线程
+    else if (p->pagetable)
+        proc_freepagetable(p->pagetable, p->mm->sz);
     p->pagetable = 0;
-    p->sz = 0;
-    p->pid = 0;
+    p->mm->sz = 0;
+    p->mm->nthread = 1;
+    p->mm->exe = 0;
+    p->mm->nseg = 0;
+    memset(p->mm->acct, 0, sizeof(p->mm->acct));
+    p->tfva = TRAPFRAME;
     p->parent = 0;
     p->name[0] = 0;
     p->chan = 0;
     p->killed = 0;
     p->xstate = 0;
+    seqacquire(&procseq);
+    p->pid = 0;
     p->state = UNUSED;
+    seqrelease(&procseq);
 }
 
 // 为一个进程创建一个页表，并映射 trampoline 和 trapframe 页。
@@ -159,17 +441,19 @@ pagetable_t proc_pagetable(struct proc* p) {
     pagetable = uvmcreate();
     if (pagetable == 0)
         return 0;
+    // 新的地址空间沿用这个槽位的 ASID，各 CPU 的 TLB 中可能还有旧地址空间的表项
+    tlbstale(p);
 
     // 在最高用户虚拟地址映射trampoline代码（用于系统调用返回）
     // 仅有主管在往返用户空间的途中使用它，因此不是 PTE_U。
     if (mappages(pagetable, TRAMPOLINE, PGSIZE,
-                 (uint64)trampoline, PTE_R | PTE_X) < 0) {
+                 (uint64)trampoline, PTE_R | PTE_X | PTE_G) < 0) {
         uvmfree(pagetable, 0);
         return 0;
     }
 
     // 对于 trampoline.S，将 trapframe 页面映射到 trampoline 页面的正下方。
-    if (mappages(pagetable, TRAPFRAME, PGSIZE,
+    if (mappages(pagetable, p->tfva, PGSIZE,
                  (uint64)(p->trapframe), PTE_R | PTE_W) < 0) {
         uvmunmap(pagetable, TRAMPOLINE, 1, 0);
         uvmfree(pagetable, 0);
@@ -202,13 +486,14 @@ uchar initcode[] = {
 void userinit(void) {
     struct proc* p;
 
-    p = allocproc();
+    p = allocproc(0);
     initproc = p;
 
     // allocate one user page and copy initcode's instructions
     // and data into it.
     uvmfirst(p->pagetable, initcode, sizeof(initcode));
-    p->sz = PGSIZE;
+    p->mm->sz = PGSIZE;
+    uvmrecount(p->pagetable, p->mm);
 
     // prepare for the very first "return" from kernel to user.
     p->trapframe->epc = 0;     // user program counter
@@ -217,26 +502,32 @@ void userinit(void) {
     safestrcpy(p->name, "initcode", sizeof(p->name));
     p->cwd = namei("/");
 
-    p->state = RUNNABLE;
+    p->cpu = 0;
+    makerunnable(p);
 
     release(&p->lock);
 }
 
 // 增加或减少当前进程的虚拟内存大小。
 // Return 0 on success, -1 on failure.
-int growproc(int n) {
+// super 非 0 时，新增内存中按 2MB 对齐的部分尽量用大页映射。
+// 调用者持有 mmlock()。
+int growproc(int n, int super) {
     uint64 sz;
     struct proc* p = myproc();
 
-    sz = p->sz;
+    sz = p->mm->sz;
     if (n > 0) {
-        if ((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
+        if (super)
+            sz = uvmalloc_super(p->pagetable, sz, sz + n, PTE_W);
+        else
+            sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W);
+        if (sz == 0)
             return -1;
-        }
     } else if (n < 0) {
         sz = uvmdealloc(p->pagetable, sz, sz + n);
     }
-    p->sz = sz;
+    p->mm->sz = sz;
     return 0;
 }
 
@@ -246,18 +537,36 @@ int fork(void) {
     struct proc* np;
     struct proc* p = myproc();
 
+    // 复制期间其他线程不能改变地址空间
+    mmlock(p);
+
     // Allocate process.
-    if ((np = allocproc()) == 0) {
+    if ((np = allocproc(0)) == 0) {
+        mmunlock(p);
         return -1;
     }
 
     // Copy user memory from parent to child.
-    if (uvmcopy(p->pagetable, np->pagetable, p->sz) < 0) {
+    if (uvmcopy(p->pagetable, np->pagetable, p->mm->sz) < 0) {
+        freeproc(np);
+        release(&np->lock);
+        mmunlock(p);
+        return -1;
+    }
+    np->mm->sz = p->mm->sz;
+    if (mmapfork(p, np) < 0) {
         freeproc(np);
         release(&np->lock);
+        mmunlock(p);
         return -1;
     }
-    np->sz = p->sz;
+    if (p->mm->exe) {
+        np->mm->exe = idup(p->mm->exe);
+        idenywrite(np->mm->exe); // 父进程已经禁止了写入，不会失败
+    }
+    memmove(np->mm->seg, p->mm->seg, sizeof(p->mm->seg));
+    np->mm->nseg = p->mm->nseg;
+    uvmrecount(np->pagetable, np->mm);
 
     // copy saved user registers.
     *(np->trapframe) = *(p->trapframe);
@@ -266,9 +575,12 @@ int fork(void) {
     np->trapframe->a0 = 0;
 
     // increment reference counts on open file descriptors.
+    // 其他线程可能同时在打开或关闭文件
+    acquire(&p->mm->lock);
     for (i = 0; i < NOFILE; i++)
-        if (p->ofile[i])
-            np->ofile[i] = filedup(p->ofile[i]);
+        if (p->mm->ofile[i])
+            np->mm->ofile[i] = filedup(p->mm->ofile[i]);
+    release(&p->mm->lock);
     np->cwd = idup(p->cwd);
 
     safestrcpy(np->name, p->name, sizeof(p->name));
@@ -278,13 +590,15 @@ int fork(void) {
     pid = np->pid;
 
     release(&np->lock);
+    mmunlock(p);
 
     acquire(&wait_lock);
     np->parent = p;
     release(&wait_lock);
 
     acquire(&np->lock);
-    np->state = RUNNABLE;
+    np->cpu = cpuid();
+    makerunnable(np);
     release(&np->lock);
 
     return pid;
@@ -302,26 +616,81 @@ void reparent(struct proc* p) {
     }
 }
 
+// 主线程退出前结束并回收其他线程，它们都用着主线程的地址空间。
+static void threadreap(struct proc* p) {
+    struct proc* pp;
+    int n;
+
+    acquire(&wait_lock);
+    for (;;) {
+        n = 0;
+        for (pp = proc; pp < &proc[NPROC]; pp++) {
+            if (pp->parent != p || pp->mm != p->mm)
+                continue;
+            acquire(&pp->lock);
+            if (pp->state == ZOMBIE) {
+                freeproc(pp);
+            } else {
+                n++;
+                setkilled(pp);
+                if (pp->state == SLEEPING)
+                    makerunnable(pp);
+            }
+            release(&pp->lock);
+        }
+        if (n == 0)
+            break;
+        sleep(p, &wait_lock); // 线程退出时唤醒主线程
+    }
+    release(&wait_lock);
+}
+
 // 当前进程退出，释放资源并将其状态设置为 ZOMBIE。
 void exit(int status) {
     struct proc* p = myproc();
+    int own = p->mm == &p->mmown;
 
     if (p == initproc)
         panic("init exiting");
 
-    // Close all open files.
-    for (int fd = 0; fd < NOFILE; fd++) {
-        if (p->ofile[fd]) {
-            struct file* f = p->ofile[fd];
+    if (own) {
+        if (__atomic_load_n(&p->mm->nthread, __ATOMIC_RELAXED) > 1)
+            threadreap(p);
+        // 写回并去掉所有文件映射
+        mmapclear(p, p->pagetable);
+    } else {
+        // 线程只去掉自己的 trapframe，不再使用主线程的页表
+        mmlock(p);
+        uvmunmap(p->pagetable, p->tfva, 1, 0);
+        acquire(&p->lock);
+        p->pagetable = 0;
+        release(&p->lock);
+        __atomic_sub_fetch(&p->mm->nthread, 1, __ATOMIC_RELAXED);
+        mmunlock(p);
+    }
+
+    // Close all open files. 线程共用主线程的文件描述符表，由主线程关闭，
+    // 这时其他线程都已经被回收了。
+    for (int fd = 0; own && fd < NOFILE; fd++) {
+        if (p->mm->ofile[fd]) {
+            struct file* f = p->mm->ofile[fd];
             fileclose(f);
-            p->ofile[fd] = 0;
+            p->mm->ofile[fd] = 0;
         }
     }
 
     begin_op();
     iput(p->cwd);
+    if (own && p->mm->exe) {
+        iallowwrite(p->mm->exe);
+        iput(p->mm->exe);
+    }
     end_op();
     p->cwd = 0;
+    if (own) {
+        p->mm->exe = 0;
+        p->mm->nseg = 0;
+    }
 
     acquire(&wait_lock);
 
@@ -349,13 +718,17 @@ int wait(uint64 addr) {
     int havekids, pid;
     struct proc* p = myproc();
 
+    // 下面在持有自旋锁时 copyout，不能再从可执行文件读页
+    if (addr != 0)
+        uvmprefault(addr, sizeof(int), 1);
+
     acquire(&wait_lock);
 
     for (;;) {
         // Scan through table looking for exited children.
         havekids = 0;
         for (pp = proc; pp < &proc[NPROC]; pp++) {
-            if (pp->parent == p) {
+            if (pp->parent == p && pp->mm != p->mm) { // 线程由 join() 回收
                 // make sure the child isn't still in exit() or swtch().
                 acquire(&pp->lock);
 
@@ -389,16 +762,190 @@ int wait(uint64 addr) {
     }
 }
 
+// 线程
+//
+// clone() 创建的线程是进程表中的一项，有自己的 pid(即线程号)、内核栈、
+// trapframe、用户栈和当前目录，共用调用者的页表和 struct mm(其中有文件
+// 描述符表)。线程的 trapframe
+// 映射在 THREADFRAME(槽位号)，不和主线程的 TRAPFRAME 冲突。线程的 parent
+// 总是主线程(它自己的 mm 就是 &mmown 的那个)，主线程的 wait() 跳过它们，
+// 由同一进程中的任何线程 join() 回收；主线程 exit() 时先杀死并回收
+// 所有线程，所以 mm 总比使用它的线程活得长。
+//
+// 改变地址空间(sbrk、mmap、缺页、fork 复制)的代码持有 mmlock()。
+// 去掉映射或收回权限后，其他 CPU 上正在用户态运行的线程可能还在用 TLB
+// 中的旧表项，threadstale() 用 IPI 把它们拉进内核，进内核时切换到内核
+// 页表，回到用户态时清掉自己的 TLB。已经在内核中 copyin/copyout 的线程
+// 给正在复制的页加了引用(见 vm.c 的 copyaddr())，释放的页不会再被它们写。
+//
+// 锁的顺序：mmlock()、begin_op()、inode 锁，然后才是 mm->lock 等自旋锁。
+// 缺页处理持有 mmlock() 读文件，所以持有 inode 锁时不处理缺页。
+
+// 获取 p 的地址空间。已经被占用时睡眠等待；调用者持有自旋锁、不能睡眠时
+// 返回 -1，成功返回 0。
+int mmlock(struct proc* p) {
+    struct mm* mm = p->mm;
+
+    acquire(&mm->lock);
+    while (mm->busy) {
+        if (holdinglocks()) {
+            release(&mm->lock);
+            return -1;
+        }
+        sleep(mm, &mm->lock);
+    }
+    mm->busy = 1;
+    release(&mm->lock);
+    return 0;
+}
+
+void mmunlock(struct proc* p) {
+    struct mm* mm = p->mm;
+
+    acquire(&mm->lock);
+    mm->busy = 0;
+    release(&mm->lock);
+    wakeup_one(mm);
+}
+
+// p 的页表变了，和 p 共用页表的其他线程回到用户态前也要清 TLB。
+// wait 不为 0 时还要等正在别的 CPU 的用户态运行的线程都进一次内核，
+// 之后它们不会再用旧的表项。
+void threadstale(struct proc* p, int wait) {
+    struct proc* q;
+    struct cpu* c;
+    uint64 n;
+
+    for (q = proc; q < &proc[NPROC]; q++) {
+        if (q != p && q->mm == p->mm) {
+            __atomic_store_n(&q->tlbdirty, ~0U, __ATOMIC_RELAXED);
+            q->cc.perm = 0;
+        }
+    }
+    __sync_synchronize();
+    if (!wait)
+        return;
+
+    push_off();
+    for (c = cpus; c < &cpus[NCPU]; c++) {
+        if (c == mycpu())
+            continue;
+        n = __atomic_load_n(&c->utrap, __ATOMIC_ACQUIRE);
+        __sync_synchronize();
+        q = __atomic_load_n(&c->proc, __ATOMIC_RELAXED);
+        if (!__atomic_load_n(&c->user, __ATOMIC_RELAXED) || q == 0 || q->mm != p->mm)
+            continue;
+        ipi(c - cpus);
+        while (__atomic_load_n(&c->utrap, __ATOMIC_ACQUIRE) == n)
+            ;
+    }
+    pop_off();
+}
+
+// 创建一个和当前进程共用地址空间的线程，从 fn(arg) 开始执行，栈顶为 stack。
+// fn 返回时跳到无效地址 ~0 而被杀死，线程应当调用 exit() 结束。
+// 返回线程的 pid，失败时返回 -1。
+int clone(uint64 fn, uint64 arg, uint64 stack) {
+    struct proc *np, *leader;
+    struct proc* p = myproc();
+    int pid;
+
+    mmlock(p);
+    if ((np = allocproc(p)) == 0) {
+        mmunlock(p);
+        return -1;
+    }
+    if (mappages(p->pagetable, np->tfva, PGSIZE, (uint64)np->trapframe, PTE_R | PTE_W) < 0) {
+        freeproc(np);
+        release(&np->lock);
+        mmunlock(p);
+        return -1;
+    }
+    __atomic_add_fetch(&p->mm->nthread, 1, __ATOMIC_RELAXED);
+
+    *(np->trapframe) = *(p->trapframe);
+    np->trapframe->epc = fn;
+    np->trapframe->a0 = arg;
+    np->trapframe->sp = stack & ~15UL;
+    np->trapframe->ra = ~0UL;
+
+    // 文件描述符表在共用的 mm 中，当前目录各自一份
+    np->cwd = idup(p->cwd);
+    safestrcpy(np->name, p->name, sizeof(p->name));
+    np->sys_trace_mask = p->sys_trace_mask;
+    pid = np->pid;
+    release(&np->lock);
+    mmunlock(p);
+
+    acquire(&wait_lock);
+    leader = p->mm == &p->mmown ? p : p->parent;
+    np->parent = leader;
+    release(&wait_lock);
+
+    acquire(&np->lock);
+    np->cpu = cpuid();
+    makerunnable(np);
+    release(&np->lock);
+
+    return pid;
+}
+
+// 等待同一进程中线程号为 tid 的线程(tid 为 0 时任意一个)退出，回收它，
+// 退出状态复制到 addr。主线程不能被等待。返回线程号，没有可等的线程时返回 -1。
+int join(int tid, uint64 addr) {
+    struct proc *pp, *leader;
+    struct proc* p = myproc();
+    int found, pid;
+
+    // 下面在持有自旋锁时 copyout
+    if (addr != 0)
+        uvmprefault(addr, sizeof(int), 1);
+
+    acquire(&wait_lock);
+    leader = p->mm == &p->mmown ? p : p->parent;
+    for (;;) {
+        found = 0;
+        for (pp = proc; pp < &proc[NPROC]; pp++) {
+            if (pp == p || pp->parent != leader || pp->mm != p->mm ||
+                (tid != 0 && pp->pid != tid))
+                continue;
+            acquire(&pp->lock);
+            found = 1;
+            if (pp->state == ZOMBIE) {
+                pid = pp->pid;
+                if (addr != 0 && copyout(p->pagetable, addr, (char*)&pp->xstate,
+                                         sizeof(pp->xstate)) < 0) {
+                    release(&pp->lock);
+                    release(&wait_lock);
+                    return -1;
+                }
+                freeproc(pp);
+                release(&pp->lock);
+                release(&wait_lock);
+                return pid;
+            }
+            release(&pp->lock);
+        }
+        if (!found || killed(p)) {
+            release(&wait_lock);
+            return -1;
+        }
+        sleep(leader, &wait_lock); // 线程退出时唤醒主线程
+    }
+}
+
 // 每个CPU的调度器函数
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run.
+//  - choose a process to run: 本 CPU 运行队列的头部，
+//    队列空了就从其他 CPU 的队列偷一个。
 //  - swtch to start running that process.
 //  - eventually that process transfers control
 //    via swtch back to the scheduler.
 void scheduler(void) {
     struct proc* p;
     struct cpu* c = mycpu();
+    int id = cpuid();
 
     c->proc = 0;
     for (;;) {
@@ -407,29 +954,51 @@ void scheduler(void) {
         // processes are waiting.
         intr_on();
 
-        int found = 0;
-        for (p = proc; p < &proc[NPROC]; p++) {
-            acquire(&p->lock);
-            if (p->state == RUNNABLE) {
-                // Switch to chosen process.  It is the process's job
-                // to release its lock and then reacquire it
-                // before jumping back to us.
-                p->state = RUNNING;
-                c->proc = p;
-                swtch(&c->context, &p->context);
-
-                // Process is done running for now.
-                // It should have changed its p->state before coming back.
-                c->proc = 0;
-                found = 1;
+        if ((p = runqget(id)) == 0 && (p = runqsteal(id)) == 0) {
+            // 没有可运行的进程：先预先清零一些空闲页，池满了再睡
+            if (kzero_idle() > 0)
+                continue;
+            // nothing to run; stop running on this core until an interrupt.
+            // 关着中断执行 wfi，检查队列之后到来的中断也能叫醒它。
+            intr_off();
+            if (runqidle(id)) {
+                timerslice(0);
+                asm volatile("wfi");
+                __atomic_store_n(&c->idle, 0, __ATOMIC_RELAXED);
             }
-            release(&p->lock);
+            continue;
         }
-        if (found == 0) {
-            // nothing to run; stop running on this core until an interrupt.
-            intr_on();
-            asm volatile("wfi");
+
+        // 时间片的时钟中断。timer.c 的锁在 p->lock 之前获取，这里还没有持有 p->lock。
+        timerslice(schedpolicy == SCHED_MLFQ ? SLICECYCLES : TICKCYCLES);
+
+        acquire(&p->lock);
+        if (p->state != RUNNABLE)
+            panic("scheduler: queued process not runnable");
+        if (p->swapping) {
+            // 正在换出它的页，放回队列稍后再运行
+            runqput(p, id);
+            release(&p->lock);
+            continue;
         }
+
+        // Switch to chosen process.  It is the process's job
+        // to release its lock and then reacquire it
+        // before jumping back to us.
+        p->state = RUNNING;
+        p->cpu = id;
+        c->proc = p;
+        c->nsched++;
+        p->runstart = r_time();
+        p->waittime += p->runstart - p->readytime;
+        c->schedwait += p->runstart - p->readytime;
+        swtch(&c->context, &p->context);
+
+        // Process is done running for now.
+        // It should have changed its p->state before coming back.
+        p->runtime += r_time() - p->runstart;
+        c->proc = 0;
+        release(&p->lock);
     }
 }
 
@@ -455,11 +1024,40 @@ void sched(void) {
     mycpu()->intena = intena;
 }
 
+// 换出页时调用：能否换出进程表第 i 项的页。可以时返回这个进程。
+// 当前进程总是可以；其他进程必须在用户态边界让出了 CPU、正在等待调度，
+// 为它设置 swapping，在 procswapend() 之前调度器不会运行它。
+struct proc* procswapbegin(int i) {
+    struct proc* p = &proc[i];
+
+    if (__atomic_load_n(&p->mm->nthread, __ATOMIC_RELAXED) > 1)
+        return 0;
+    if (p == myproc())
+        return p;
+    acquire(&p->lock);
+    if (p->state != RUNNABLE || !p->swapok || p->swapping) {
+        release(&p->lock);
+        return 0;
+    }
+    p->swapping = 1;
+    release(&p->lock);
+    return p;
+}
+
+void procswapend(struct proc* p) {
+    if (p == myproc())
+        return;
+    acquire(&p->lock);
+    p->swapping = 0;
+    release(&p->lock);
+}
+
 // 进程让出 CPU，进入 RUNNABLE 状态。
 void yield(void) {
     struct proc* p = myproc();
     acquire(&p->lock);
-    p->state = RUNNABLE;
+    mlfqcharge(p, 0);
+    makerunnable(p);
     sched();
     release(&p->lock);
 }
@@ -486,83 +1084,153 @@ void forkret(void) {
     usertrapret();
 }
 
+// 等待队列
+//
+// 睡眠的进程按 chan 的哈希挂在 waitq[] 的一个桶上，wakeup() 只查看这个桶。
+// 锁的顺序是 sleep() 的 lk、桶的锁、p->lock。被唤醒(或被 kill)的进程
+// 由 sleep() 自己从桶中摘下，在此之前 wakeup() 看到它不再是 SLEEPING，跳过它。
+
+#define NWAITQ 64
+
+struct waitq {
+    struct spinlock lock;
+    struct proc* head; // 按入睡的先后排列
+    struct proc* tail;
+} waitq[NWAITQ];
+
+void waitqinit(void) {
+    for (int i = 0; i < NWAITQ; i++)
+        initlock(&waitq[i].lock, "waitq");
+}
+
+static struct waitq* chanq(void* chan) {
+    uint64 h = (uint64)chan * 0x9e3779b97f4a7c15UL; // Fibonacci 哈希
+    return &waitq[h >> 58];                         // 取高 6 位
+}
+
 // 进程进入睡眠状态，等待某个事件发生。
 // 原子释放 lk 锁，并将进程状态设置为 SLEEPING。
 void sleep(void* chan, struct spinlock* lk) {
     struct proc* p = myproc();
+    struct waitq* wq = chanq(chan);
 
     // Must acquire p->lock in order to
     // change p->state and then call sched.
-    // Once we hold p->lock, we can be
-    // guaranteed that we won't miss any wakeup
-    // (wakeup locks p->lock),
-    // so it's okay to release lk.
-
+    // 挂上桶、置为 SLEEPING 之后才释放 lk：wakeup() 的调用者持有 lk 改变
+    // 条件，之后不加锁地看桶是否为空时一定能看到这次睡眠。
+    acquire(&wq->lock);
     acquire(&p->lock); // DOC: sleeplock1
-    release(lk);
+    mlfqcharge(p, 1);
 
     // Go to sleep.
+    p->wqnext = 0;
+    p->wqprev = wq->tail;
+    if (wq->tail)
+        wq->tail->wqnext = p;
+    else
+        wq->head = p;
+    wq->tail = p;
     p->chan = chan;
     p->state = SLEEPING;
+    release(lk);
+    release(&wq->lock);
 
     sched();
 
     // Tidy up.
     p->chan = 0;
+    release(&p->lock);
+
+    acquire(&wq->lock);
+    if (p->wqprev)
+        p->wqprev->wqnext = p->wqnext;
+    else
+        wq->head = p->wqnext;
+    if (p->wqnext)
+        p->wqnext->wqprev = p->wqprev;
+    else
+        wq->tail = p->wqprev;
+    release(&wq->lock);
 
     // Reacquire original lock.
-    release(&p->lock);
     acquire(lk);
 }
 
-// 唤醒所有在 chan 上睡眠的进程。
-void wakeup(void* chan) {
+// 按入睡的先后唤醒至多 n 个在 chan 上睡眠的进程，返回唤醒的个数
+static int wakechan(void* chan, int n) {
+    struct waitq* wq = chanq(chan);
     struct proc* p;
+    int woken = 0;
 
-    for (p = proc; p < &proc[NPROC]; p++) {
-        if (p != myproc()) {
-            acquire(&p->lock);
-            if (p->state == SLEEPING && p->chan == chan) {
-                p->state = RUNNABLE;
-            }
-            release(&p->lock);
+    // 睡眠者在释放 lk 之前已经挂上桶，持有 lk 的调用者不加锁也能看到它
+    if (__atomic_load_n(&wq->head, __ATOMIC_RELAXED) == 0)
+        return 0;
+    acquire(&wq->lock);
+    for (p = wq->head; p && woken < n; p = p->wqnext) {
+        acquire(&p->lock);
+        if (p->state == SLEEPING && p->chan == chan) {
+            makerunnable(p);
+            woken++;
         }
+        release(&p->lock);
     }
+    release(&wq->lock);
+    return woken;
+}
+
+// 唤醒所有在 chan 上睡眠的进程。
+void wakeup(void* chan) {
+    wakechan(chan, NPROC);
+}
+
+// 只唤醒一个在 chan 上睡眠的进程，用于一次只有一个等待者能继续的场合，
+// 避免唤醒所有等待者后它们又都睡回去。被唤醒的进程如果发现条件仍不满足
+// 而再次睡眠，要由下一次 wakeup 来唤醒其他等待者。
+void wakeup_one(void* chan) {
+    wakechan(chan, 1);
+}
+
+// 唤醒至多 n 个在 chan 上睡眠的进程，返回唤醒的个数
+int wakeup_n(void* chan, int n) {
+    return wakechan(chan, n);
 }
 
 // 设置指定进程的killed标志，若进程正在睡眠状态，则将其唤醒。
+// pid 不会重复使用，不加锁找到 pid 所在的槽位后只锁这一个进程，
+// 再确认它还是这个进程。
 int kill(int pid) {
     struct proc* p;
 
-    for (p = proc; p < &proc[NPROC]; p++) {
-        acquire(&p->lock);
-        if (p->pid == pid) {
-            p->killed = 1;
-            if (p->state == SLEEPING) {
-                // Wake process from sleep().
-                p->state = RUNNABLE;
-            }
-            release(&p->lock);
-            return 0;
-        }
+    if (pid <= 0)
+        return -1;
+    for (p = proc; p < &proc[NPROC]; p++)
+        if (__atomic_load_n(&p->pid, __ATOMIC_RELAXED) == pid)
+            break;
+    if (p == &proc[NPROC])
+        return -1;
+
+    acquire(&p->lock);
+    if (p->pid != pid) { // 找到之后已经退出并被回收
         release(&p->lock);
+        return -1;
+    }
+    __atomic_store_n(&p->killed, 1, __ATOMIC_RELAXED);
+    if (p->state == SLEEPING) {
+        // Wake process from sleep().
+        makerunnable(p);
     }
-    return -1;
+    release(&p->lock);
+    return 0;
 }
 
 void setkilled(struct proc* p) {
-    acquire(&p->lock);
-    p->killed = 1;
-    release(&p->lock);
+    __atomic_store_n(&p->killed, 1, __ATOMIC_RELAXED);
 }
 
+// 每次陷入和系统调用返回都要检查，不获取 p->lock。
+// killed 只会从 0 变为 1(回收时才清零)，读到旧值最多晚一点发现。
 int killed(struct proc* p) {
-    int k;
-
-    acquire(&p->lock);
-    k = p->killed;
-    release(&p->lock);
-    return k;
+    return __atomic_load_n(&p->killed, __ATOMIC_RELAXED);
 }
 
 // 支持从用户地址或内核地址复制数据到用户空间。
@@ -597,6 +1265,7 @@ void procdump(void) {
         [ZOMBIE] = "zombie"};
     struct proc* p;
     char* state;
+    struct procinfo pi;
 
     printf("\n");
     for (p = proc; p < &proc[NPROC]; p++) {
@@ -607,6 +1276,68 @@ void procdump(void) {
         else
             state = "???";
         printf("%d %s %s", p->pid, state, p->name);
+        if (p->pagetable) {
+            uvmacct(p->mm, &pi);
+            printf(" rss %ld pt %ld flt %ld/%ld", pi.rss, pi.ptpages, pi.minflt, pi.majflt);
+        }
         printf("\n");
+        // 正在运行的进程可能同时在改页表，只遍历睡眠和就绪的进程
+        // 线程共用主线程的页表，只打印一次
+        if ((p->state == SLEEPING || p->state == RUNNABLE) && p->pagetable &&
+            p->mm == &p->mmown)
+            vmprint(p->pagetable, p->mm);
     }
 }
+
+// 把至多 n 个进程的内存和调度统计复制到用户地址 addr 处的 struct procinfo 数组，
+// 返回复制的个数，出错时返回 -1。
+int procinfo(uint64 addr, int n) {
+    struct proc* p;
+    struct procinfo pi;
+    int i = 0;
+
+    for (p = proc; p < &proc[NPROC] && i < n; p++) {
+        // 持有 p->lock 时进程不会被 wait() 回收、释放页表
+        acquire(&p->lock);
+        if (p->state == UNUSED) {
+            release(&p->lock);
+            continue;
+        }
+        memset(&pi, 0, sizeof(pi));
+        pi.pid = p->pid;
+        pi.state = p->state;
+        safestrcpy(pi.name, p->name, sizeof(pi.name));
+        pi.sz = p->mm->sz;
+        pi.level = p->level;
+        pi.runtime = p->runtime;
+        pi.waittime = p->waittime;
+        if (p->state == RUNNING)
+            pi.runtime += r_time() - p->runstart;
+        else if (p->state == RUNNABLE)
+            pi.waittime += r_time() - p->readytime;
+        // 线程的 mm 是主线程的，主线程在所有线程被回收之后才释放
+        if (p->pagetable)
+            uvmacct(p->mm, &pi);
+        release(&p->lock);
+        if (copyout(myproc()->pagetable, addr + i * sizeof(pi), (char*)&pi, sizeof(pi)) < 0)
+            return -1;
+        i++;
+    }
+    return i;
+}
+
+// 统计不处于 UNUSED 状态的进程数
+uint64 nproc(void) {
+    struct proc* p;
+    uint64 n;
+    uint seq;
+
+    do {
+        seq = seqbegin(&procseq);
+        n = 0;
+        for (p = proc; p < &proc[NPROC]; p++)
+            if (__atomic_load_n(&p->state, __ATOMIC_RELAXED) != UNUSED)
+                n++;
+    } while (seqretry(&procseq, seq));
+    return n;
+}
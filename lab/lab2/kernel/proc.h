@@ -24,11 +24,45 @@ struct context {
 
 // 每个CPU的状态信息
 // Per-CPU state.
+// 睡眠到某个时间的进程的定时器，见 timer.c
+struct timer {
+    uint64 when; // 到期的 r_time()
+    int cpu;     // 在哪个 CPU 的堆中，-1 表示不在堆中
+    int idx;     // 在堆中的下标
+};
+
+// 一个优先级的运行队列
+struct runq {
+    struct proc* head;
+    struct proc* tail;
+};
+
+// 调度策略，编译时用 SCHED=mlfq 选择 MLFQ
+enum { SCHED_RR,
+       SCHED_MLFQ };
+
 struct cpu {
     struct proc* proc;      // 当前运行的进程（若无则为null)
     struct context context; // 用于进入scheduler()时的上下文切换
     int noff;               // push_off()调用深度(中断禁用计数)
     int intena;             // 中断在push_off()前的状态
+    uint64 uret;            // 回到用户态的次数
+    uint64 tlbflush;        // 其中清除了 TLB 表项的次数
+
+    // 运行队列：等待在这个 CPU 上运行的 RUNNABLE 进程，
+    // 每个优先级一个队列，先进先出。轮转调度只用 rq[0]。
+    struct spinlock rqlock;
+    struct runq rq[NMLFQ];
+    int nrunq;              // 各队列的总长度
+    uint boostgen;          // 队列中的进程已经按第几次优先级提升调整过
+    int idle;               // 正在 wfi，有进程放进运行队列时要用 IPI 叫醒它
+    uint64 nclock;          // 时钟中断的次数
+    uint64 nipi;            // 收到的处理器间中断的次数
+    int user;               // 正在用户态运行 proc，TLB 中可能有它的用户页的表项
+    uint64 utrap;           // 从用户态进入内核的次数
+    uint64 nsched;          // 调度进程运行的次数
+    uint64 schedwait;       // 进程从进入队列到开始运行的总时间 (r_time() 周期)
+    uint64 steal;           // 从其他 CPU 的队列偷取进程的次数
 };
 
 extern struct cpu cpus[NCPU];
@@ -90,8 +124,63 @@ enum procstate { UNUSED,
                  RUNNING,
                  ZOMBIE };
 
+// exec 记录的一个程序段，缺页时从可执行文件读入
+struct execseg {
+    uint64 va;     // 段的起始虚拟地址，页对齐
+    uint64 memsz;  // 段在内存中的大小
+    uint64 filesz; // 其中来自文件的部分，其余为 .bss
+    uint off;      // 段在文件中的偏移
+    int perm;      // 映射的 PTE 权限
+};
+
+// mmap 建立的一段文件映射，缺页时从页缓存取页
+struct vma {
+    uint64 addr;    // 起始虚拟地址，页对齐；len 为 0 表示空闲
+    uint64 len;     // 长度，页的整数倍
+    int prot;       // PROT_*
+    int flags;      // MAP_SHARED 或 MAP_PRIVATE
+    struct file* f; // 映射持有文件的一个引用
+    uint off;       // addr 对应的文件偏移
+};
+
+// struct mm 中地址空间的记账，随页表的修改增量维护，见 vm.c
+enum { ACCT_RSS,     // 驻留的用户页数
+       ACCT_PTPAGES, // 页表页数，含根页表
+       ACCT_MINFLT,  // 次缺页次数
+       ACCT_MAJFLT,  // 主缺页次数
+       NACCT };
+
+// 用户地址空间：大小和布局，以及文件描述符表。普通进程用自己的 p->mmown；
+// 同一进程的线程共用页表和打开的文件，也就共用主线程的 mm。
+struct mm {
+    struct spinlock lock;         // 保护 busy 和 ofile
+    int busy;                     // 有线程正在缺页或改变地址空间，见 mmlock()
+    int nthread;                  // 共用它的线程数，原子地读写
+    uint64 sz;                    // 进程内存大小
+    struct inode* exe;            // 正在运行的可执行文件
+    struct execseg seg[NEXECSEG]; // 按需读入的程序段
+    int nseg;
+    struct vma vma[NVMA];         // mmap 的映射，位于 sz 之上、TRAPFRAMES 之下
+    uint64 acct[NACCT];           // 记账，原子地读写
+    struct file* ofile[NOFILE];   // 打开的文件描述符
+};
+
 // 进程的数据结构
 // Per-process state
+// copyin/copyout 最近一次翻译的用户页，页表变化时由 tlbstale() 作废
+struct copycache {
+    uint64 va; // 用户页的虚拟地址
+    uint64 pa; // 物理地址
+    int perm;  // 0 表示无效；PTE_R 只读，PTE_R | PTE_W 可写且已记下 PTE_D
+};
+
+// copyin_batch() 的一段：从用户地址 va 复制 len 字节到 dst
+struct copyseg {
+    char* dst;
+    uint64 va;
+    uint64 len;
+};
+
 struct proc {
     struct spinlock lock; // 自旋锁保护该进程数据结构
 
@@ -101,6 +190,22 @@ struct proc {
     int killed;           // 是否被终止
     int xstate;           // 退出状态
     int pid;              // 进程 ID
+    int swapok;           // 在用户态边界让出 CPU，等待调度期间可以换出它的页
+    int swapping;         // 正在换出它的页，调度器暂不运行它
+    int asid;             // 用户页表的 ASID，0 表示不用 ASID
+    uint tlbdirty;        // 哪些 CPU 的 TLB 中可能有 asid 的过时表项
+    int cpu;              // 上次运行它的 CPU，唤醒时放回这个 CPU 的运行队列
+    struct proc* rqnext;  // 运行队列中的下一个进程
+    struct proc* wqnext;  // 等待队列中的前后进程，由队列的锁保护
+    struct proc* wqprev;
+    uint64 readytime;     // 进入运行队列的时间
+    uint64 runstart;      // 这一次开始运行的时间
+    uint64 runtime;       // 累计运行时间 (r_time() 周期)
+    uint64 waittime;      // 累计在运行队列中等待的时间
+    int level;            // MLFQ 优先级
+    uint64 allot;         // 在这一级上已经用掉的时间
+    uint boostgen;        // 按第几次优先级提升调整过 level
+    struct timer timer;   // 睡眠到某个时间，由 timer.c 中堆的锁保护
 
     // wait_lock must be held when using this:
     struct proc* parent; // 父进程
@@ -108,11 +213,17 @@ struct proc {
 
     // 以下是进程私有，无须锁保护
     uint64 kstack;               // 内核栈虚拟地址
-    uint64 sz;                   // 进程内存大小
-    pagetable_t pagetable;       // 进程页表
+    pagetable_t pagetable;       // 进程页表，线程共用
+    struct mm* mm;               // 地址空间，线程共用主线程的
+    struct mm mmown;
     struct trapframe* trapframe; // trapframe页，用于用户内核切换
+    uint64 tfva;                 // trapframe 在用户页表中的地址
     struct context context;      // 上下文，用于用户内核切换
-    struct file* ofile[NOFILE];  // 打开的文件描述符
-    struct inode* cwd;           // 当前工作目录
+    struct inode* cwd;           // 当前工作目录，线程各自一份
+    uint64 execstart;            // exec 开始的时间，回到用户态后清零
+    struct copycache cc;         // 复制用户内存时的翻译缓存
+    int ilocks;                  // 持有的 inode 锁数，不为 0 时 copyin/copyout 不处理缺页
+    int faultskip;               // copyin/copyout 因此没有处理缺页
+    int nomem;                   // 有 kalloc 因内存不足失败，uvmtrap() 据此决定是否回收后重试
     char name[16];               // 进程名
 };
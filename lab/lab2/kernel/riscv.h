@@ -78,6 +78,7 @@ static inline void w_sie(uint64 x) {
 }
 
 // Machine-mode Interrupt Enable
+#define MIE_MSIE (1L << 3) // machine software
 #define MIE_STIE (1L << 5) // supervisor timer
 static inline uint64 r_mie() {
     uint64 x;
@@ -89,6 +90,15 @@ static inline void w_mie(uint64 x) {
     asm volatile("csrw mie, %0" : : "r"(x));
 }
 
+// Machine-mode interrupt vector
+static inline void w_mtvec(uint64 x) {
+    asm volatile("csrw mtvec, %0" : : "r"(x));
+}
+
+static inline void w_mscratch(uint64 x) {
+    asm volatile("csrw mscratch, %0" : : "r"(x));
+}
+
 // supervisor exception program counter, holds the
 // instruction address to which a return from
 // exception will go.
@@ -175,6 +185,8 @@ static inline void w_pmpaddr0(uint64 x) {
 #define SATP_SV39 (8L << 60)
 
 #define MAKE_SATP(pagetable) (SATP_SV39 | (((uint64)pagetable) >> 12))
+#define SATP_ASID(asid) ((uint64)(asid) << 44) // 地址空间标识，TLB 表项按它区分
+#define SATP_ASIDMASK SATP_ASID(0xffff)
 
 // supervisor address translation and protection;
 // holds the address of the page table.
@@ -220,6 +232,13 @@ static inline uint64 r_time() {
     return x;
 }
 
+// 处理器的时钟周期数
+static inline uint64 r_cycle() {
+    uint64 x;
+    asm volatile("csrr %0, cycle" : "=r"(x));
+    return x;
+}
+
 // enable device interrupts
 static inline void intr_on() {
     w_sstatus(r_sstatus() | SSTATUS_SIE);
@@ -266,6 +285,11 @@ static inline void sfence_vma() {
     asm volatile("sfence.vma zero, zero");
 }
 
+// 只清掉 TLB 中属于地址空间 asid 的表项(全局表项除外)
+static inline void sfence_vma_asid(uint64 asid) {
+    asm volatile("sfence.vma zero, %0" : : "r"(asid));
+}
+
 typedef uint64 pte_t;
 typedef uint64* pagetable_t; // 512 PTEs
 
@@ -277,11 +301,20 @@ typedef uint64* pagetable_t; // 512 PTEs
 #define PGROUNDUP(sz) (((sz) + PGSIZE - 1) & ~(PGSIZE - 1))
 #define PGROUNDDOWN(a) (((a)) & ~(PGSIZE - 1))
 
+#define SUPERPGSIZE (2 * (1 << 20)) // 2MB 大页，由第 1 级页表的叶子 PTE 映射
+#define SUPERPGROUNDUP(sz) (((sz) + SUPERPGSIZE - 1) & ~(SUPERPGSIZE - 1))
+#define SUPERPGROUNDDOWN(a) (((a)) & ~(SUPERPGSIZE - 1))
+
 #define PTE_V (1L << 0) // valid
 #define PTE_R (1L << 1)
 #define PTE_W (1L << 2)
 #define PTE_X (1L << 3)
 #define PTE_U (1L << 4) // user can access
+#define PTE_G (1L << 5) // global：所有地址空间中都相同的映射，TLB 表项不区分 ASID
+#define PTE_A (1L << 6) // accessed，QEMU 由硬件置位
+#define PTE_D (1L << 7) // dirty，页被写过
+#define PTE_COW (1L << 8) // RSW 位：写时复制的共享页
+#define PTE_SWAP (1L << 9) // RSW 位：页在交换区，PPN 字段是槽位号，V 为 0
 
 // shift a physical address to the right place for a PTE.
 #define PA2PTE(pa) ((((uint64)pa) >> 12) << 10)
@@ -290,6 +323,9 @@ typedef uint64* pagetable_t; // 512 PTEs
 
 #define PTE_FLAGS(pte) ((pte) & 0x3FF)
 
+// R、W、X 任一位置位的 PTE 是叶子，否则指向下一级页表
+#define PTE_LEAF(pte) ((pte) & (PTE_R | PTE_W | PTE_X))
+
 // extract the three 9-bit page table indices from a virtual address.
 #define PXMASK 0x1FF // 9 bits
 #define PXSHIFT(level) (PGSHIFT + (9 * (level)))
@@ -0,0 +1,97 @@
+// 读写自旋锁和顺序锁
+//
+// 用于读多写少的内核状态。读写锁让读者并行，只有写者之间、写者和读者
+// 之间互斥；顺序锁的读者完全不写共享内存，不会让缓存行在 CPU 之间来回
+// 搬，适合很短、可以重读的读操作。两者持有期间都关中断，和自旋锁一样
+// 不能睡眠。
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "rwlock.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define RWWRITER 0x80000000
+
+void initrwlock(struct rwlock* rw, char* name) {
+    rw->cnt = 0;
+    rw->wwait = 0;
+    rw->name = name;
+}
+
+void racquire(struct rwlock* rw) {
+    uint c;
+
+    push_off();
+    for (;;) {
+        while (__atomic_load_n(&rw->wwait, __ATOMIC_RELAXED) != 0 ||
+               ((c = __atomic_load_n(&rw->cnt, __ATOMIC_RELAXED)) & RWWRITER) != 0)
+            ;
+        if (__atomic_compare_exchange_n(&rw->cnt, &c, c + 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+    }
+}
+
+void rrelease(struct rwlock* rw) {
+    if (__atomic_fetch_sub(&rw->cnt, 1, __ATOMIC_RELEASE) == 0)
+        panic("rrelease");
+    pop_off();
+}
+
+void wacquire(struct rwlock* rw) {
+    uint c;
+
+    push_off();
+    __atomic_fetch_add(&rw->wwait, 1, __ATOMIC_RELAXED);
+    for (;;) {
+        c = 0;
+        if (__atomic_compare_exchange_n(&rw->cnt, &c, RWWRITER, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+        while (__atomic_load_n(&rw->cnt, __ATOMIC_RELAXED) != 0)
+            ;
+    }
+    __atomic_fetch_sub(&rw->wwait, 1, __ATOMIC_RELAXED);
+}
+
+void wrelease(struct rwlock* rw) {
+    if (__atomic_load_n(&rw->cnt, __ATOMIC_RELAXED) != RWWRITER)
+        panic("wrelease");
+    __atomic_store_n(&rw->cnt, 0, __ATOMIC_RELEASE);
+    pop_off();
+}
+
+void initseqlock(struct seqlock* sl, char* name) {
+    initlock(&sl->lk, name);
+    sl->seq = 0;
+}
+
+// 写者：seq 变为奇数，读者在此期间读到的数据都会被丢弃
+void seqacquire(struct seqlock* sl) {
+    acquire(&sl->lk);
+    __atomic_store_n(&sl->seq, sl->seq + 1, __ATOMIC_RELAXED);
+    __sync_synchronize();
+}
+
+void seqrelease(struct seqlock* sl) {
+    __sync_synchronize();
+    __atomic_store_n(&sl->seq, sl->seq + 1, __ATOMIC_RELAXED);
+    release(&sl->lk);
+}
+
+// 读者开始读，返回当时的 seq。有写者在写时等它写完。
+uint seqbegin(struct seqlock* sl) {
+    uint seq;
+
+    while ((seq = __atomic_load_n(&sl->seq, __ATOMIC_RELAXED)) & 1)
+        ;
+    __sync_synchronize();
+    return seq;
+}
+
+// 读者读完，期间有写者写过时返回 1，要重读
+int seqretry(struct seqlock* sl, uint seq) {
+    __sync_synchronize();
+    return __atomic_load_n(&sl->seq, __ATOMIC_RELAXED) != seq;
+}
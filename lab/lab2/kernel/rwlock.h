@@ -0,0 +1,13 @@
+// 读写自旋锁：多个读者可以同时持有，写者独占
+struct rwlock {
+    uint cnt;   // 持有的读者数，写者持有时为 RWWRITER
+    uint wwait; // 等待的写者数，不为 0 时新的读者等待，写者不会饿死
+    char* name;
+};
+
+// 顺序锁：读者不加锁，读完后检查 seq 是否变过，变过就重读。
+// 写者之间用 lk 互斥，写期间 seq 为奇数。
+struct seqlock {
+    uint seq;
+    struct spinlock lk;
+};
@@ -0,0 +1,191 @@
+// Slab 对象缓存
+//
+// 为小的内核对象(pipe、file、inode 等)提供按类型划分的缓存。
+// 每个 slab 是 kalloc() 得到的一页：页首是 struct slab 和空闲对象
+// 下标栈，后面紧跟着等大的对象。对象在 slab 创建时调用一次构造函数，
+// 释放时必须恢复到构造后的状态，这样下次分配不用再初始化锁之类的字段。
+//
+// 每个 CPU 有一个小的对象弹匣(magazine)，常见的分配和释放只在
+// 关中断的情况下操作本 CPU 的弹匣，不需要获取缓存的锁。
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define NCACHE 16  // 最多的缓存种类数
+#define MAGSIZE 16 // 每个 CPU 弹匣的容量
+
+struct slab {
+    struct slab* next; // 缓存的 partial 链表
+    struct slab* prev;
+    struct kmem_cache* cache;
+    char* objs;   // 第一个对象的地址
+    ushort nfree; // 空闲对象数，也是 free[] 栈的深度
+    ushort free[]; // 空闲对象的下标
+};
+
+struct magazine {
+    int n;
+    void* obj[MAGSIZE];
+};
+
+struct kmem_cache {
+    struct spinlock lock;
+    char* name;
+    uint size;           // 对象大小，按 8 字节对齐
+    uint perslab;        // 每个 slab 容纳的对象数
+    void (*ctor)(void*); // 构造函数，可以为 0
+    struct slab* partial; // 还有空闲对象的 slab
+    int nslab;            // 已分配的 slab 页数
+    struct magazine mag[NCPU];
+};
+
+struct {
+    struct spinlock lock;
+    struct kmem_cache cache[NCACHE];
+    int n;
+} slabtable;
+
+void slabinit(void) {
+    initlock(&slabtable.lock, "slabtable");
+}
+
+// 创建一个对象大小为 size 的缓存。ctor 在每个对象第一次进入缓存时调用。
+struct kmem_cache* kmem_cache_create(char* name, uint size, void (*ctor)(void*)) {
+    struct kmem_cache* c;
+
+    size = (size + 7) & ~7;
+    if (size == 0 || sizeof(struct slab) + sizeof(ushort) + size > PGSIZE)
+        panic("kmem_cache_create: size");
+
+    acquire(&slabtable.lock);
+    if (slabtable.n >= NCACHE)
+        panic("kmem_cache_create: too many caches");
+    c = &slabtable.cache[slabtable.n++];
+    release(&slabtable.lock);
+
+    initlock(&c->lock, name);
+    c->name = name;
+    c->size = size;
+    c->ctor = ctor;
+    c->perslab = (PGSIZE - sizeof(struct slab)) / (size + sizeof(ushort));
+    // 对象区按 8 字节对齐后可能放不下最后一个
+    while (c->perslab > 0 &&
+           ((sizeof(struct slab) + c->perslab * sizeof(ushort) + 7) & ~7) + c->perslab * size > PGSIZE)
+        c->perslab--;
+    return c;
+}
+
+// 分配一个新的 slab 页，构造其中所有对象，挂到 partial 链表上。
+// 调用者持有 c->lock。内存不足时返回 0。
+static struct slab* slab_grow(struct kmem_cache* c) {
+    struct slab* s;
+
+    if ((s = (struct slab*)kalloc()) == 0)
+        return 0;
+    s->cache = c;
+    s->objs = (char*)s + ((sizeof(struct slab) + c->perslab * sizeof(ushort) + 7) & ~7);
+    s->nfree = c->perslab;
+    for (int i = 0; i < c->perslab; i++) {
+        s->free[i] = c->perslab - 1 - i;
+        if (c->ctor)
+            c->ctor(s->objs + i * c->size);
+    }
+    s->prev = 0;
+    s->next = c->partial;
+    if (s->next)
+        s->next->prev = s;
+    c->partial = s;
+    c->nslab++;
+    return s;
+}
+
+static void slab_unlink(struct kmem_cache* c, struct slab* s) {
+    if (s->prev)
+        s->prev->next = s->next;
+    else
+        c->partial = s->next;
+    if (s->next)
+        s->next->prev = s->prev;
+    s->next = s->prev = 0;
+}
+
+// 从 slab 中取出至多 n 个对象放进弹匣。
+// 调用者持有 c->lock。
+static void mag_fill(struct kmem_cache* c, struct magazine* m, int n) {
+    struct slab* s;
+
+    while (n > 0) {
+        if ((s = c->partial) == 0 && (s = slab_grow(c)) == 0)
+            return;
+        while (n > 0 && s->nfree > 0) {
+            m->obj[m->n++] = s->objs + s->free[--s->nfree] * c->size;
+            n--;
+        }
+        if (s->nfree == 0)
+            slab_unlink(c, s);
+    }
+}
+
+// 把弹匣里的 n 个对象还给各自的 slab，完全空闲的 slab 页还给 kalloc。
+// 调用者持有 c->lock。
+static void mag_flush(struct kmem_cache* c, struct magazine* m, int n) {
+    while (n-- > 0 && m->n > 0) {
+        char* obj = m->obj[--m->n];
+        struct slab* s = (struct slab*)PGROUNDDOWN((uint64)obj);
+
+        if (s->cache != c)
+            panic("kmem_cache_free: wrong cache");
+        if (s->nfree == 0) {
+            // 原来是满的，重新挂回 partial 链表
+            s->prev = 0;
+            s->next = c->partial;
+            if (s->next)
+                s->next->prev = s;
+            c->partial = s;
+        }
+        s->free[s->nfree++] = (obj - s->objs) / c->size;
+        // 保留一个空 slab，避免在边界上反复申请释放页
+        if (s->nfree == c->perslab && (s->prev || s->next)) {
+            slab_unlink(c, s);
+            c->nslab--;
+            kfree((void*)s);
+        }
+    }
+}
+
+// 分配一个处于构造后状态的对象。内存不足时返回 0。
+void* kmem_cache_alloc(struct kmem_cache* c) {
+    struct magazine* m;
+    void* obj = 0;
+
+    push_off();
+    m = &c->mag[cpuid()];
+    if (m->n == 0) {
+        acquire(&c->lock);
+        mag_fill(c, m, MAGSIZE / 2);
+        release(&c->lock);
+    }
+    if (m->n > 0)
+        obj = m->obj[--m->n];
+    pop_off();
+    return obj;
+}
+
+// 释放对象。对象必须已经恢复到构造后的状态(比如锁未被持有)。
+void kmem_cache_free(struct kmem_cache* c, void* obj) {
+    struct magazine* m;
+
+    push_off();
+    m = &c->mag[cpuid()];
+    if (m->n == MAGSIZE) {
+        acquire(&c->lock);
+        mag_flush(c, m, MAGSIZE / 2);
+        release(&c->lock);
+    }
+    m->obj[m->n++] = obj;
+    pop_off();
+}
@@ -1,4 +1,12 @@
 // Sleeping locks
+//
+// 自适应：锁被持有时，如果持有者正在另一个 CPU 上运行，它多半很快就会
+// 释放(缓冲区锁、inode 锁大多只持有一小段时间)，等待者先自旋一会儿，
+// 省掉睡眠和唤醒的两次切换；持有者没有在运行(比如在等磁盘)或自旋太久
+// 时才睡眠。
+//
+// 和自旋锁一样，同名的睡眠锁归为一类统计，lockstat() 把它们列在自旋锁
+// 之后。
 
 #include "types.h"
 #include "riscv.h"
@@ -8,29 +16,118 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "sleeplock.h"
+#include "sysinfo.h"
+
+#define NSLEEPCLASS 16
+#define SPINMAX (TIMEFREQ / 10000) // 最多自旋 100us，之后睡眠
+
+struct sleepcount {
+    uint64 nacquire;
+    uint64 ncontend;
+    uint64 nspin;
+    uint64 nsleep;
+    uint64 holdtime;
+    uint64 waittime;
+} __attribute__((aligned(64))); // 各 CPU 的计数器不共用缓存行
+
+struct sleepclass {
+    char* name;
+    struct sleepcount cnt[NCPU]; // 持有 lk->lk 时由本 CPU 更新
+};
+
+struct {
+    struct spinlock lock;
+    int n;
+    struct sleepclass cls[NSLEEPCLASS];
+} sleeptab;
+
+void sleeplockinit(void) {
+    initlock(&sleeptab.lock, "sleeptab");
+}
+
+// 名为 name 的睡眠锁的类，没有就新建一个。类满了时归入最后一类。
+static struct sleepclass* sleepclass(char* name) {
+    struct sleepclass* c;
+    int i;
+
+    acquire(&sleeptab.lock);
+    for (i = 0; i < sleeptab.n; i++)
+        if (sleeptab.cls[i].name == name || strncmp(sleeptab.cls[i].name, name, 16) == 0)
+            break;
+    if (i == sleeptab.n) {
+        if (i == NSLEEPCLASS)
+            i--;
+        else
+            sleeptab.cls[sleeptab.n++].name = i == NSLEEPCLASS - 1 ? "other" : name;
+    }
+    c = &sleeptab.cls[i];
+    release(&sleeptab.lock);
+    return c;
+}
 
 void initsleeplock(struct sleeplock* lk, char* name) {
     initlock(&lk->lk, "sleep lock");
     lk->name = name;
     lk->locked = 0;
     lk->pid = 0;
+    lk->owner = 0;
+    lk->cls = sleepclass(name);
+}
+
+// 持有者 o 正在某个 CPU 上运行时不加锁地自旋，直到锁被释放、换了持有者、
+// 持有者不再运行或者从 start 起等了 SPINMAX。返回自旋的次数。
+static uint64 spinwait(struct sleeplock* lk, struct proc* o, uint64 start) {
+    uint64 n = 0;
+
+    while (__atomic_load_n(&lk->locked, __ATOMIC_RELAXED) &&
+           __atomic_load_n(&lk->owner, __ATOMIC_RELAXED) == o &&
+           __atomic_load_n(&o->state, __ATOMIC_RELAXED) == RUNNING &&
+           r_time() - start < SPINMAX)
+        n++;
+    return n;
 }
 
 void acquiresleep(struct sleeplock* lk) {
+    struct sleepcount* cnt;
+    struct proc* o;
+    uint64 start = 0, spin = 0, nsleep = 0;
+
     acquire(&lk->lk);
+    if (lk->locked)
+        start = r_time();
     while (lk->locked) {
-        sleep(lk, &lk->lk);
+        o = lk->owner;
+        release(&lk->lk);
+        spin += spinwait(lk, o, start);
+        acquire(&lk->lk);
+        if (lk->locked) {
+            nsleep++;
+            sleep(lk, &lk->lk);
+        }
     }
-    lk->locked = 1;
+    __atomic_store_n(&lk->locked, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&lk->owner, myproc(), __ATOMIC_RELAXED);
     lk->pid = myproc()->pid;
+    lk->acqtime = r_time();
+
+    cnt = &lk->cls->cnt[cpuid()];
+    cnt->nacquire++;
+    if (start) {
+        cnt->ncontend++;
+        cnt->nspin += spin;
+        cnt->nsleep += nsleep;
+        cnt->waittime += lk->acqtime - start;
+    }
     release(&lk->lk);
 }
 
 void releasesleep(struct sleeplock* lk) {
     acquire(&lk->lk);
-    lk->locked = 0;
+    lk->cls->cnt[cpuid()].holdtime += r_time() - lk->acqtime;
+    __atomic_store_n(&lk->owner, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&lk->locked, 0, __ATOMIC_RELAXED);
     lk->pid = 0;
-    wakeup(lk);
+    wakeup_one(lk); // 只有一个等待者能拿到锁
     release(&lk->lk);
 }
 
@@ -42,3 +139,32 @@ int holdingsleep(struct sleeplock* lk) {
     release(&lk->lk);
     return r;
 }
+
+// 把至多 n 类睡眠锁的统计复制到用户地址 addr 处的 struct lockstat 数组，
+// 返回复制的个数，出错时返回 -1。
+int sleeplockstat(uint64 addr, int n) {
+    struct lockstat ls;
+    struct sleepclass* c;
+    int i, k, nclass;
+
+    acquire(&sleeptab.lock);
+    nclass = sleeptab.n;
+    release(&sleeptab.lock);
+    for (i = 0; i < nclass && i < n; i++) {
+        c = &sleeptab.cls[i];
+        memset(&ls, 0, sizeof(ls));
+        safestrcpy(ls.name, c->name, sizeof(ls.name));
+        ls.sleeplock = 1;
+        for (k = 0; k < NCPU; k++) {
+            ls.nacquire += c->cnt[k].nacquire;
+            ls.ncontend += c->cnt[k].ncontend;
+            ls.nspin += c->cnt[k].nspin;
+            ls.nsleep += c->cnt[k].nsleep;
+            ls.holdtime += c->cnt[k].holdtime;
+            ls.waittime += c->cnt[k].waittime;
+        }
+        if (copyout(myproc()->pagetable, addr + i * sizeof(ls), (char*)&ls, sizeof(ls)) < 0)
+            return -1;
+    }
+    return i;
+}
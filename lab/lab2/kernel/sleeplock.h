@@ -6,5 +6,7 @@ struct sleeplock {
   // For debugging:
   char *name;        // Name of lock.
   int pid;           // Process holding lock
+  struct proc *owner; // 持有者，等待者看它是否正在运行来决定自旋还是睡眠
+  struct sleepclass *cls; // 同名的睡眠锁共用的统计
+  uint64 acqtime;    // 获得锁的时间 (r_time())
 };
-
@@ -1,4 +1,13 @@
 // 互斥自旋锁
+//
+// 排号锁：等待的 CPU 按到达的先后获得锁，不会有 CPU 一直抢不到。
+// 等待时只读 owner，前面排的 CPU 越多，两次读之间等得越久，
+// 减少锁释放时对这个缓存行的争抢。
+//
+// 同名的锁(比如所有进程的 p->lock)归为一类，共用一份统计：获取次数、
+// 需要等待的次数、自旋的次数和持有的时间。slab 中的对象的锁随页面
+// 分配释放，按类统计不用跟踪每个锁的生死。每个 CPU 有自己的一行
+// 计数器，只在持有锁或关中断时由本 CPU 更新，不需要原子操作。
 
 #include "types.h"
 #include "param.h"
@@ -7,26 +16,76 @@
 #include "riscv.h"
 #include "proc.h"
 #include "defs.h"
+#include "sysinfo.h"
+
+#define NLOCKCLASS 64
+#define BACKOFF 8 // 前面每排一个 CPU，两次读 owner 之间多等的循环次数
+
+struct lockcount {
+    uint64 nacquire;
+    uint64 ncontend;
+    uint64 nspin;
+    uint64 holdtime;
+} __attribute__((aligned(64))); // 各 CPU 的计数器不共用缓存行
+
+struct lockclass {
+    char* name;
+    struct lockcount cnt[NCPU];
+};
+
+struct {
+    uint busy; // 保护 n 和新加入的类，不能用自旋锁
+    int n;
+    struct lockclass cls[NLOCKCLASS];
+} locktab;
+
+// 名为 name 的锁的类，没有就新建一个。类满了时归入最后一类。
+static struct lockclass* lockclass(char* name) {
+    struct lockclass* c;
+    int i;
+
+    while (__sync_lock_test_and_set(&locktab.busy, 1) != 0)
+        ;
+    for (i = 0; i < locktab.n; i++)
+        if (locktab.cls[i].name == name || strncmp(locktab.cls[i].name, name, 16) == 0)
+            break;
+    if (i == locktab.n) {
+        if (i == NLOCKCLASS)
+            i--;
+        else
+            locktab.cls[locktab.n++].name = i == NLOCKCLASS - 1 ? "other" : name;
+    }
+    c = &locktab.cls[i];
+    __sync_lock_release(&locktab.busy);
+    return c;
+}
 
 void initlock(struct spinlock* lk, char* name) {
     lk->name = name;
-    lk->locked = 0;
+    lk->next = 0;
+    lk->owner = 0;
     lk->cpu = 0;
+    lk->cls = lockclass(name);
 }
 
 // Acquire the lock.
 // Loops (spins) until the lock is acquired.
 void acquire(struct spinlock* lk) {
+    struct lockcount* cnt;
+    uint ticket, owner;
+    uint64 spin = 0;
+
     push_off(); // disable interrupts to avoid deadlock.
     if (holding(lk))
         panic("acquire");
 
-    // On RISC-V, sync_lock_test_and_set turns into an atomic swap:
-    //   a5 = 1
-    //   s1 = &lk->locked
-    //   amoswap.w.aq a5, a5, (s1)
-    while (__sync_lock_test_and_set(&lk->locked, 1) != 0)
-        ;
+    // 取号。On RISC-V this is an amoadd.w.
+    ticket = __atomic_fetch_add(&lk->next, 1, __ATOMIC_RELAXED);
+    while ((owner = __atomic_load_n(&lk->owner, __ATOMIC_RELAXED)) != ticket) {
+        for (uint i = (ticket - owner) * BACKOFF; i > 0; i--)
+            asm volatile("nop");
+        spin++;
+    }
 
     // Tell the C compiler and the processor to not move loads or stores
     // past this point, to ensure that the critical section's memory
@@ -36,6 +95,13 @@ void acquire(struct spinlock* lk) {
 
     // Record info about lock acquisition for holding() and debugging.
     lk->cpu = mycpu();
+    lk->acqtime = r_time();
+    cnt = &lk->cls->cnt[cpuid()];
+    cnt->nacquire++;
+    if (spin > 0) {
+        cnt->ncontend++;
+        cnt->nspin += spin;
+    }
 }
 
 // Release the lock.
@@ -43,6 +109,7 @@ void release(struct spinlock* lk) {
     if (!holding(lk))
         panic("release");
 
+    lk->cls->cnt[cpuid()].holdtime += r_time() - lk->acqtime;
     lk->cpu = 0;
 
     // Tell the C compiler and the CPU to not move loads or stores
@@ -53,14 +120,9 @@ void release(struct spinlock* lk) {
     // On RISC-V, this emits a fence instruction.
     __sync_synchronize();
 
-    // Release the lock, equivalent to lk->locked = 0.
-    // This code doesn't use a C assignment, since the C standard
-    // implies that an assignment might be implemented with
-    // multiple store instructions.
-    // On RISC-V, sync_lock_release turns into an atomic swap:
-    //   s1 = &lk->locked
-    //   amoswap.w zero, zero, (s1)
-    __sync_lock_release(&lk->locked);
+    // Release the lock: 轮到下一个号。只有持有者写 owner，
+    // 用原子的 store 保证它不会被拆成几次写。
+    __atomic_store_n(&lk->owner, lk->owner + 1, __ATOMIC_RELAXED);
 
     pop_off();
 }
@@ -69,7 +131,46 @@ void release(struct spinlock* lk) {
 // Interrupts must be off.
 int holding(struct spinlock* lk) {
     int r;
-    r = (lk->locked && lk->cpu == mycpu());
+    r = (spinlocked(lk) && lk->cpu == mycpu());
+    return r;
+}
+
+// 锁是否被某个 CPU 持有(或有 CPU 在等)，只用于统计和调试
+int spinlocked(struct spinlock* lk) {
+    return __atomic_load_n(&lk->owner, __ATOMIC_RELAXED) !=
+           __atomic_load_n(&lk->next, __ATOMIC_RELAXED);
+}
+
+// 把至多 n 类锁的统计复制到用户地址 addr 处的 struct lockstat 数组，
+// 返回复制的个数，出错时返回 -1。
+int lockstat(uint64 addr, int n) {
+    struct lockstat ls;
+    struct lockclass* c;
+    int i, k, nclass = __atomic_load_n(&locktab.n, __ATOMIC_ACQUIRE);
+
+    for (i = 0; i < nclass && i < n; i++) {
+        c = &locktab.cls[i];
+        memset(&ls, 0, sizeof(ls));
+        safestrcpy(ls.name, c->name, sizeof(ls.name));
+        for (k = 0; k < NCPU; k++) {
+            ls.nacquire += c->cnt[k].nacquire;
+            ls.ncontend += c->cnt[k].ncontend;
+            ls.nspin += c->cnt[k].nspin;
+            ls.holdtime += c->cnt[k].holdtime;
+        }
+        if (copyout(myproc()->pagetable, addr + i * sizeof(ls), (char*)&ls, sizeof(ls)) < 0)
+            return -1;
+    }
+    return i;
+}
+
+// 当前 CPU 是否持有自旋锁(或在 push_off() 之内)。持有时不能睡眠。
+int holdinglocks(void) {
+    int r;
+
+    push_off();
+    r = mycpu()->noff > 1;
+    pop_off();
     return r;
 }
 
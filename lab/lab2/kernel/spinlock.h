@@ -1,9 +1,15 @@
 // Mutual exclusion lock.
+// 排号(ticket)锁：获取时取一个号，等到 owner 轮到这个号，
+// 按到达的先后获得锁。
 struct spinlock {
-  uint locked;       // Is the lock held?
+  uint next;         // 下一个取的号
+  uint owner;        // 持有锁的号，owner == next 时锁空闲
 
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
-};
 
+  // 统计，见 spinlock.c
+  struct lockclass *cls; // 同名的锁共用一份统计
+  uint64 acqtime;        // 获得锁的时间
+};
@@ -8,12 +8,16 @@
 
 int main();
 void timerinit();
+void ipiinit();
 
 // entry.S needs one stack per CPU.
 // __attribute__((aligned(16))) 指定对齐方式为16字节，确保栈的起始地址是16字节对齐的。
 // NCPU 最大 CPU 数量
 __attribute__((aligned(16))) char stack0[4096 * NCPU];
 
+// kernelvec.S 中 machinevec 用的每个 hart 的暂存区
+uint64 ipiscratch[NCPU][2];
+
 // entry.S jumps here in machine mode on stack0.
 // 每个CPU启动时都会调用这个函数。
 void start() {
@@ -47,6 +51,9 @@ void start() {
     // ask for clock interrupts.
     timerinit();
 
+    // 接收其他 hart 的处理器间中断
+    ipiinit();
+
     // keep each CPU's hartid in its tp register, for cpuid().
     int id = r_mhartid();
     w_tp(id);
@@ -63,9 +70,21 @@ void timerinit() {
     // enable the sstc extension (i.e. stimecmp).
     w_menvcfg(r_menvcfg() | (1L << 63));
 
-    // allow supervisor to use stimecmp and time.
-    w_mcounteren(r_mcounteren() | 2);
+    // allow supervisor to use stimecmp and time, and to read cycle.
+    w_mcounteren(r_mcounteren() | 2 | 1);
+
+    // 第一个进程开始运行时才需要时钟中断，见 timer.c
+    w_stimecmp(~0UL);
+}
+
+// 其他 hart 写这个 hart 的 CLINT MSIP 时进入机器模式的 machinevec，
+// 它把机器软件中断转为管理模式的软件中断。
+void ipiinit() {
+    extern void machinevec();
+    int id = r_mhartid();
 
-    // ask for the very first timer interrupt.
-    w_stimecmp(r_time() + 1000000);
+    ipiscratch[id][1] = CLINT_MSIP(id);
+    w_mscratch((uint64)ipiscratch[id]);
+    w_mtvec((uint64)machinevec);
+    w_mie(r_mie() | MIE_MSIE);
 }
@@ -1,8 +1,17 @@
 // C风格字符串和字节数组库
+//
+// memset/memmove/memcmp/strlen 默认按 8 字节的字处理：先逐字节处理到对齐，
+// 主体每次处理 4 个字，剩下的再逐字节处理。两边对 8 的余数不同时没法都对齐，
+// 只能逐字节处理。用 make BYTESTRING=1 编译时全部改用逐字节的版本。
+// 两种版本都以 byte*/word* 为名保留，stringtest.c 比较它们。
 
 #include "types.h"
 
-void* memset(void* dst, int c, uint n) {
+#define ONES 0x0101010101010101UL
+#define HASZERO(w) (((w) - ONES) & ~(w) & (ONES << 7)) // 字中是否有 0 字节
+#define ALIGNED(p) (((uint64)(p) & 7) == 0)
+
+void* bytememset(void* dst, int c, uint n) {
     char* cdst = (char*)dst;
     int i;
     for (i = 0; i < n; i++) {
@@ -11,7 +20,28 @@ void* memset(void* dst, int c, uint n) {
     return dst;
 }
 
-int memcmp(const void* v1, const void* v2, uint n) {
+void* wordmemset(void* dst, int c, uint n) {
+    char* d = dst;
+    uint64 w = (uchar)c * ONES;
+
+    if (n >= 8) {
+        for (; !ALIGNED(d); n--)
+            *d++ = c;
+        for (; n >= 32; n -= 32, d += 32) {
+            ((uint64*)d)[0] = w;
+            ((uint64*)d)[1] = w;
+            ((uint64*)d)[2] = w;
+            ((uint64*)d)[3] = w;
+        }
+        for (; n >= 8; n -= 8, d += 8)
+            *(uint64*)d = w;
+    }
+    while (n-- > 0)
+        *d++ = c;
+    return dst;
+}
+
+int bytememcmp(const void* v1, const void* v2, uint n) {
     const uchar *s1, *s2;
 
     s1 = v1;
@@ -25,7 +55,21 @@ int memcmp(const void* v1, const void* v2, uint n) {
     return 0;
 }
 
-void* memmove(void* dst, const void* src, uint n) {
+int wordmemcmp(const void* v1, const void* v2, uint n) {
+    const uchar *s1 = v1, *s2 = v2;
+
+    if (n >= 8 && ((uint64)s1 & 7) == ((uint64)s2 & 7)) {
+        for (; !ALIGNED(s1); n--, s1++, s2++)
+            if (*s1 != *s2)
+                return *s1 - *s2;
+        // 找到第一个不同的字，再逐字节找出其中不同的字节
+        for (; n >= 8 && *(uint64*)s1 == *(uint64*)s2; n -= 8, s1 += 8, s2 += 8)
+            ;
+    }
+    return bytememcmp(s1, s2, n);
+}
+
+void* bytememmove(void* dst, const void* src, uint n) {
     const char* s;
     char* d;
 
@@ -46,6 +90,104 @@ void* memmove(void* dst, const void* src, uint n) {
     return dst;
 }
 
+// 每次先读出 4 个字再写，源和目标重叠时也正确
+void* wordmemmove(void* dst, const void* src, uint n) {
+    const char* s = src;
+    char* d = dst;
+    uint64 w0, w1, w2, w3;
+    int words = n >= 8 && ((uint64)s & 7) == ((uint64)d & 7);
+
+    if (n == 0 || s == d)
+        return dst;
+    if (s < d && s + n > d) {
+        s += n;
+        d += n;
+        if (words) {
+            for (; !ALIGNED(d); n--)
+                *--d = *--s;
+            for (; n >= 32; n -= 32) {
+                d -= 32;
+                s -= 32;
+                w0 = ((uint64*)s)[0];
+                w1 = ((uint64*)s)[1];
+                w2 = ((uint64*)s)[2];
+                w3 = ((uint64*)s)[3];
+                ((uint64*)d)[3] = w3;
+                ((uint64*)d)[2] = w2;
+                ((uint64*)d)[1] = w1;
+                ((uint64*)d)[0] = w0;
+            }
+            for (; n >= 8; n -= 8) {
+                d -= 8;
+                s -= 8;
+                *(uint64*)d = *(uint64*)s;
+            }
+        }
+        while (n-- > 0)
+            *--d = *--s;
+    } else {
+        if (words) {
+            for (; !ALIGNED(d); n--)
+                *d++ = *s++;
+            for (; n >= 32; n -= 32, d += 32, s += 32) {
+                w0 = ((uint64*)s)[0];
+                w1 = ((uint64*)s)[1];
+                w2 = ((uint64*)s)[2];
+                w3 = ((uint64*)s)[3];
+                ((uint64*)d)[0] = w0;
+                ((uint64*)d)[1] = w1;
+                ((uint64*)d)[2] = w2;
+                ((uint64*)d)[3] = w3;
+            }
+            for (; n >= 8; n -= 8, d += 8, s += 8)
+                *(uint64*)d = *(uint64*)s;
+        }
+        while (n-- > 0)
+            *d++ = *s++;
+    }
+    return dst;
+}
+
+int bytestrlen(const char* s) {
+    int n;
+
+    for (n = 0; s[n]; n++)
+        ;
+    return n;
+}
+
+int wordstrlen(const char* s) {
+    const char* p = s;
+
+    for (; !ALIGNED(p); p++)
+        if (*p == 0)
+            return p - s;
+    // 对齐的字不会跨页，读到字符串末尾之后也不会出错
+    for (; !HASZERO(*(uint64*)p); p += 8)
+        ;
+    for (; *p; p++)
+        ;
+    return p - s;
+}
+
+#ifdef BYTESTRING
+#define STRINGFN(f) byte##f
+#else
+#define STRINGFN(f) word##f
+#endif
+
+void* memset(void* dst, int c, uint n) {
+    return STRINGFN(memset)(dst, c, n);
+}
+
+int memcmp(const void* v1, const void* v2, uint n) {
+    return STRINGFN(memcmp)(v1, v2, n);
+}
+
+void* memmove(void* dst, const void* src, uint n) {
+    return STRINGFN(memmove)(dst, src, n);
+}
+
 // memcpy exists to placate GCC.  Use memmove.
 void* memcpy(void* dst, const void* src, uint n) {
     return memmove(dst, src, n);
@@ -84,9 +226,5 @@ char* safestrcpy(char* s, const char* t, int n) {
 }
 
 int strlen(const char* s) {
-    int n;
-
-    for (n = 0; s[n]; n++)
-        ;
-    return n;
+    return STRINGFN(strlen)(s);
 }
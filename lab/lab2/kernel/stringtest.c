@@ -0,0 +1,127 @@
+// string.c 的自测和性能比较，用 make STRINGTEST=1 编译时在启动时运行：
+// 先在各种对齐和长度下核对按字的版本和逐字节的版本结果一致，
+// 再测量两者每个时钟周期处理的字节数。
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define NREP 64 // 计时时每种大小重复的次数
+
+static char *a, *b; // 两页测试缓冲区
+
+// 用和位置有关的内容填满两个缓冲区
+static void fill(int seed) {
+    for (int i = 0; i < PGSIZE; i++) {
+        a[i] = i * 7 + seed;
+        b[i] = i * 7 + seed;
+    }
+}
+
+static void check(int ok, char* what, int x, int y, int n) {
+    if (!ok) {
+        printf("stringtest: %s wrong (offsets %d %d, %d bytes)\n", what, x, y, n);
+        panic("stringtest");
+    }
+}
+
+static int sign(int x) {
+    return x < 0 ? -1 : x > 0;
+}
+
+static void correctness(void) {
+    static int lens[] = {0, 1, 7, 8, 9, 15, 31, 32, 33, 63, 64, 65, 100, 257, 1000, 2000};
+    int i, x, y, n, r1, r2;
+
+    for (i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+        n = lens[i];
+        for (x = 0; x < 8; x++) {
+            fill(x);
+            wordmemset(a + x, 0x5a + x, n);
+            bytememset(b + x, 0x5a + x, n);
+            check(bytememcmp(a, b, PGSIZE) == 0, "memset", x, 0, n);
+
+            // 同一缓冲区中向前、向后重叠的复制
+            for (y = 0; y < 8; y++) {
+                fill(y);
+                wordmemmove(a + 8 + x, a + 8 + y + 16, n);
+                bytememmove(b + 8 + x, b + 8 + y + 16, n);
+                check(bytememcmp(a, b, PGSIZE) == 0, "memmove", x, y, n);
+                fill(y);
+                wordmemmove(a + 8 + y + 16, a + 8 + x, n);
+                bytememmove(b + 8 + y + 16, b + 8 + x, n);
+                check(bytememcmp(a, b, PGSIZE) == 0, "memmove back", x, y, n);
+
+                // 在不同的位置制造第一个差异
+                fill(0);
+                bytememmove(b + 2048 + y, a + x, n);
+                if (n > 0)
+                    b[2048 + y + (n * 5 + x) % n] ^= 0x80;
+                r1 = wordmemcmp(a + x, b + 2048 + y, n);
+                r2 = bytememcmp(a + x, b + 2048 + y, n);
+                check(sign(r1) == sign(r2), "memcmp", x, y, n);
+            }
+
+            fill(1);
+            a[x + n] = 0;
+            check(wordstrlen(a + x) == bytestrlen(a + x), "strlen", x, 0, n);
+        }
+    }
+}
+
+// 每个时钟周期处理的字节数，保留两位小数
+static void report(char* name, int n, uint64 bytecycles, uint64 wordcycles) {
+    uint64 bytes = (uint64)n * NREP * 100;
+
+    if (bytecycles == 0 || wordcycles == 0)
+        return;
+    printf("%s\t%d\t%d.%d%d\t%d.%d%d\n", name, n,
+           (int)(bytes / bytecycles / 100), (int)(bytes / bytecycles / 10 % 10), (int)(bytes / bytecycles % 10),
+           (int)(bytes / wordcycles / 100), (int)(bytes / wordcycles / 10 % 10), (int)(bytes / wordcycles % 10));
+}
+
+#define TIME(stmt, cycles)                 \
+    do {                                   \
+        uint64 t0 = r_cycle();             \
+        for (int r = 0; r < NREP; r++)     \
+            stmt;                          \
+        cycles = r_cycle() - t0;           \
+    } while (0)
+
+static void benchmark(void) {
+    static int sizes[] = {16, 256, 4000};
+    uint64 bc, wc;
+    int i, n;
+
+    printf("stringtest: bytes per cycle\n");
+    printf("func\tsize\tbyte\tword\n");
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        n = sizes[i];
+        TIME(bytememset(a, r, n), bc);
+        TIME(wordmemset(a, r, n), wc);
+        report("memset", n, bc, wc);
+        TIME(bytememmove(a, b, n), bc);
+        TIME(wordmemmove(a, b, n), wc);
+        report("memmove", n, bc, wc);
+        bytememmove(b, a, n);
+        TIME(bytememcmp(a, b, n), bc);
+        TIME(wordmemcmp(a, b, n), wc);
+        report("memcmp", n, bc, wc);
+        a[n] = 0;
+        TIME(bytestrlen(a), bc);
+        TIME(wordstrlen(a), wc);
+        report("strlen", n, bc, wc);
+    }
+}
+
+void stringtest(void) {
+    if ((a = kalloc()) == 0 || (b = kalloc()) == 0)
+        panic("stringtest: kalloc");
+    correctness();
+    printf("stringtest: OK\n");
+    benchmark();
+    kfree(a);
+    kfree(b);
+}
@@ -0,0 +1,249 @@
+// 交换区
+//
+// 空闲内存少于 SWAPLOW 页时 swapreclaim() 调用 swapout()，把进程私有的页
+// 写到磁盘上紧跟日志的交换区，PTE 改为记录槽位号的无效项(PTE_SWAP)；
+// 进程再访问时 swapfault() 把页读回来。kalloc() 自己不换出：它的调用者
+// 可能持有睡眠锁或在文件系统操作中，不能等待写盘。换出的页用时钟(second chance)算法挑选：指针扫过进程的页，
+// PTE_A 置位的页清掉 PTE_A、留到下一圈，未置位的页换出。
+//
+// 只换出两种进程的页：当前进程自己(调用者没有持有自旋锁、可以睡眠)，和在
+// 用户态边界被抢占、正在等待调度的进程。后者在写盘期间不会被调度。
+// 有多个线程的进程不换出：其他线程可能正在别的 CPU 上使用这些页。
+// 只换出引用计数为 1 的 4KB 页，共享页、文件缓存页和大页都留在内存里。
+// fork 时交换区中的页由父子进程的 PTE 共同引用同一个槽位，各自换入各自的一份。
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "fs.h"
+#include "defs.h"
+#include "sysinfo.h"
+
+#define SWAPBATCH 4           // 一次读写盘的最多页数，不超过 virtio 一个请求的数据段数
+#define SWAPLOW 64            // 空闲页少于它时在安全点换出
+#define BPP (PGSIZE / BSIZE) // 每页的块数
+
+// 交换区中的页的 PTE：槽位号放在 PPN 字段，保留 R/W/X/U/COW 权限位
+#define SWAPPTE(slot, pte) (((uint64)(slot) << 10) | (PTE_FLAGS(pte) & ~(PTE_V | PTE_A | PTE_D)) | PTE_SWAP)
+#define PTE2SLOT(pte) ((uint)((pte) >> 10))
+
+struct {
+    struct spinlock lock;
+    uint start;        // 交换区的第一个块
+    uint n;            // 槽位数，0 表示没有交换区
+    uint used;         // 已使用的槽位数
+    ushort ref[NSWAP]; // 每个槽位被几个 PTE 引用，0 为空闲
+    int hand;          // 时钟指针：进程表下标
+    uint64 handva;     // 和其中下一个检查的虚拟地址
+    uint64 pageout;
+    uint64 pagein;
+    uint64 majfault;
+} swap;
+
+void swapinit(struct superblock* sb) {
+    initlock(&swap.lock, "swap");
+    swap.start = sb->swapstart;
+    swap.n = sb->nswap < NSWAP ? sb->nswap : NSWAP;
+}
+
+// 分配至多 *n 个连续的空闲槽位，*n 返回实际分配的个数。
+// 返回第一个槽位，交换区满时返回 -1。
+static int slotalloc(int* n) {
+    uint s, e, best = 0, bestlen = 0;
+
+    acquire(&swap.lock);
+    for (s = 0; s < swap.n && bestlen < *n; s = e + 1) {
+        for (; s < swap.n && swap.ref[s] != 0; s++)
+            ;
+        for (e = s; e < swap.n && e - s < *n && swap.ref[e] == 0; e++)
+            ;
+        if (e - s > bestlen) {
+            best = s;
+            bestlen = e - s;
+        }
+    }
+    for (s = best; s < best + bestlen; s++)
+        swap.ref[s] = 1;
+    swap.used += bestlen;
+    release(&swap.lock);
+    if (bestlen == 0)
+        return -1;
+    *n = bestlen;
+    return best;
+}
+
+static void slotfree(uint slot) {
+    acquire(&swap.lock);
+    if (slot >= swap.n || swap.ref[slot] == 0)
+        panic("slotfree");
+    if (--swap.ref[slot] == 0)
+        swap.used--;
+    release(&swap.lock);
+}
+
+// fork 复制了一个交换区中的页的 PTE
+void swapdup(pte_t pte) {
+    acquire(&swap.lock);
+    swap.ref[PTE2SLOT(pte)]++;
+    release(&swap.lock);
+}
+
+// 去掉了一个交换区中的页的 PTE
+void swapfree(pte_t pte) {
+    slotfree(PTE2SLOT(pte));
+}
+
+// 时钟指针在进程 p 中从 *va 开始挑选至多 max 个可以换出的页，
+// 它们的 PTE 存入 ptes[]。*va 前进到最后检查的页之后。
+static int swapscan(struct proc* p, uint64* va, pte_t** ptes, int max) {
+    uint64 sz;
+    pte_t* pte;
+    int n = 0;
+
+    for (; *va < p->mm->sz && n < max; *va += sz) {
+        sz = PGSIZE;
+        if ((pte = walkleaf(p->pagetable, *va, &sz)) == 0) {
+            sz = PGSIZE;
+            continue;
+        }
+        if (sz != PGSIZE || (*pte & PTE_U) == 0 || krefcnt((void*)PTE2PA(*pte)) != 1)
+            continue;
+        if (*pte & PTE_A) {
+            *pte &= ~PTE_A; // 最近访问过，再给一次机会
+            continue;
+        }
+        ptes[n++] = pte;
+    }
+    tlbstale(p); // 让清掉的 PTE_A 重新生效
+    return n;
+}
+
+// 把 ptes[] 映射的 n 页写到交换区连续的槽位上，改写 PTE 并释放这些页。
+// 返回换出的页数。
+static int swapwrite(struct proc* p, pte_t** ptes, int n) {
+    char* pages[SWAPBATCH];
+    int i, slot;
+
+    if ((slot = slotalloc(&n)) < 0)
+        return 0;
+    for (i = 0; i < n; i++)
+        pages[i] = (char*)PTE2PA(*ptes[i]);
+    virtio_disk_rwpages(swap.start + slot * BPP, pages, n, 1);
+    for (i = 0; i < n; i++) {
+        *ptes[i] = SWAPPTE(slot + i, *ptes[i]);
+        kfree(pages[i]);
+    }
+    uvmresident(p->mm, -n);
+    tlbstale(p);
+    __atomic_add_fetch(&swap.pageout, n, __ATOMIC_RELAXED);
+    return n;
+}
+
+// 换出至少 want 页。调用者持有自旋锁时不能等待磁盘，什么也不做。
+// 返回换出的页数。
+static int swapout(int want) {
+    pte_t* ptes[SWAPBATCH];
+    struct proc* p;
+    uint64 va;
+    int i, n, done, freed = 0, passed = 0;
+
+    if (swap.n == 0 || myproc() == 0 || holdinglocks())
+        return 0;
+    // 时钟指针转两圈：第一圈清掉 PTE_A，第二圈一定能换出没有再被访问的页
+    while (freed < want && passed < 2 * NPROC) {
+        acquire(&swap.lock);
+        i = swap.hand;
+        va = swap.handva;
+        release(&swap.lock);
+
+        done = 1;
+        if ((p = procswapbegin(i)) != 0) {
+            if ((n = swapscan(p, &va, ptes, SWAPBATCH)) > 0 && (n = swapwrite(p, ptes, n)) == 0) {
+                procswapend(p);
+                break; // 交换区满了
+            }
+            freed += n;
+            done = va >= p->mm->sz;
+            procswapend(p);
+        }
+
+        acquire(&swap.lock);
+        if (done) {
+            swap.hand = (i + 1) % NPROC;
+            swap.handva = 0;
+            passed++;
+        } else {
+            swap.handva = va;
+        }
+        release(&swap.lock);
+    }
+    return freed;
+}
+
+// va 处的页在交换区时把它读回来。顺带预读虚拟地址和槽位都连续的后几页，
+// 它们多半是一起换出的。va 处不是交换区中的页时返回 1，成功返回 0，
+// 内存不足时返回 -1。
+int swapfault(struct proc* p, uint64 va) {
+    pte_t* ptes[SWAPBATCH];
+    char* pages[SWAPBATCH];
+    pte_t* pte;
+    uint slot;
+    int i, n;
+
+    va = PGROUNDDOWN(va);
+    if (va >= MAXVA || (pte = walk(p->pagetable, va, 0)) == 0 || (*pte & PTE_SWAP) == 0)
+        return 1;
+    slot = PTE2SLOT(*pte);
+    ptes[0] = pte;
+    for (n = 1; n < SWAPBATCH && va + n * PGSIZE < p->mm->sz; n++) {
+        pte = walk(p->pagetable, va + n * PGSIZE, 0);
+        if (pte == 0 || (*pte & PTE_SWAP) == 0 || PTE2SLOT(*pte) != slot + n)
+            break;
+        ptes[n] = pte;
+    }
+    // kalloc() 不会换出页，分配期间这些 PTE 不变
+    for (i = 0; i < n; i++)
+        if ((pages[i] = kalloc()) == 0)
+            break;
+    if ((n = i) == 0)
+        return -1;
+
+    virtio_disk_rwpages(swap.start + slot * BPP, pages, n, 0);
+    for (i = 0; i < n; i++) {
+        *ptes[i] = PA2PTE(pages[i]) | (PTE_FLAGS(*ptes[i]) & ~PTE_SWAP) | PTE_V;
+        slotfree(slot + i);
+    }
+    uvmresident(p->mm, n);
+    tlbstale(p);
+    __atomic_add_fetch(&swap.majfault, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&swap.pagein, n, __ATOMIC_RELAXED);
+    return 0;
+}
+
+// 空闲内存不足 SWAPLOW 页时先回收文件缓存页和没有引用的 inode，还不够
+// 再换出进程的页。返回回收或换出的页、inode 的个数，为 0 表示没能腾出
+// 内存。只在安全点调用：从用户态进入系统调用时，和用户态缺页因内存不足
+// 失败之后，这时没有持有任何锁，也不在文件系统操作中。
+int swapreclaim(void) {
+    long want = SWAPLOW - (long)(freemem() / PGSIZE);
+    int n;
+
+    if (want <= 0)
+        return 0;
+    n = pcreclaim() + ireclaim();
+    want = SWAPLOW - (long)(freemem() / PGSIZE);
+    if (want <= 0)
+        return n;
+    return n + swapout(want < SWAPBATCH ? SWAPBATCH : want);
+}
+
+void swapstat(struct sysinfo* info) {
+    info->swapsize = swap.n;
+    info->swapused = swap.used;
+    info->pageout = swap.pageout;
+    info->swappagein = swap.pagein;
+    info->majfault = swap.majfault;
+}
@@ -12,7 +12,7 @@
 // Fetch the uint64 at addr from the current process.
 int fetchaddr(uint64 addr, uint64* ip) {
     struct proc* p = myproc();
-    if (addr >= p->sz || addr + sizeof(uint64) > p->sz) // both tests needed, in case of overflow
+    if (addr >= p->mm->sz || addr + sizeof(uint64) > p->mm->sz) // both tests needed, in case of overflow
         return -1;
     if (copyin(p->pagetable, (char*)ip, addr, sizeof(*ip)) != 0)
         return -1;
@@ -93,6 +93,17 @@ extern uint64 sys_mkdir(void);
 extern uint64 sys_close(void);
 extern uint64 sys_freemem(void);
 extern uint64 sys_trace(void);
+extern uint64 sys_sysinfo(void);
+extern uint64 sys_mmap(void);
+extern uint64 sys_munmap(void);
+extern uint64 sys_procinfo(void);
+extern uint64 sys_nanosleep(void);
+extern uint64 sys_nanouptime(void);
+extern uint64 sys_lockstat(void);
+extern uint64 sys_clone(void);
+extern uint64 sys_join(void);
+extern uint64 sys_futex_wait(void);
+extern uint64 sys_futex_wake(void);
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -120,6 +131,17 @@ static uint64 (*syscalls[])(void) = {
     [SYS_close] = sys_close,
     [SYS_freemem] = sys_freemem,
     [SYS_trace] = sys_trace,
+    [SYS_sysinfo] = sys_sysinfo,
+    [SYS_mmap] = sys_mmap,
+    [SYS_munmap] = sys_munmap,
+    [SYS_procinfo] = sys_procinfo,
+    [SYS_nanosleep] = sys_nanosleep,
+    [SYS_nanouptime] = sys_nanouptime,
+    [SYS_lockstat] = sys_lockstat,
+    [SYS_clone] = sys_clone,
+    [SYS_join] = sys_join,
+    [SYS_futex_wait] = sys_futex_wait,
+    [SYS_futex_wake] = sys_futex_wake,
 };
 
 static char* syscallnames[] = {
@@ -145,7 +167,18 @@ static char* syscallnames[] = {
     [SYS_mkdir] = "mkdir",
     [SYS_close] = "close",
     [SYS_freemem] = "freemem",
-    [SYS_trace] = "trace"};
+    [SYS_trace] = "trace",
+    [SYS_sysinfo] = "sysinfo",
+    [SYS_mmap] = "mmap",
+    [SYS_munmap] = "munmap",
+    [SYS_procinfo] = "procinfo",
+    [SYS_nanosleep] = "nanosleep",
+    [SYS_nanouptime] = "nanouptime",
+    [SYS_lockstat] = "lockstat",
+    [SYS_clone] = "clone",
+    [SYS_join] = "join",
+    [SYS_futex_wait] = "futex_wait",
+    [SYS_futex_wake] = "futex_wake"};
 
 void syscall(void) {
     int num;
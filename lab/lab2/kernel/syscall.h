@@ -22,3 +22,19 @@
 #define SYS_close 21
 #define SYS_freemem 22
 #define SYS_trace 23
+#define SYS_sysinfo 24
+#define SYS_mmap 25
+#define SYS_munmap 26
+#define SYS_procinfo 27
+#define SYS_nanosleep 28
+#define SYS_nanouptime 29
+#define SYS_lockstat 30
+#define SYS_clone 31
+#define SYS_join 32
+#define SYS_futex_wait 33
+#define SYS_futex_wake 34
+
+// sys_sbrk() 的第二个参数：立即分配，或者只增大进程大小、访问时再分配
+#define SBRK_EAGER 1
+#define SBRK_LAZY 2
+#define SBRK_SUPER 3 // 立即分配，按 2MB 对齐的部分用大页
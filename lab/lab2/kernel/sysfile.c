@@ -19,19 +19,25 @@
 #include "fcntl.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
-// and return both the descriptor and the corresponding struct file.
+// and return the corresponding struct file.
+// 文件描述符表由线程共用，另一个线程可能同时 close 它：返回的 file
+// 带一个引用，调用者用完后 fileclose()。
 static int
-argfd(int n, int* pfd, struct file** pf) {
+argfd(int n, struct file** pf) {
     int fd;
     struct file* f;
+    struct mm* mm = myproc()->mm;
 
     argint(n, &fd);
-    if (fd < 0 || fd >= NOFILE || (f = myproc()->ofile[fd]) == 0)
+    if (fd < 0 || fd >= NOFILE)
         return -1;
-    if (pfd)
-        *pfd = fd;
-    if (pf)
-        *pf = f;
+    acquire(&mm->lock);
+    if ((f = mm->ofile[fd]) != 0)
+        filedup(f);
+    release(&mm->lock);
+    if (f == 0)
+        return -1;
+    *pf = f;
     return 0;
 }
 
@@ -40,55 +46,82 @@ argfd(int n, int* pfd, struct file** pf) {
 static int
 fdalloc(struct file* f) {
     int fd;
-    struct proc* p = myproc();
+    struct mm* mm = myproc()->mm;
 
+    acquire(&mm->lock);
     for (fd = 0; fd < NOFILE; fd++) {
-        if (p->ofile[fd] == 0) {
-            p->ofile[fd] = f;
+        if (mm->ofile[fd] == 0) {
+            mm->ofile[fd] = f;
+            release(&mm->lock);
             return fd;
         }
     }
+    release(&mm->lock);
     return -1;
 }
 
+// 去掉文件描述符 fd，返回它引用的 file，由调用者 fileclose()。
+// f 不为 0 时只在 fd 仍然引用 f 时去掉(另一个线程可能已经关掉了它)。
+static struct file*
+fdfree(int fd, struct file* f) {
+    struct mm* mm = myproc()->mm;
+
+    if (fd < 0 || fd >= NOFILE)
+        return 0;
+    acquire(&mm->lock);
+    if (f == 0 || mm->ofile[fd] == f) {
+        f = mm->ofile[fd];
+        mm->ofile[fd] = 0;
+    } else {
+        f = 0;
+    }
+    release(&mm->lock);
+    return f;
+}
+
 uint64
 sys_dup(void) {
     struct file* f;
     int fd;
 
-    if (argfd(0, 0, &f) < 0)
+    if (argfd(0, &f) < 0)
         return -1;
-    if ((fd = fdalloc(f)) < 0)
+    if ((fd = fdalloc(f)) < 0) {
+        fileclose(f);
         return -1;
-    filedup(f);
+    }
     return fd;
 }
 
 uint64
 sys_read(void) {
     struct file* f;
-    int n;
+    int n, r;
     uint64 p;
 
     argaddr(1, &p);
     argint(2, &n);
-    if (argfd(0, 0, &f) < 0)
+    if (argfd(0, &f) < 0)
         return -1;
-    return fileread(f, p, n);
+    r = fileread(f, p, n);
+    fileclose(f);
+    return r;
 }
 
 uint64
 sys_write(void) {
     struct file* f;
-    int n;
+    int n, r;
     uint64 p;
 
     argaddr(1, &p);
     argint(2, &n);
-    if (argfd(0, 0, &f) < 0)
+    if (argfd(0, &f) < 0)
         return -1;
 
-    return filewrite(f, p, n);
+    r = filewrite(f, p, n);
+    fileclose(f);
+    return r;
 }
 
 uint64
@@ -96,9 +129,9 @@ sys_close(void) {
     int fd;
     struct file* f;
 
-    if (argfd(0, &fd, &f) < 0)
+    argint(0, &fd);
+    if ((f = fdfree(fd, 0)) == 0)
         return -1;
-    myproc()->ofile[fd] = 0;
     fileclose(f);
     return 0;
 }
@@ -107,11 +140,14 @@ uint64
 sys_fstat(void) {
     struct file* f;
     uint64 st; // user pointer to struct stat
+    int r;
 
     argaddr(1, &st);
-    if (argfd(0, 0, &f) < 0)
+    if (argfd(0, &f) < 0)
         return -1;
-    return filestat(f, st);
+    r = filestat(f, st);
+    fileclose(f);
+    return r;
 }
 
 // Create the path new as a link to the same inode as old.
@@ -298,7 +334,7 @@ sys_open(void) {
     int fd, omode;
     struct file* f;
     struct inode* ip;
-    int n;
+    int n, writer;
 
     argint(1, &omode);
     if ((n = argstr(0, path, MAXPATH)) < 0)
@@ -331,9 +367,19 @@ sys_open(void) {
         return -1;
     }
 
+    // 正在运行的可执行文件不能打开来写或截断
+    writer = ip->type == T_FILE && (omode & (O_WRONLY | O_RDWR | O_TRUNC));
+    if (writer && igetwrite(ip) < 0) {
+        iunlockput(ip);
+        end_op();
+        return -1;
+    }
+
     if ((f = filealloc()) == 0 || (fd = fdalloc(f)) < 0) {
         if (f)
             fileclose(f);
+        if (writer)
+            iputwrite(ip);
         iunlockput(ip);
         end_op();
         return -1;
@@ -353,6 +399,8 @@ sys_open(void) {
     if ((omode & O_TRUNC) && ip->type == T_FILE) {
         itrunc(ip);
     }
+    if (writer && !f->writable)
+        iputwrite(ip); // 只读打开的截断已经完成
 
     iunlock(ip);
     end_op();
@@ -472,19 +520,47 @@ sys_pipe(void) {
         return -1;
     fd0 = -1;
     if ((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0) {
-        if (fd0 >= 0)
-            p->ofile[fd0] = 0;
-        fileclose(rf);
+        if (fd0 < 0 || fdfree(fd0, rf) != 0)
+            fileclose(rf);
         fileclose(wf);
         return -1;
     }
     if (copyout(p->pagetable, fdarray, (char*)&fd0, sizeof(fd0)) < 0 ||
         copyout(p->pagetable, fdarray + sizeof(fd0), (char*)&fd1, sizeof(fd1)) < 0) {
-        p->ofile[fd0] = 0;
-        p->ofile[fd1] = 0;
-        fileclose(rf);
-        fileclose(wf);
+        // 另一个线程可能已经关掉了它们，只关掉仍在表中的
+        if (fdfree(fd0, rf) != 0)
+            fileclose(rf);
+        if (fdfree(fd1, wf) != 0)
+            fileclose(wf);
         return -1;
     }
     return 0;
 }
+
+// void* mmap(void* addr, uint64 len, int prot, int flags, int fd, uint64 off)
+// addr 只是提示，总是由内核选择映射的地址
+uint64
+sys_mmap(void) {
+    uint64 addr, len, off;
+    int prot, flags;
+    struct file* f;
+
+    argaddr(1, &len);
+    argint(2, &prot);
+    argint(3, &flags);
+    argaddr(5, &off);
+    if (argfd(4, &f) < 0)
+        return -1;
+    addr = mmap(f, len, prot, flags, off);
+    fileclose(f);
+    return addr;
+}
+
+uint64
+sys_munmap(void) {
+    uint64 addr, len;
+
+    argaddr(0, &addr);
+    argaddr(1, &len);
+    return munmap(addr, len);
+}
@@ -1,4 +1,68 @@
+#include "kernel/param.h"
+
 struct sysinfo {
   uint64 freemem;   // amount of free memory (bytes)
   uint64 nproc;     // number of process
+  uint64 usedmem;   // 已分配出去的内存 (bytes)
+  uint64 peakmem;   // usedmem 的最高水位 (bytes)
+  uint64 freeblk[MAXORDER + 1]; // 伙伴分配器中各阶的空闲块数
+  uint64 zeropool;  // 预先清零的空闲页数
+  uint64 zerohit;   // kalloc_zeroed() 直接拿到清零页的次数
+  uint64 zeromiss;  // kalloc_zeroed() 同步清零的次数
+  uint64 cowfault;  // 写时复制缺页次数
+  uint64 cowcopy;   // 其中复制了页面的次数
+  uint64 lazyfault; // 懒分配缺页次数
+  uint64 execs;      // 回到用户态的 exec 次数
+  uint64 execcycles; // exec 到第一条用户指令的总时间 (r_time() 周期)
+  uint64 pagein;     // 按需从可执行文件读入的页数
+  uint64 pcpages;    // 页缓存中的文件页数
+  uint64 pcmaps;     // 这些页被进程映射的次数
+  uint64 pchit;      // 缺页时直接映射缓存页的次数
+  uint64 pcmiss;     // 缺页时读文件的次数
+  uint64 swapsize;   // 交换区的页数
+  uint64 swapused;   // 其中已使用的页数
+  uint64 pageout;    // 换出到交换区的页数
+  uint64 swappagein; // 从交换区换入的页数(含预读)
+  uint64 majfault;   // 需要从交换区读盘的缺页次数
+  uint64 nasid;      // 硬件支持的 ASID 个数
+  uint64 uret;       // 回到用户态的次数
+  uint64 tlbflush;   // 其中清除了 TLB 表项的次数
+  uint64 copyhit;    // copyin/copyout 命中翻译缓存的页数
+  uint64 copymiss;   // 查页表翻译的页数
+  uint64 nsched;     // 调度进程运行的次数
+  uint64 schedwait;  // 进程在运行队列中等待的总时间 (r_time() 周期)
+  uint64 steal;      // 空闲 CPU 从其他 CPU 的运行队列偷取进程的次数
+  uint64 schedpolicy; // 调度策略：0 轮转，1 MLFQ
+  uint64 nclock;     // 时钟中断次数
+  uint64 nipi;       // 处理器间中断次数
+  uint64 kmem_lock;    // kalloc/kfree 获取分配器锁的次数
+  uint64 kmem_contend; // 其中锁已被其他 CPU 持有的次数
+  uint64 kmem_steal;   // 从其他 CPU 缓存偷取空闲页的次数
+};
+
+// lockstat() 为每类自旋锁(同名的锁)返回的统计，之后是每类睡眠锁的
+struct lockstat {
+  char name[16];
+  int sleeplock;   // 1 表示睡眠锁
+  uint64 nacquire; // 获取次数
+  uint64 ncontend; // 其中需要等待的次数
+  uint64 nspin;    // 等待时读锁的总次数
+  uint64 holdtime; // 持有的总时间 (r_time() 周期)
+  uint64 nsleep;   // 睡眠锁：等待时睡眠的次数，其余的等待只自旋
+  uint64 waittime; // 睡眠锁：等待的总时间 (r_time() 周期)
+};
+
+// procinfo() 为每个进程返回的信息
+struct procinfo {
+  int pid;
+  int state;       // kernel/proc.h 中的 enum procstate
+  char name[16];
+  uint64 sz;       // 堆和栈等用户内存的大小 (bytes)
+  uint64 rss;      // 驻留内存的用户页数，大页按 4KB 计，共享的页各自计入
+  uint64 ptpages;  // 页表占用的页数
+  uint64 minflt;   // 次缺页：写时复制、懒分配
+  uint64 majflt;   // 主缺页：从交换区或文件取页
+  int level;       // MLFQ 优先级，0 最高
+  uint64 runtime;  // 累计运行时间 (r_time() 周期)
+  uint64 waittime; // 累计在运行队列中等待的时间
 };
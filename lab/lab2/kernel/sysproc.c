@@ -7,6 +7,8 @@
 #include "memlayout.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "syscall.h"
+#include "sysinfo.h"
 
 uint64 sys_exit(void) {
     int n;
@@ -30,34 +32,45 @@ uint64 sys_wait(void) {
 }
 
 uint64 sys_sbrk(void) {
+    struct proc* p = myproc();
     uint64 addr;
-    int n;
+    int n, t;
 
     argint(0, &n);
-    addr = myproc()->sz;
-    if (growproc(n) < 0)
-        return -1;
+    argint(1, &t);
+    mmlock(p); // 同一进程的线程可能同时 sbrk
+    addr = p->mm->sz;
+    if (n > 0 && addr + n > mmaplimit(p)) {
+        // 堆不能长进 mmap 的映射区
+        addr = -1;
+    } else if (t == SBRK_EAGER || t == SBRK_SUPER || n < 0) {
+        if (growproc(n, t == SBRK_SUPER) < 0)
+            addr = -1;
+    } else {
+        // 懒分配：只增大进程大小，页面在第一次访问时由 usertrap() 分配
+        p->mm->sz += n;
+    }
+    mmunlock(p);
     return addr;
 }
 
+#define NSPERCYCLE (1000000000L / TIMEFREQ) // r_time() 一个周期的纳秒数
+
 uint64 sys_sleep(void) {
     int n;
-    uint ticks0;
 
     argint(0, &n);
     if (n < 0)
         n = 0;
-    acquire(&tickslock);
-    ticks0 = ticks;
-    while (ticks - ticks0 < n) {
-        if (killed(myproc())) {
-            release(&tickslock);
-            return -1;
-        }
-        sleep(&ticks, &tickslock);
-    }
-    release(&tickslock);
-    return 0;
+    return timersleep(r_time() + (uint64)n * TICKCYCLES);
+}
+
+// 睡眠 ns 纳秒，精度为 r_time() 的一个周期，不足一个周期的部分向上取整
+uint64 sys_nanosleep(void) {
+    uint64 ns;
+
+    argaddr(0, &ns);
+    return timersleep(r_time() + (ns + NSPERCYCLE - 1) / NSPERCYCLE);
 }
 
 uint64 sys_kill(void) {
@@ -67,15 +80,55 @@ uint64 sys_kill(void) {
     return kill(pid);
 }
 
-// return how many clock tick interrupts have occurred
-// since start.
+// clone(fn, arg, stack)：创建共用地址空间的线程，返回线程号
+uint64 sys_clone(void) {
+    uint64 fn, arg, stack;
+
+    argaddr(0, &fn);
+    argaddr(1, &arg);
+    argaddr(2, &stack);
+    return clone(fn, arg, stack);
+}
+
+// join(tid, status)：等待同一进程的线程退出
+uint64 sys_join(void) {
+    int tid;
+    uint64 addr;
+
+    argint(0, &tid);
+    argaddr(1, &addr);
+    return join(tid, addr);
+}
+
+// futex_wait(addr, val)：*addr 等于 val 时睡眠
+uint64 sys_futex_wait(void) {
+    uint64 addr;
+    int val;
+
+    argaddr(0, &addr);
+    argint(1, &val);
+    return futexwait(addr, val);
+}
+
+// futex_wake(addr, n)：唤醒至多 n 个在 addr 上等待的线程
+uint64 sys_futex_wake(void) {
+    uint64 addr;
+    int n;
+
+    argaddr(0, &addr);
+    argint(1, &n);
+    return futexwake(addr, n);
+}
+
+// return how many clock ticks have passed since start.
+// tick 由 r_time() 算出，没有周期性的时钟中断。
 uint64 sys_uptime(void) {
-    uint xticks;
+    return r_time() / TICKCYCLES;
+}
 
-    acquire(&tickslock);
-    xticks = ticks;
-    release(&tickslock);
-    return xticks;
+// 开机以来的纳秒数
+uint64 sys_nanouptime(void) {
+    return r_time() * NSPERCYCLE;
 }
 
 uint64 sys_freemem(void) {
@@ -89,3 +142,47 @@ uint64 sys_trace(void) {
     myproc()->sys_trace_mask = n;
     return 0;
 }
+
+// lockstat(buf, n)：至多 n 类锁的竞争统计，返回填入的个数
+uint64 sys_lockstat(void) {
+    uint64 addr;
+    int n, i, k;
+
+    argaddr(0, &addr);
+    argint(1, &n);
+    // 自旋锁在前，睡眠锁在后
+    if ((i = lockstat(addr, n)) < 0)
+        return -1;
+    if ((k = sleeplockstat(addr + i * sizeof(struct lockstat), n - i)) < 0)
+        return -1;
+    return i + k;
+}
+
+// procinfo(buf, n)：至多 n 个进程的内存统计，返回填入的个数
+uint64 sys_procinfo(void) {
+    uint64 addr;
+    int n;
+
+    argaddr(0, &addr);
+    argint(1, &n);
+    return procinfo(addr, n);
+}
+
+// 收集系统信息并复制到用户空间的 struct sysinfo
+uint64 sys_sysinfo(void) {
+    struct sysinfo info;
+    uint64 addr;
+
+    argaddr(0, &addr);
+    kallocstat(&info);
+    vmstat(&info);
+    execstat(&info);
+    pcstat(&info);
+    swapstat(&info);
+    trapstat(&info);
+    schedstat(&info);
+    info.nproc = nproc();
+    if (copyout(myproc()->pagetable, addr, (char*)&info, sizeof(info)) < 0)
+        return -1;
+    return 0;
+}
@@ -0,0 +1,144 @@
+// 定时器
+//
+// 每个 CPU 有一个按到期时间排列的最小堆。睡眠到某个时间的进程把自己的
+// p->timer 放进当前 CPU 的堆，时钟中断唤醒到期的进程。stimecmp 只设为
+// 真正需要的下一个时间：堆中最早的到期时间，以及正在运行的进程的时间片
+// 结束的时间。CPU 空闲且堆为空时没有时钟中断(tickless)。
+//
+// r_time() 从开机时的 0 开始，频率为 TIMEFREQ，uptime() 的 tick 也由它
+// 算出，不再由时钟中断计数。
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+struct timerq {
+    struct spinlock lock;
+    struct timer* heap[NPROC];
+    int n;
+    uint64 slice; // 正在运行的进程的时间片结束的时间，0 表示没有
+} timerq[NCPU];
+
+void timerqinit(void) {
+    for (int i = 0; i < NCPU; i++)
+        initlock(&timerq[i].lock, "timerq");
+}
+
+static void heapset(struct timerq* q, int i, struct timer* t) {
+    q->heap[i] = t;
+    t->idx = i;
+}
+
+// 下标 i 处的定时器向上或向下移到合适的位置
+static void heapfix(struct timerq* q, int i) {
+    struct timer* t = q->heap[i];
+    int c;
+
+    for (; i > 0 && q->heap[(i - 1) / 2]->when > t->when; i = (i - 1) / 2)
+        heapset(q, i, q->heap[(i - 1) / 2]);
+    for (; (c = 2 * i + 1) < q->n; i = c) {
+        if (c + 1 < q->n && q->heap[c + 1]->when < q->heap[c]->when)
+            c++;
+        if (q->heap[c]->when >= t->when)
+            break;
+        heapset(q, i, q->heap[c]);
+    }
+    heapset(q, i, t);
+}
+
+static void heapadd(struct timerq* q, struct timer* t) {
+    t->cpu = q - timerq;
+    heapset(q, q->n++, t);
+    heapfix(q, t->idx);
+}
+
+static void heapdel(struct timerq* q, struct timer* t) {
+    int i = t->idx;
+
+    t->cpu = -1;
+    if (--q->n > i) {
+        heapset(q, i, q->heap[q->n]);
+        heapfix(q, i);
+    }
+}
+
+// 把 stimecmp 设为这个 CPU 下一个需要的时间。调用者持有 q->lock，q 是本 CPU 的。
+static void timerarm(struct timerq* q) {
+    uint64 next = ~0UL;
+
+    if (q->n > 0)
+        next = q->heap[0]->when;
+    if (q->slice && q->slice < next)
+        next = q->slice;
+    w_stimecmp(next);
+}
+
+// 调度器在开始运行一个进程时调用，len 个周期后产生时钟中断让它让出 CPU。
+// len 为 0 表示 CPU 将空闲，只需要为定时器产生时钟中断。
+void timerslice(uint64 len) {
+    struct timerq* q;
+
+    push_off();
+    q = &timerq[cpuid()];
+    acquire(&q->lock);
+    q->slice = len ? r_time() + len : 0;
+    timerarm(q);
+    release(&q->lock);
+    pop_off();
+}
+
+// 时钟中断：唤醒到期的进程，设置下一次中断。
+// 当前进程的时间片用完时返回 1。
+int timerintr(void) {
+    struct timerq* q = &timerq[cpuid()];
+    uint64 now = r_time();
+    struct timer* t;
+    int expired = 0;
+
+    acquire(&q->lock);
+    while (q->n > 0 && (t = q->heap[0])->when <= now) {
+        heapdel(q, t);
+        wakeup(t);
+    }
+    if (q->slice && q->slice <= now) {
+        expired = 1;
+        q->slice = now + (schedpolicy == SCHED_MLFQ ? SLICECYCLES : TICKCYCLES);
+    }
+    timerarm(q);
+    release(&q->lock);
+    return expired;
+}
+
+// 睡眠到 r_time() 达到 when。被 kill 时提前返回 -1，否则返回 0。
+int timersleep(uint64 when) {
+    struct proc* p = myproc();
+    struct timer* t = &p->timer;
+    struct timerq* q;
+    int r = 0;
+
+    // 持有 q->lock 期间中断关闭，不会换到别的 CPU 上，可以设置本 CPU 的 stimecmp
+    push_off();
+    q = &timerq[cpuid()];
+    acquire(&q->lock);
+    pop_off();
+
+    t->when = when;
+    heapadd(q, t);
+    if (q->heap[0] == t)
+        timerarm(q);
+    while (r_time() < when) {
+        if (killed(p)) {
+            r = -1;
+            break;
+        }
+        sleep(t, &q->lock);
+    }
+    if (t->cpu >= 0)
+        heapdel(q, t); // 被 kill 唤醒，还在堆中
+    release(&q->lock);
+    return r;
+}
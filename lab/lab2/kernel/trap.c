@@ -7,9 +7,7 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
-
-struct spinlock tickslock;
-uint ticks;
+#include "sysinfo.h"
 
 extern char trampoline[], uservec[], userret[];
 
@@ -19,7 +17,7 @@ void kernelvec();
 extern int devintr();
 
 void trapinit(void) {
-    initlock(&tickslock, "time");
+    timerqinit();
 }
 
 // set up to take exceptions and traps while in the kernel.
@@ -41,6 +39,11 @@ void usertrap(void) {
     // since we're now in the kernel.
     w_stvec((uint64)kernelvec);
 
+    // 已经离开用户态，threadstale() 不用再等这个 CPU
+    struct cpu* c = mycpu();
+    c->user = 0;
+    __atomic_add_fetch(&c->utrap, 1, __ATOMIC_RELEASE);
+
     struct proc* p = myproc();
 
     // save user program counter.
@@ -60,7 +63,15 @@ void usertrap(void) {
         // so enable only now that we're done with those registers.
         intr_on();
 
+        // 内存不足时在这里换出，系统调用中的 kalloc() 不等待磁盘
+        swapreclaim();
+
         syscall();
+    } else if ((r_scause() == 12 || r_scause() == 13 || r_scause() == 15) &&
+               uvmtrap(p, r_stval(), r_scause()) == 0) {
+        // store to a copy-on-write page, first touch of a program
+        // segment or a lazily allocated heap page, or a page swapped
+        // out to disk; now mapped.
     } else if ((which_dev = devintr()) != 0) {
         // ok
     } else {
@@ -73,8 +84,12 @@ void usertrap(void) {
         exit(-1);
 
     // give up the CPU if this is a timer interrupt.
-    if (which_dev == 2)
+    // 此时内核没有用到它的任何用户页，等待调度期间可以换出这些页。
+    if (which_dev == 2 && preempt()) {
+        p->swapok = 1;
         yield();
+        p->swapok = 0;
+    }
 
     usertrapret();
 }
@@ -113,14 +128,36 @@ void usertrapret(void) {
     // set S Exception Program Counter to the saved user pc.
     w_sepc(p->trapframe->epc);
 
+    // 第一次回到 exec 出来的程序
+    if (p->execstart)
+        execdone(p);
+
     // tell trampoline.S the user page table to switch to.
+    // 带上进程的 ASID，只在页表变过之后才清掉本 CPU 上这个 ASID 的 TLB 表项；
+    // 不用 ASID 时由 trampoline.S 清空整个 TLB。
+    // 先标记在用户态再检查 tlbdirty：threadstale() 先改 tlbdirty 再检查
+    // user，两边总有一边看到另一边的修改。
     uint64 satp = MAKE_SATP(p->pagetable);
+    struct cpu* c = mycpu();
+    c->user = 1;
+    __sync_synchronize();
+    c->uret++;
+    if (p->asid != 0) {
+        satp |= SATP_ASID(p->asid);
+        if (p->tlbdirty & (1U << cpuid())) {
+            __atomic_and_fetch(&p->tlbdirty, ~(1U << cpuid()), __ATOMIC_RELAXED);
+            sfence_vma_asid(p->asid);
+            c->tlbflush++;
+        }
+    } else {
+        c->tlbflush++;
+    }
 
     // jump to userret in trampoline.S at the top of memory, which
     // switches to the user page table, restores user registers,
     // and switches to user mode with sret.
     uint64 trampoline_userret = TRAMPOLINE + (userret - trampoline);
-    ((void (*)(uint64))trampoline_userret)(satp);
+    ((void (*)(uint64, uint64))trampoline_userret)(satp, p->tfva);
 }
 
 // interrupts and exceptions from kernel code go here via kernelvec,
@@ -143,7 +180,7 @@ void kerneltrap() {
     }
 
     // give up the CPU if this is a timer interrupt.
-    if (which_dev == 2 && myproc() != 0)
+    if (which_dev == 2 && myproc() != 0 && preempt())
         yield();
 
     // the yield() may have caused some traps to occur,
@@ -152,23 +189,16 @@ void kerneltrap() {
     w_sstatus(sstatus);
 }
 
-void clockintr() {
-    if (cpuid() == 0) {
-        acquire(&tickslock);
-        ticks++;
-        wakeup(&ticks);
-        release(&tickslock);
-    }
-
-    // ask for the next timer interrupt. this also clears
-    // the interrupt request. 1000000 is about a tenth
-    // of a second.
-    w_stimecmp(r_time() + 1000000);
+// 时钟中断。到期的定时器在 timerintr() 中处理；
+// 当前进程的时间片用完时返回 1，让它让出 CPU。
+int clockintr() {
+    mycpu()->nclock++;
+    return timerintr();
 }
 
 // check if it's an external interrupt or software interrupt,
 // and handle it.
-// returns 2 if timer interrupt,
+// returns 2 if timer interrupt at the end of a time slice,
 // 1 if other device,
 // 0 if not recognized.
 int devintr() {
@@ -197,9 +227,31 @@ int devintr() {
         return 1;
     } else if (scause == 0x8000000000000005L) {
         // timer interrupt.
-        clockintr();
-        return 2;
+        // 只是唤醒了睡眠的进程时不算时间片用完。
+        return clockintr() ? 2 : 1;
+    } else if (scause == 0x8000000000000001L) {
+        // supervisor software interrupt: 另一个 CPU 发来的 IPI，
+        // 见 kernelvec.S 的 machinevec。从 wfi 醒来就够了；
+        // 打断用户态的线程时，进入内核本身就完成了 TLB shootdown。
+        w_sip(r_sip() & ~2);
+        mycpu()->nipi++;
+        return 1;
     } else {
         return 0;
     }
 }
+
+// 汇总各 CPU 回到用户态、清除 TLB 和中断的次数
+void trapstat(struct sysinfo* info) {
+    info->uret = 0;
+    info->tlbflush = 0;
+    info->nclock = 0;
+    info->nipi = 0;
+    for (int i = 0; i < NCPU; i++) {
+        info->uret += cpus[i].uret;
+        info->tlbflush += cpus[i].tlbflush;
+        info->nclock += cpus[i].nclock;
+        info->nipi += cpus[i].nipi;
+    }
+    info->nasid = nasid;
+}
@@ -48,7 +48,7 @@ static struct disk {
     // for use when completion interrupt arrives.
     // indexed by first descriptor index of chain.
     struct {
-        struct buf* b;
+        int* busy; // 请求完成时清零并唤醒，比如 &b->disk
         char status;
     } info[NUM];
 
@@ -176,7 +176,6 @@ free_desc(int i) {
     disk.desc[i].flags = 0;
     disk.desc[i].next = 0;
     disk.free[i] = 1;
-    wakeup(&disk.free[0]);
 }
 
 // free a chain of descriptors.
@@ -191,42 +190,51 @@ free_chain(int i) {
         else
             break;
     }
+    // 整条链释放完再唤醒一次，而不是每个描述符都唤醒所有等待者
+    wakeup(&disk.free[0]);
 }
 
-// allocate three descriptors (they need not be contiguous).
-// disk transfers always use three descriptors.
+// allocate n descriptors (they need not be contiguous).
+// a transfer uses one for the header, one per data segment
+// and one for the status.
+// 不够时什么也不分配，不会先分配一部分再释放。
 static int
-alloc3_desc(int* idx) {
-    for (int i = 0; i < 3; i++) {
+alloc_descs(int* idx, int n) {
+    int nfree = 0;
+
+    for (int i = 0; i < NUM; i++)
+        nfree += disk.free[i];
+    if (nfree < n)
+        return -1;
+    for (int i = 0; i < n; i++)
         idx[i] = alloc_desc();
-        if (idx[i] < 0) {
-            for (int j = 0; j < i; j++)
-                free_desc(idx[j]);
-            return -1;
-        }
-    }
     return 0;
 }
 
-void virtio_disk_rw(struct buf* b, int write) {
-    uint64 sector = b->blockno * (BSIZE / 512);
+// 一个读写请求：从 sector 开始连续读写 n 段内存 data[0..n-1]，每段 len 字节。
+// 等待请求完成，*busy 在此期间为 1。
+static void
+virtio_disk_req(uint64 sector, char** data, int n, uint len, int write, int* busy) {
+    int idx[NUM];
+
+    if (n < 1 || n > NUM - 2)
+        panic("virtio_disk_req");
 
     acquire(&disk.vdisk_lock);
 
     // the spec's Section 5.2 says that legacy block operations use
-    // three descriptors: one for type/reserved/sector, one for the
-    // data, one for a 1-byte status result.
+    // a descriptor for type/reserved/sector, descriptors for the
+    // data, and one for a 1-byte status result.
 
-    // allocate the three descriptors.
-    int idx[3];
+    // allocate the descriptors.
     while (1) {
-        if (alloc3_desc(idx) == 0) {
+        if (alloc_descs(idx, n + 2) == 0) {
             break;
         }
         sleep(&disk.free[0], &disk.vdisk_lock);
     }
 
-    // format the three descriptors.
+    // format the descriptors.
     // qemu's virtio-blk.c reads them.
 
     struct virtio_blk_req* buf0 = &disk.ops[idx[0]];
@@ -243,24 +251,26 @@ void virtio_disk_rw(struct buf* b, int write) {
     disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
     disk.desc[idx[0]].next = idx[1];
 
-    disk.desc[idx[1]].addr = (uint64)b->data;
-    disk.desc[idx[1]].len = BSIZE;
-    if (write)
-        disk.desc[idx[1]].flags = 0; // device reads b->data
-    else
-        disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-    disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-    disk.desc[idx[1]].next = idx[2];
+    for (int i = 1; i <= n; i++) {
+        disk.desc[idx[i]].addr = (uint64)data[i - 1];
+        disk.desc[idx[i]].len = len;
+        if (write)
+            disk.desc[idx[i]].flags = 0; // device reads the data
+        else
+            disk.desc[idx[i]].flags = VRING_DESC_F_WRITE; // device writes the data
+        disk.desc[idx[i]].flags |= VRING_DESC_F_NEXT;
+        disk.desc[idx[i]].next = idx[i + 1];
+    }
 
     disk.info[idx[0]].status = 0xff; // device writes 0 on success
-    disk.desc[idx[2]].addr = (uint64)&disk.info[idx[0]].status;
-    disk.desc[idx[2]].len = 1;
-    disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-    disk.desc[idx[2]].next = 0;
+    disk.desc[idx[n + 1]].addr = (uint64)&disk.info[idx[0]].status;
+    disk.desc[idx[n + 1]].len = 1;
+    disk.desc[idx[n + 1]].flags = VRING_DESC_F_WRITE; // device writes the status
+    disk.desc[idx[n + 1]].next = 0;
 
-    // record struct buf for virtio_disk_intr().
-    b->disk = 1;
-    disk.info[idx[0]].b = b;
+    // record the completion flag for virtio_disk_intr().
+    *busy = 1;
+    disk.info[idx[0]].busy = busy;
 
     // tell the device the first index in our chain of descriptors.
     disk.avail->ring[disk.avail->idx % NUM] = idx[0];
@@ -275,16 +285,30 @@ void virtio_disk_rw(struct buf* b, int write) {
     *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
 
     // Wait for virtio_disk_intr() to say request has finished.
-    while (b->disk == 1) {
-        sleep(b, &disk.vdisk_lock);
+    while (*busy == 1) {
+        sleep(busy, &disk.vdisk_lock);
     }
 
-    disk.info[idx[0]].b = 0;
+    disk.info[idx[0]].busy = 0;
     free_chain(idx[0]);
 
     release(&disk.vdisk_lock);
 }
 
+void virtio_disk_rw(struct buf* b, int write) {
+    char* data = (char*)b->data;
+
+    virtio_disk_req(b->blockno * (BSIZE / 512), &data, 1, BSIZE, write, &b->disk);
+}
+
+// 用一个请求读写从 blockno 开始连续的 n 页，第 i 页在内存中的地址为 pages[i]。
+// 交换区用它成批换出和换入，n 不超过 NUM - 2。
+void virtio_disk_rwpages(uint blockno, char** pages, int n, int write) {
+    int busy;
+
+    virtio_disk_req(blockno * (BSIZE / 512), pages, n, PGSIZE, write, &busy);
+}
+
 void virtio_disk_intr() {
     acquire(&disk.vdisk_lock);
 
@@ -308,9 +332,9 @@ void virtio_disk_intr() {
         if (disk.info[id].status != 0)
             panic("virtio_disk_intr status");
 
-        struct buf* b = disk.info[id].b;
-        b->disk = 0; // disk is done with buf
-        wakeup(b);
+        int* busy = disk.info[id].busy;
+        *busy = 0; // disk is done with the request
+        wakeup(busy);
 
         disk.used_idx += 1;
     }
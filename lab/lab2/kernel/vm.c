@@ -9,12 +9,43 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "fs.h"
+#include "sysinfo.h"
 
 /*
  * the kernel's page table.
  */
 pagetable_t kernel_pagetable;
 
+// 硬件支持的 ASID 个数。内核页表用 ASID 0，够给每个进程槽位一个时
+// 进程 p 用 ASID (p - proc) + 1，否则所有页表都用 0、每次切换清空 TLB。
+int nasid;
+
+#define SUPERORDER 9 // 大页在 kalloc_order() 中的阶
+
+// 虚拟内存的事件计数
+struct {
+    uint64 cowfault; // 处理的写时复制缺页
+    uint64 cowcopy;  // 其中真正复制了页面的次数
+    uint64 lazyfault; // 懒分配缺页
+    uint64 copyhit;   // copyin/copyout 命中翻译缓存
+    uint64 copymiss;  // copyin/copyout 查页表
+} vmcount;
+
+// 地址空间的记账，随页表的修改增量维护，记在页表所属的 struct mm 中。
+// 这里只认得当前进程(和它的线程)的页表：exec 正在建立的新页表、fork 的
+// 子进程的页表在接上 mm 时由 uvmrecount() 数一遍，换出别的进程的页时
+// swap.c 用 uvmresident() 直接记到那个进程的 mm 上。
+static void acct(pagetable_t pagetable, int i, long n) {
+    struct proc* p = myproc();
+
+    if (p != 0 && p->pagetable == pagetable)
+        __atomic_add_fetch(&p->mm->acct[i], (uint64)n, __ATOMIC_RELAXED);
+}
+
+static uint64 acctget(struct mm* mm, int i) {
+    return __atomic_load_n(&mm->acct[i], __ATOMIC_RELAXED);
+}
+
 extern char etext[]; // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
@@ -29,6 +60,9 @@ pagetable_t kvmmake(void) {
     // uart registers
     kvmmap(kpgtbl, UART0, UART0, PGSIZE, PTE_R | PTE_W);
 
+    // CLINT，只用到 MSIP 寄存器，用来发送处理器间中断
+    kvmmap(kpgtbl, CLINT, CLINT, PGSIZE, PTE_R | PTE_W);
+
     // virtio mmio disk interface
     kvmmap(kpgtbl, VIRTIO0, VIRTIO0, PGSIZE, PTE_R | PTE_W);
 
@@ -51,7 +85,8 @@ pagetable_t kvmmake(void) {
 
     // map the trampoline for trap entry/exit to
     // the highest virtual address in the kernel.
-    kvmmap(kpgtbl, TRAMPOLINE, (uint64)trampoline, PGSIZE, PTE_R | PTE_X);
+    // 用户页表中也以同样的方式映射它，所以是全局的。
+    kvmmap(kpgtbl, TRAMPOLINE, (uint64)trampoline, PGSIZE, PTE_R | PTE_X | PTE_G);
 
     // allocate and map a kernel stack for each process.
     proc_mapstacks(kpgtbl);
@@ -70,12 +105,42 @@ void kvminithart() {
     // wait for any previous writes to the page table memory to finish.
     sfence_vma();
 
+    // 往 ASID 字段写全 1，读回来的是硬件实现的位数
+    w_satp(MAKE_SATP(kernel_pagetable) | SATP_ASIDMASK);
+    nasid = ((r_satp() & SATP_ASIDMASK) >> 44) + 1;
     w_satp(MAKE_SATP(kernel_pagetable));
 
     // flush stale entries from the TLB.
     sfence_vma();
 }
 
+// p 的页表中已有的映射变了：p 下次在各个 CPU 上回到用户态前，
+// 都要先清掉 TLB 中 p 的 ASID 的表项。
+// copyin/copyout 的翻译缓存也随之作废。共用页表的线程也一样。
+void tlbstale(struct proc* p) {
+    __atomic_store_n(&p->tlbdirty, ~0U, __ATOMIC_RELAXED);
+    p->cc.perm = 0;
+    if (__atomic_load_n(&p->mm->nthread, __ATOMIC_RELAXED) > 1)
+        threadstale(p, 0);
+}
+
+// 改的是当前进程的页表时记下 TLB 需要清除。revoke 非 0 表示去掉了映射、
+// 收回了写权限或者换了物理页：共用页表的其他线程可能正在别的 CPU 上
+// 通过 TLB 中的旧表项访问，要等它们都进入内核。
+static void uvmchanged(pagetable_t pagetable, int revoke) {
+    struct proc* p = myproc();
+
+    if (p == 0 || p->pagetable != pagetable)
+        return;
+    tlbstale(p);
+    if (revoke && __atomic_load_n(&p->mm->nthread, __ATOMIC_RELAXED) > 1) {
+        threadstale(p, 1);
+        // 等正在 copyaddr() 中确认映射的线程，见那里的注释
+        acquire(&p->mm->lock);
+        release(&p->mm->lock);
+    }
+}
+
 // Return the address of the PTE in page table pagetable
 // that corresponds to virtual address va.  If alloc!=0,
 // create any required page-table pages.
@@ -88,47 +153,72 @@ void kvminithart() {
 //   21..29 -- 9 bits of level-1 index.
 //   12..20 -- 9 bits of level-0 index.
 //    0..11 -- 12 bits of byte offset within the page.
+// 调用者把返回的 PTE 当作 4KB 页的，途中遇到大页的叶子时返回 0；
+// 要处理大页的调用者用 walkleaf()。
 pte_t* walk(pagetable_t pagetable, uint64 va, int alloc) {
+    return walklevel(pagetable, va, alloc, 0);
+}
+
+// 和 walk() 一样，但停在第 level 级页表的 PTE 上。途中遇到更大的叶子时返回 0。
+pte_t* walklevel(pagetable_t pagetable, uint64 va, int alloc, int level) {
+    pagetable_t root = pagetable;
+
     if (va >= MAXVA)
         panic("walk");
 
-    for (int level = 2; level > 0; level--) {
-        pte_t* pte = &pagetable[PX(level, va)];
+    for (int l = 2; l > level; l--) {
+        pte_t* pte = &pagetable[PX(l, va)];
         if (*pte & PTE_V) {
+            if (PTE_LEAF(*pte))
+                return 0;
             pagetable = (pagetable_t)PTE2PA(*pte);
-#ifdef LAB_PGTBL
-            if (PTE_LEAF(*pte)) {
-                return pte;
-            }
-#endif
         } else {
-            if (!alloc || (pagetable = (pde_t*)kalloc()) == 0)
+            if (!alloc || (pagetable = (pde_t*)kalloc_zeroed()) == 0)
                 return 0;
-            memset(pagetable, 0, PGSIZE);
             *pte = PA2PTE(pagetable) | PTE_V;
+            acct(root, ACCT_PTPAGES, 1);
+        }
+    }
+    return &pagetable[PX(level, va)];
+}
+
+// 查找映射 va 的叶子 PTE，*sz 返回它映射的大小(PGSIZE 或 SUPERPGSIZE)。
+// va 没有映射时返回 0。
+pte_t* walkleaf(pagetable_t pagetable, uint64 va, uint64* sz) {
+    pte_t* pte;
+
+    if (va >= MAXVA)
+        return 0;
+    for (int level = 2; level >= 0; level--) {
+        pte = &pagetable[PX(level, va)];
+        if ((*pte & PTE_V) == 0)
+            return 0;
+        if (PTE_LEAF(*pte)) {
+            *sz = 1UL << PXSHIFT(level);
+            return pte;
         }
+        pagetable = (pagetable_t)PTE2PA(*pte);
     }
-    return &pagetable[PX(0, va)];
+    return 0;
 }
 
 // Look up a virtual address, return the physical address,
 // or 0 if not mapped.
 // Can only be used to look up user pages.
+// 大页中返回 va 所在的 4KB 页的物理地址。
 uint64 walkaddr(pagetable_t pagetable, uint64 va) {
     pte_t* pte;
-    uint64 pa;
+    uint64 pa, sz;
 
     if (va >= MAXVA)
         return 0;
 
-    pte = walk(pagetable, va, 0);
+    pte = walkleaf(pagetable, va, &sz);
     if (pte == 0)
         return 0;
-    if ((*pte & PTE_V) == 0)
-        return 0;
     if ((*pte & PTE_U) == 0)
         return 0;
-    pa = PTE2PA(*pte);
+    pa = PTE2PA(*pte) + PGROUNDDOWN(va & (sz - 1));
     return pa;
 }
 
@@ -140,13 +230,38 @@ void kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm) {
         panic("kvmmap");
 }
 
+// 为 va 处的 2MB 大页找到第 1 级 PTE。原来的第 0 级页表如果已经空了就释放掉；
+// 换出到交换区的页的 PTE 也算占用，释放页表会丢掉它们的槽位。
+// 返回的 PTE 可能仍被占用(已有大页，或第 0 级页表里还有页)：和小页一样，
+// mappages() 把这当作重复映射而 panic，调用者要保证这段地址没有映射。
+static pte_t* walksuper(pagetable_t pagetable, uint64 va) {
+    pagetable_t pt;
+    pte_t* pte;
+    int i;
+
+    if ((pte = walklevel(pagetable, va, 1, 1)) == 0)
+        return 0;
+    if ((*pte & PTE_V) && !PTE_LEAF(*pte)) {
+        pt = (pagetable_t)PTE2PA(*pte);
+        for (i = 0; i < 512 && (pt[i] & (PTE_V | PTE_SWAP)) == 0; i++)
+            ;
+        if (i == 512) {
+            kfree((void*)pt);
+            *pte = 0;
+            acct(pagetable, ACCT_PTPAGES, -1);
+        }
+    }
+    return pte;
+}
+
 // Create PTEs for virtual addresses starting at va that refer to
 // physical addresses starting at pa.
 // va and size MUST be page-aligned.
+// va 和 pa 都按 2MB 对齐、且剩余至少 2MB 时用一个大页映射。
 // Returns 0 on success, -1 if walk() couldn't
 // allocate a needed page-table page.
 int mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm) {
-    uint64 a, last;
+    uint64 a, last, sz;
     pte_t* pte;
 
     if ((va % PGSIZE) != 0)
@@ -161,56 +276,106 @@ int mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
     a = va;
     last = va + size - PGSIZE;
     for (;;) {
-        if ((pte = walk(pagetable, a, 1)) == 0)
+        sz = PGSIZE;
+        if (a % SUPERPGSIZE == 0 && pa % SUPERPGSIZE == 0 && last - a >= SUPERPGSIZE - PGSIZE) {
+            sz = SUPERPGSIZE;
+            pte = walksuper(pagetable, a);
+        } else {
+            pte = walk(pagetable, a, 1);
+        }
+        if (pte == 0)
             return -1;
-        if (*pte & PTE_V)
+        if (*pte & (PTE_V | PTE_SWAP))
             panic("mappages: remap");
         *pte = PA2PTE(pa) | perm | PTE_V;
-        if (a == last)
+        if (a + sz - PGSIZE == last)
             break;
-        a += PGSIZE;
-        pa += PGSIZE;
+        a += sz;
+        pa += sz;
     }
+    if (perm & PTE_U)
+        acct(pagetable, ACCT_RSS, size / PGSIZE);
+    uvmchanged(pagetable, 0);
     return 0;
 }
 
+// 当前进程的页表是否被多个线程共用
+static int uvmshared(pagetable_t pagetable) {
+    struct proc* p = myproc();
+
+    return p != 0 && p->pagetable == pagetable &&
+           __atomic_load_n(&p->mm->nthread, __ATOMIC_RELAXED) > 1;
+}
+
+// 线程共用的页表中要去掉 [va, va+npages*PGSIZE) 并释放物理页：先收回
+// 用户权限，等别的 CPU 上的线程不再使用 TLB 中的旧表项，之后才能释放。
+// 返回收回的用户页数。调用者持有 mmlock()，缺页处理不会把它们恢复。
+static long uvmrevoke(pagetable_t pagetable, uint64 va, uint64 npages) {
+    uint64 a, sz;
+    pte_t* pte;
+    long n = 0;
+
+    for (a = va; a < va + npages * PGSIZE; a += sz) {
+        sz = PGSIZE;
+        if ((pte = walkleaf(pagetable, a, &sz)) == 0) {
+            sz = PGSIZE;
+            continue;
+        }
+        if (*pte & PTE_U) {
+            n += sz / PGSIZE;
+            *pte &= ~PTE_U;
+        }
+    }
+    uvmchanged(pagetable, 1);
+    return n;
+}
+
 // Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
+// page-aligned. 懒分配的堆中可能有从未访问过的页，跳过没有映射的页。
+// 释放物理内存时也释放换出到交换区的页占用的槽位。
+// 范围必须覆盖其中的整个大页，只去掉一部分时先用 uvmsplit() 拆开。
 // Optionally free the physical memory.
 void uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free) {
-    uint64 a;
+    uint64 a, sz;
     pte_t* pte;
-    int sz;
+    long resident = 0;
 
     if ((va % PGSIZE) != 0)
         panic("uvmunmap: not aligned");
 
+    if (do_free && uvmshared(pagetable))
+        resident = uvmrevoke(pagetable, va, npages);
     for (a = va; a < va + npages * PGSIZE; a += sz) {
         sz = PGSIZE;
-        if ((pte = walk(pagetable, a, 0)) == 0)
-            panic("uvmunmap: walk");
-        if ((*pte & PTE_V) == 0) {
-            printf("va=%ld pte=%ld\n", a, *pte);
-            panic("uvmunmap: not mapped");
+        if ((pte = walkleaf(pagetable, a, &sz)) == 0) {
+            sz = PGSIZE;
+            if (do_free && (pte = walk(pagetable, a, 0)) != 0 && (*pte & PTE_SWAP)) {
+                swapfree(*pte);
+                *pte = 0;
+            }
+            continue;
         }
-        if (PTE_FLAGS(*pte) == PTE_V)
-            panic("uvmunmap: not a leaf");
+        if (a % sz != 0 || a + sz > va + npages * PGSIZE)
+            panic("uvmunmap: partial superpage");
         if (do_free) {
             uint64 pa = PTE2PA(*pte);
             kfree((void*)pa);
         }
+        if (*pte & PTE_U)
+            resident += sz / PGSIZE;
         *pte = 0;
     }
+    acct(pagetable, ACCT_RSS, -resident);
+    uvmchanged(pagetable, 1);
 }
 
 // create an empty user page table.
 // returns 0 if out of memory.
 pagetable_t uvmcreate() {
     pagetable_t pagetable;
-    pagetable = (pagetable_t)kalloc();
+    pagetable = (pagetable_t)kalloc_zeroed();
     if (pagetable == 0)
         return 0;
-    memset(pagetable, 0, PGSIZE);
     return pagetable;
 }
 
@@ -228,12 +393,21 @@ void uvmfirst(pagetable_t pagetable, uchar* src, uint sz) {
     memmove(mem, src, sz);
 }
 
+// 为用户内存分配一页。
+// syscall 实验的 attack 依赖新分配的用户页不被清零。
+static char* uvmpage(void) {
+#ifndef LAB_SYSCALL
+    return kalloc_zeroed();
+#else
+    return kalloc();
+#endif
+}
+
 // Allocate PTEs and physical memory to grow process from oldsz to
 // newsz, which need not be page aligned.  Returns new size or 0 on error.
 uint64 uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm) {
     char* mem;
-    uint64 a;
-    int sz;
+    uint64 a, sz;
 
     if (newsz < oldsz)
         return oldsz;
@@ -241,14 +415,11 @@ uint64 uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm) {
     oldsz = PGROUNDUP(oldsz);
     for (a = oldsz; a < newsz; a += sz) {
         sz = PGSIZE;
-        mem = kalloc();
+        mem = uvmpage();
         if (mem == 0) {
             uvmdealloc(pagetable, a, oldsz);
             return 0;
         }
-#ifndef LAB_SYSCALL
-        memset(mem, 0, sz);
-#endif
         if (mappages(pagetable, a, sz, (uint64)mem, PTE_R | PTE_U | xperm) != 0) {
             kfree(mem);
             uvmdealloc(pagetable, a, oldsz);
@@ -258,14 +429,90 @@ uint64 uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm) {
     return newsz;
 }
 
+// 和 uvmalloc() 一样，但 [oldsz, newsz) 中按 2MB 对齐的整块用大页映射。
+// 拿不到 2MB 的连续物理内存时退回到 4KB 的页。
+uint64 uvmalloc_super(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm) {
+    uint64 a, next;
+    char* mem;
+
+    if (newsz < oldsz)
+        return oldsz;
+
+    for (a = PGROUNDUP(oldsz); a < newsz; a = next) {
+        next = SUPERPGROUNDDOWN(a) + SUPERPGSIZE;
+        if (a % SUPERPGSIZE == 0 && next <= newsz && (mem = kalloc_order(SUPERORDER)) != 0) {
+            memset(mem, 0, SUPERPGSIZE);
+            if (mappages(pagetable, a, SUPERPGSIZE, (uint64)mem, PTE_R | PTE_U | xperm) != 0) {
+                kfree(mem);
+                uvmdealloc(pagetable, a, oldsz);
+                return 0;
+            }
+            continue;
+        }
+        if (next > newsz)
+            next = newsz;
+        if (uvmalloc(pagetable, a, next, xperm) == 0) {
+            uvmdealloc(pagetable, a, oldsz);
+            return 0;
+        }
+    }
+    return newsz;
+}
+
+// 把 va 所在的大页拆成 512 个 4KB 页，权限不变。大页只有这一个引用时
+// 直接拆分物理块；还和别的进程写时复制共享时，复制出私有的 4KB 页。
+// 内存不足时返回 -1，va 不在大页中时什么也不做。
+int uvmsplit(pagetable_t pagetable, uint64 va) {
+    pagetable_t pt;
+    pte_t* pte;
+    uint64 sz, pa, flags;
+    char* mem;
+    int i;
+
+    if ((pte = walkleaf(pagetable, va, &sz)) == 0 || sz != SUPERPGSIZE)
+        return 0;
+    if ((pt = (pagetable_t)kalloc_zeroed()) == 0)
+        return -1;
+    pa = PTE2PA(*pte);
+    flags = PTE_FLAGS(*pte);
+    if (krefcnt((void*)pa) == 1) {
+        ksplit((void*)pa);
+        for (i = 0; i < 512; i++)
+            pt[i] = PA2PTE(pa + (uint64)i * PGSIZE) | flags;
+    } else {
+        if (flags & PTE_COW)
+            flags = (flags & ~PTE_COW) | PTE_W;
+        for (i = 0; i < 512; i++) {
+            if ((mem = kalloc()) == 0) {
+                while (--i >= 0)
+                    kfree((void*)PTE2PA(pt[i]));
+                kfree((void*)pt);
+                return -1;
+            }
+            memmove(mem, (char*)pa + (uint64)i * PGSIZE, PGSIZE);
+            pt[i] = PA2PTE(mem) | flags;
+        }
+    }
+    *pte = PA2PTE(pt) | PTE_V;
+    acct(pagetable, ACCT_PTPAGES, 1);
+    uvmchanged(pagetable, 1);
+    if (PTE2PA(pt[0]) != pa)
+        kfree((void*)pa); // 复制出了私有的页，不再引用共享的大页
+    return 0;
+}
+
 // Deallocate user pages to bring the process size from oldsz to
 // newsz.  oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz.  oldsz can be larger than the actual
 // process size.  Returns the new process size.
+// 新的末尾落在大页中间时先拆开它，内存不足拆不开时不缩小。
 uint64 uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz) {
     if (newsz >= oldsz)
         return oldsz;
 
+    if (PGROUNDUP(newsz) % SUPERPGSIZE != 0 && uvmsplit(pagetable, PGROUNDUP(newsz)) < 0)
+        return oldsz;
+
     if (PGROUNDUP(newsz) < PGROUNDUP(oldsz)) {
         int npages = (PGROUNDUP(oldsz) - PGROUNDUP(newsz)) / PGSIZE;
         uvmunmap(pagetable, PGROUNDUP(newsz), npages, 1);
@@ -302,41 +549,207 @@ void uvmfree(pagetable_t pagetable, uint64 sz) {
 
 // Given a parent process's page table, copy
 // its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
+// 写时复制：父子共享物理页，可写页在双方的页表中都改成只读并打上
+// PTE_COW，第一次写入时由 uvmcow() 复制。
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
+// 大页整个共享，在子进程中也映射成大页。
 int uvmcopy(pagetable_t old, pagetable_t new, uint64 sz) {
-    pte_t* pte;
-    uint64 pa, i;
+    return uvmcopyrange(old, new, 0, sz, 1);
+}
+
+// 把父进程页表中 [start, end) 已经映射的页映射到子进程页表的相同位置。
+// cow 为 1 时可写页改为两边共享的写时复制页；为 0 时照原样共享(MAP_SHARED)。
+// 失败时撤销子进程中已经建立的映射。
+int uvmcopyrange(pagetable_t old, pagetable_t new, uint64 start, uint64 end, int cow) {
+    pte_t *pte, *npte;
+    uint64 pa, i, szinc;
     uint flags;
-    char* mem;
-    int szinc;
+    int changed = 0;
 
-    for (i = 0; i < sz; i += szinc) {
-        szinc = PGSIZE;
+    for (i = start; i < end; i += szinc) {
         szinc = PGSIZE;
-        if ((pte = walk(old, i, 0)) == 0)
-            panic("uvmcopy: pte should exist");
-        if ((*pte & PTE_V) == 0)
-            panic("uvmcopy: page not present");
+        if ((pte = walkleaf(old, i, &szinc)) == 0) {
+            szinc = PGSIZE;
+            if ((pte = walk(old, i, 0)) != 0 && (*pte & PTE_SWAP)) {
+                // 换出的页：子进程的 PTE 引用同一个交换区槽位
+                if ((npte = walk(new, i, 1)) == 0)
+                    goto err;
+                *npte = *pte;
+                swapdup(*pte);
+            }
+            continue; // 懒分配、还没有访问过的页
+        }
+        if (cow && (*pte & PTE_W)) {
+            *pte = (*pte & ~PTE_W) | PTE_COW;
+            changed = 1;
+        }
         pa = PTE2PA(*pte);
         flags = PTE_FLAGS(*pte);
-        if ((mem = kalloc()) == 0)
-            goto err;
-        memmove(mem, (char*)pa, PGSIZE);
-        if (mappages(new, i, PGSIZE, (uint64)mem, flags) != 0) {
-            kfree(mem);
+        if (mappages(new, i, szinc, pa, flags) != 0)
             goto err;
-        }
+        kdup((void*)pa);
     }
+    if (changed)
+        uvmchanged(old, 1);
     return 0;
 
 err:
-    uvmunmap(new, 0, i / PGSIZE, 1);
+    if (changed)
+        uvmchanged(old, 1);
+    uvmunmap(new, start, (i - start) / PGSIZE, 1);
     return -1;
 }
 
+int uvmcow(pagetable_t pagetable, uint64 va) {
+    pte_t* pte;
+    uint64 pa, sz;
+    uint flags;
+    char* mem;
+
+    pte = walkleaf(pagetable, va, &sz);
+    if (pte == 0 || (*pte & (PTE_V | PTE_U | PTE_COW)) != (PTE_V | PTE_U | PTE_COW))
+        return -1;
+    __atomic_add_fetch(&vmcount.cowfault, 1, __ATOMIC_RELAXED);
+    acct(pagetable, ACCT_MINFLT, 1);
+    pa = PTE2PA(*pte);
+    flags = (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+    if (krefcnt((void*)pa) == 1) {
+        // 其他共享者都已经复制或退出，这一页归我们独有
+        *pte = PA2PTE(pa) | flags;
+        uvmchanged(pagetable, 0);
+        return 0;
+    }
+    if (sz == SUPERPGSIZE)
+        mem = kalloc_order(SUPERORDER);
+    else
+        mem = kalloc();
+    if (mem == 0) {
+        // uvmsplit() 会复制出私有的小页
+        if (sz == SUPERPGSIZE && uvmsplit(pagetable, va) == 0)
+            return 0;
+        return -1;
+    }
+    memmove(mem, (char*)pa, sz);
+    *pte = PA2PTE(mem) | flags;
+    uvmchanged(pagetable, 1);
+    kfree((void*)pa);
+    __atomic_add_fetch(&vmcount.cowcopy, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+// 懒分配：va 在进程大小 sz 之内但还没有映射时，分配一页并映射。
+// va 已经映射(比如栈的保护页)、越界或内存不足时返回 -1。
+static int uvmlazy(pagetable_t pagetable, uint64 va, uint64 sz) {
+    uint64 leaf;
+    char* mem;
+
+    if (va >= sz || va >= MAXVA)
+        return -1;
+    va = PGROUNDDOWN(va);
+    if (walkleaf(pagetable, va, &leaf) != 0)
+        return -1;
+    if ((mem = uvmpage()) == 0)
+        return -1;
+    if (mappages(pagetable, va, PGSIZE, (uint64)mem, PTE_R | PTE_W | PTE_U) != 0) {
+        kfree(mem);
+        return -1;
+    }
+    __atomic_add_fetch(&vmcount.lazyfault, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+// 进程 p 访问用户地址 va 时缺页：exec 的程序段从文件读入，其余是懒分配的堆页。
+// 成功映射返回 0。调用者持有 mmlock()。
+static int uvmfault(struct proc* p, uint64 va) {
+    int r, major = 1;
+
+    // 换入、映射文件和读程序段要从交换区或文件取页，记为主缺页
+    if ((r = swapfault(p, va)) == 1 && (r = mmapfault(p, va)) == 1) {
+        if (va >= p->mm->sz)
+            return -1;
+        if ((r = execfault(p, va)) == 1) {
+            r = uvmlazy(p->pagetable, va, p->mm->sz);
+            major = 0;
+        }
+    }
+    if (r == 0)
+        acct(p->pagetable, major ? ACCT_MAJFLT : ACCT_MINFLT, 1);
+    return r;
+}
+
+// 用户态访问 va 时的缺页(scause 12、13、15)：写时复制页的写入，或者 uvmfault()
+// 处理的缺页。同一进程的另一个线程可能刚处理完同一页，这时什么也不用做。
+// 因为分配内存失败(p->nomem)而没能处理时，在锁外用 swapreclaim() 腾出内存再试。成功返回 0。
+int uvmtrap(struct proc* p, uint64 va, uint64 scause) {
+    int perm = scause == 12 ? PTE_X : scause == 13 ? PTE_R : PTE_W;
+    uint64 sz;
+    pte_t* pte;
+    int r;
+
+    for (;;) {
+        p->nomem = 0;
+        mmlock(p);
+        if (scause == 15 && uvmcow(p->pagetable, va) == 0)
+            r = 0;
+        else if ((pte = walkleaf(p->pagetable, va, &sz)) != 0 &&
+                 (*pte & (PTE_V | PTE_U | perm)) == (PTE_V | PTE_U | perm))
+            r = 0;
+        else
+            r = uvmfault(p, va);
+        mmunlock(p);
+        // 地址没有映射、写只读页这类错误回收多少内存也没用
+        if (r == 0 || !p->nomem || swapreclaim() == 0)
+            return r;
+    }
+}
+
+// 内核代表当前进程访问用户地址 va：如果它所在的页还没有读入或分配，先处理缺页。
+// 返回 va 所在页的物理地址，不可访问时返回 0。
+// 锁的顺序是先 mmlock() 后 inode 锁：缺页处理持有 mmlock() 读文件，所以持有
+// inode 锁时不处理缺页，只记下 p->faultskip，由调用者放开锁之后用
+// uvmprefault() 让页就位再重试。
+static uint64 uvmaddr(pagetable_t pagetable, uint64 va) {
+    struct proc* p = myproc();
+    uint64 pa;
+
+    pa = walkaddr(pagetable, va);
+    if (pa != 0 || p == 0 || p->pagetable != pagetable)
+        return pa;
+    if (p->ilocks) {
+        p->faultskip = 1;
+        return 0;
+    }
+    if (mmlock(p) == 0) {
+        if ((pa = walkaddr(pagetable, va)) == 0 && uvmfault(p, va) == 0)
+            pa = walkaddr(pagetable, va);
+        mmunlock(p);
+    }
+    return pa;
+}
+
+// mm 的页表中 n 页被换出(n < 0)或换入(n > 0)，由 swap.c 调用
+void uvmresident(struct mm* mm, long n) {
+    __atomic_add_fetch(&mm->acct[ACCT_RSS], (uint64)n, __ATOMIC_RELAXED);
+}
+
+// 地址空间的记账：驻留的页数、页表页数和缺页次数
+void uvmacct(struct mm* mm, struct procinfo* pi) {
+    pi->rss = acctget(mm, ACCT_RSS);
+    pi->ptpages = acctget(mm, ACCT_PTPAGES);
+    pi->minflt = acctget(mm, ACCT_MINFLT);
+    pi->majflt = acctget(mm, ACCT_MAJFLT);
+}
+
+// 汇总虚拟内存的事件计数
+void vmstat(struct sysinfo* info) {
+    info->cowfault = vmcount.cowfault;
+    info->cowcopy = vmcount.cowcopy;
+    info->lazyfault = vmcount.lazyfault;
+    info->copyhit = vmcount.copyhit;
+    info->copymiss = vmcount.copymiss;
+}
+
 // mark a PTE invalid for user access.
 // used by exec for the user stack guard page.
 void uvmclear(pagetable_t pagetable, uint64 va) {
@@ -346,35 +759,154 @@ void uvmclear(pagetable_t pagetable, uint64 va) {
     if (pte == 0)
         panic("uvmclear");
     *pte &= ~PTE_U;
+    acct(pagetable, ACCT_RSS, -1); // 只统计用户可以访问的页
+    uvmchanged(pagetable, 1);
 }
 
-// Copy from kernel to user.
-// Copy len bytes from src to virtual address dstva in a given page table.
-// Return 0 on success, -1 on error.
-int copyout(pagetable_t pagetable, uint64 dstva, char* src, uint64 len) {
-    uint64 n, va0, pa0;
+// 用户内存中的一个字里是否有 0 字节
+#define HASZERO(w) (((w) - 0x0101010101010101UL) & ~(w) & 0x8080808080808080UL)
+
+// copyin/copyout 翻译用户页 va：write 时要求可写，先处理写时复制并记下
+// 脏页。当前进程的页表的最近一次翻译缓存在 p->cc 中，页表变化时
+// tlbstale() 把它作废。返回物理地址，不可访问时返回 0。
+//
+// 页表被几个线程共用时，另一个线程可能在复制的同时去掉这一页并释放它。
+// 这时不用翻译缓存，而是在 mm->lock 内确认映射仍然是这一页并给它加一个
+// 引用，*pin 返回要在复制之后 kfree() 的物理页(没有加引用时为 0)。
+// uvmchanged() 收回映射之后、释放物理页之前获取一次 mm->lock，
+// 所以释放的页要么已经被这样钉住，要么之后的确认会失败。
+static uint64 copyaddr(pagetable_t pagetable, uint64 va, int write, uint64* pin) {
+    struct proc* p = myproc();
+    struct copycache* cc = 0;
     pte_t* pte;
+    uint64 pa, sz;
+    int r, self = 0, shared = 0, perm;
 
-    while (len > 0) {
-        va0 = PGROUNDDOWN(dstva);
-        if (va0 >= MAXVA)
-            return -1;
-        if ((pte = walk(pagetable, va0, 0)) == 0) {
-            // printf("copyout: pte should exist 0x%x %d\n", dstva, len);
-            return -1;
+    *pin = 0;
+    if (p != 0 && p->pagetable == pagetable) {
+        self = 1;
+        shared = __atomic_load_n(&p->mm->nthread, __ATOMIC_RELAXED) > 1;
+    }
+    if (self && !shared) {
+        cc = &p->cc;
+        if (cc->perm != 0 && cc->va == va && (write == 0 || (cc->perm & PTE_W))) {
+            __atomic_add_fetch(&vmcount.copyhit, 1, __ATOMIC_RELAXED);
+            return cc->pa;
+        }
+    }
+    __atomic_add_fetch(&vmcount.copymiss, 1, __ATOMIC_RELAXED);
+
+again:
+    if (va >= MAXVA || (pa = uvmaddr(pagetable, va)) == 0)
+        return 0;
+    if (write) {
+        if ((pte = walkleaf(pagetable, va, &sz)) == 0)
+            return 0;
+
+        // 写时复制页先复制出私有的一份
+        if (*pte & PTE_COW) {
+            if (!self) {
+                r = uvmcow(pagetable, va);
+            } else if (p->ilocks) {
+                p->faultskip = 1; // 同 uvmaddr()，不在 inode 锁内获取 mmlock()
+                r = -1;
+            } else if ((r = mmlock(p)) == 0) {
+                // 另一个线程可能已经复制或去掉了这一页
+                if ((pte = walkleaf(pagetable, va, &sz)) == 0)
+                    r = -1;
+                else if (*pte & PTE_COW)
+                    r = uvmcow(pagetable, va);
+                mmunlock(p);
+            }
+            if (r < 0)
+                return 0;
+            if ((pte = walkleaf(pagetable, va, &sz)) == 0) // 大页可能已经被拆开
+                return 0;
         }
 
         // forbid copyout over read-only user text pages.
         if ((*pte & PTE_W) == 0)
+            return 0;
+        *pte |= PTE_D; // 和用户态写入一样记下脏页，munmap 据此写回
+        pa = walkaddr(pagetable, va);
+    }
+    if (shared) {
+        perm = PTE_V | PTE_U | (write ? PTE_W : 0);
+        acquire(&p->mm->lock);
+        pte = walkleaf(pagetable, va, &sz);
+        if (pte != 0 && (*pte & perm) == perm && PTE2PA(*pte) + (va & (sz - 1)) == pa) {
+            *pin = PTE2PA(*pte); // 大页的引用计数在它的第一页上
+            kdup((void*)*pin);
+        }
+        release(&p->mm->lock);
+        if (*pin == 0) {
+            // 映射刚刚被别的线程改了，重新翻译；去掉了的话 uvmaddr() 会失败
+            if (pte != 0 && (*pte & perm) == perm)
+                goto again;
+            return 0;
+        }
+        return pa;
+    }
+    if (cc != 0) {
+        cc->va = va;
+        cc->pa = pa;
+        cc->perm = write ? PTE_R | PTE_W : PTE_R;
+    }
+    return pa;
+}
+
+// 放开 copyaddr() 钉住的页
+static void copydone(uint64 pin) {
+    if (pin != 0)
+        kfree((void*)pin);
+}
+
+// 让当前进程 [va, va+n) 的页就位，write 不为 0 时还要可写(先解除写时复制)。
+// 处理缺页会睡眠、会获取 mmlock() 和 inode 锁，持有自旋锁或 inode 锁的
+// copyin/copyout 调用者要在加锁前调用。都可以访问时返回 0，遇到不可访问的页
+// 就停下、返回 -1，错误也可以留给之后的 copyin/copyout 报告。
+int uvmprefault(uint64 va, int n, int write) {
+    struct proc* p = myproc();
+    uint64 a, pin;
+
+    if (n <= 0)
+        return 0;
+    for (a = PGROUNDDOWN(va); a < va + n; a += PGSIZE) {
+        if (a >= MAXVA || copyaddr(p->pagetable, a, write, &pin) == 0)
             return -1;
+        copydone(pin);
+    }
+    return 0;
+}
+
+// 用户地址 va 的物理地址，供 futex 直接读这个字。先处理缺页，write 不为 0
+// 时还要可写(先解除写时复制)。不可访问时返回 0。*pin 不为 0 时是
+// copyaddr() 钉住的页，用完后 kfree()。
+uint64 useraddr(pagetable_t pagetable, uint64 va, int write, uint64* pin) {
+    uint64 va0 = PGROUNDDOWN(va), pa;
 
-        pa0 = walkaddr(pagetable, va0);
+    *pin = 0;
+    if (va0 >= MAXVA || (pa = copyaddr(pagetable, va0, write, pin)) == 0)
+        return 0;
+    return pa + (va - va0);
+}
+
+// Copy from kernel to user.
+// Copy len bytes from src to virtual address dstva in a given page table.
+// Return 0 on success, -1 on error.
+int copyout(pagetable_t pagetable, uint64 dstva, char* src, uint64 len) {
+    uint64 n, va0, pa0, pin;
+
+    while (len > 0) {
+        va0 = PGROUNDDOWN(dstva);
+        pa0 = copyaddr(pagetable, va0, 1, &pin);
         if (pa0 == 0)
             return -1;
         n = PGSIZE - (dstva - va0);
         if (n > len)
             n = len;
         memmove((void*)(pa0 + (dstva - va0)), src, n);
+        copydone(pin);
 
         len -= n;
         src += n;
@@ -387,17 +919,18 @@ int copyout(pagetable_t pagetable, uint64 dstva, char* src, uint64 len) {
 // Copy len bytes to dst from virtual address srcva in a given page table.
 // Return 0 on success, -1 on error.
 int copyin(pagetable_t pagetable, char* dst, uint64 srcva, uint64 len) {
-    uint64 n, va0, pa0;
+    uint64 n, va0, pa0, pin;
 
     while (len > 0) {
         va0 = PGROUNDDOWN(srcva);
-        pa0 = walkaddr(pagetable, va0);
+        pa0 = copyaddr(pagetable, va0, 0, &pin);
         if (pa0 == 0)
             return -1;
         n = PGSIZE - (srcva - va0);
         if (n > len)
             n = len;
         memmove(dst, (void*)(pa0 + (srcva - va0)), n);
+        copydone(pin);
 
         len -= n;
         dst += n;
@@ -406,17 +939,27 @@ int copyin(pagetable_t pagetable, char* dst, uint64 srcva, uint64 len) {
     return 0;
 }
 
+// 依次完成 n 段 copyin，用于把用户数据分散复制到几块内核内存
+// (比如管道的环形缓冲区绕回的两段)。相邻的段多半在同一用户页上，
+// 只有第一段需要查页表。全部成功返回 0，否则返回 -1。
+int copyin_batch(pagetable_t pagetable, struct copyseg* segs, int n) {
+    for (int i = 0; i < n; i++)
+        if (copyin(pagetable, segs[i].dst, segs[i].va, segs[i].len) < 0)
+            return -1;
+    return 0;
+}
+
 // Copy a null-terminated string from user to kernel.
 // Copy bytes to dst from virtual address srcva in a given page table,
 // until a '\0', or max.
 // Return 0 on success, -1 on error.
 int copyinstr(pagetable_t pagetable, char* dst, uint64 srcva, uint64 max) {
-    uint64 n, va0, pa0;
+    uint64 n, va0, pa0, pin;
     int got_null = 0;
 
     while (got_null == 0 && max > 0) {
         va0 = PGROUNDDOWN(srcva);
-        pa0 = walkaddr(pagetable, va0);
+        pa0 = copyaddr(pagetable, va0, 0, &pin);
         if (pa0 == 0)
             return -1;
         n = PGSIZE - (srcva - va0);
@@ -424,6 +967,16 @@ int copyinstr(pagetable_t pagetable, char* dst, uint64 srcva, uint64 max) {
             n = max;
 
         char* p = (char*)(pa0 + (srcva - va0));
+        // 两边同样对齐时按字复制，直到遇到含 0 字节的字
+        if ((((uint64)p ^ (uint64)dst) & 7) == 0) {
+            for (; n > 0 && ((uint64)p & 7) != 0 && *p != '\0'; n--, max--)
+                *dst++ = *p++;
+            for (; n >= 8 && ((uint64)p & 7) == 0 && !HASZERO(*(uint64*)p); n -= 8, max -= 8) {
+                *(uint64*)dst = *(uint64*)p;
+                dst += 8;
+                p += 8;
+            }
+        }
         while (n > 0) {
             if (*p == '\0') {
                 *dst = '\0';
@@ -437,6 +990,7 @@ int copyinstr(pagetable_t pagetable, char* dst, uint64 srcva, uint64 max) {
             p++;
             dst++;
         }
+        copydone(pin);
 
         srcva = va0 + PGSIZE;
     }
@@ -447,11 +1001,86 @@ int copyinstr(pagetable_t pagetable, char* dst, uint64 srcva, uint64 max) {
     }
 }
 
-#ifdef LAB_PGTBL
-void vmprint(pagetable_t pagetable) {
-    // your code here
+static void vmprintwalk(pagetable_t pagetable, int level, uint64 va) {
+    for (int i = 0; i < 512; i++) {
+        pte_t pte = pagetable[i];
+        uint64 a = va | ((uint64)i << PXSHIFT(level));
+
+        if ((pte & PTE_V) == 0)
+            continue;
+        for (int l = level; l <= 2; l++)
+            printf(" ..");
+        printf("%p: pte %p pa %p", (void*)a, (void*)pte, (void*)PTE2PA(pte));
+        if (PTE_LEAF(pte) && level > 0)
+            printf(" (%dM)", 1 << (PXSHIFT(level) - 20));
+        printf("\n");
+        if (!PTE_LEAF(pte))
+            vmprintwalk((pagetable_t)PTE2PA(pte), level - 1, a);
+    }
+}
+
+// 页表的汇总
+struct vmsum {
+    int tables[3]; // 各级页表页数
+    int leaves[3]; // 各种大小的叶子数
+    int user;      // 用户可以访问的 4KB 页数
+    int shared;    // 其中和其他进程或缓存共用的页数
+};
+
+static void vmsumwalk(pagetable_t pagetable, int level, struct vmsum* sum) {
+    sum->tables[level]++;
+    for (int i = 0; i < 512; i++) {
+        pte_t pte = pagetable[i];
+        int n = 1 << (PXSHIFT(level) - PGSHIFT);
+
+        if ((pte & PTE_V) == 0)
+            continue;
+        if (!PTE_LEAF(pte)) {
+            vmsumwalk((pagetable_t)PTE2PA(pte), level - 1, sum);
+            continue;
+        }
+        sum->leaves[level]++;
+        if ((pte & PTE_U) == 0)
+            continue;
+        sum->user += n;
+        if (krefcnt((void*)PTE2PA(pte)) > 1)
+            sum->shared += n;
+    }
+}
+
+// exec 或 fork 把新建的页表接到 mm 上：数一遍其中的用户页和页表页，
+// 作为之后增量记账的起点。缺页次数从 0 开始。
+void uvmrecount(pagetable_t pagetable, struct mm* mm) {
+    struct vmsum sum;
+
+    memset(&sum, 0, sizeof(sum));
+    vmsumwalk(pagetable, 2, &sum);
+    __atomic_store_n(&mm->acct[ACCT_RSS], sum.user, __ATOMIC_RELAXED);
+    __atomic_store_n(&mm->acct[ACCT_PTPAGES], sum.tables[0] + sum.tables[1] + sum.tables[2],
+                     __ATOMIC_RELAXED);
+    __atomic_store_n(&mm->acct[ACCT_MINFLT], 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&mm->acct[ACCT_MAJFLT], 0, __ATOMIC_RELAXED);
+}
+
+// 打印页表的所有有效 PTE，大页的叶子标出大小。mm 不为 0 时只打印一行
+// 汇总，并和 mm 中增量维护的记账对照。
+void vmprint(pagetable_t pagetable, struct mm* mm) {
+    struct vmsum sum;
+
+    if (mm == 0) {
+        printf("page table %p\n", pagetable);
+        vmprintwalk(pagetable, 2, 0);
+        return;
+    }
+    memset(&sum, 0, sizeof(sum));
+    vmsumwalk(pagetable, 2, &sum);
+    printf("page table %p: %d tables (%d/%d/%d), %d 4K + %d 2M leaves, %d user, %d shared; "
+           "counted rss %d, tables %d, faults %d minor %d major\n",
+           pagetable, sum.tables[0] + sum.tables[1] + sum.tables[2], sum.tables[2],
+           sum.tables[1], sum.tables[0], sum.leaves[0], sum.leaves[1], sum.user, sum.shared,
+           (int)acctget(mm, ACCT_RSS), (int)acctget(mm, ACCT_PTPAGES),
+           (int)acctget(mm, ACCT_MINFLT), (int)acctget(mm, ACCT_MAJFLT));
 }
-#endif
 
 #ifdef LAB_PGTBL
 pte_t*
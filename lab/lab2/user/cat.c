@@ -8,6 +8,18 @@ void
 cat(int fd)
 {
   int n;
+  uint size;
+  char *p;
+
+  // regular files are mapped and written out in one go
+  if((p = mapfile(fd, &size)) != 0){
+    if(write(1, p, size) != size){
+      fprintf(2, "cat: write error\n");
+      exit(1);
+    }
+    munmap(p, size);
+    return;
+  }
 
   while((n = read(fd, buf, sizeof(buf))) > 0) {
     if (write(1, buf, n) != n) {
@@ -0,0 +1,70 @@
+// 测量系统调用复制用户数据的吞吐量：不同大小的 write/read 经过管道，
+// 以及 copyin/copyout 翻译缓存的命中情况
+
+#include "kernel/types.h"
+#include "kernel/sysinfo.h"
+#include "user/user.h"
+
+#define TOTAL (4 * 1024 * 1024) // 每种大小传输的字节数
+
+static char buf[4096];
+
+static void info(struct sysinfo* si) {
+    if (sysinfo(si) < 0) {
+        fprintf(2, "copybench: sysinfo failed\n");
+        exit(1);
+    }
+}
+
+// 子进程以 size 字节为单位从管道读 total 字节，父进程写。返回用的 tick 数。
+static int run(int size, int total) {
+    int fds[2], pid, n, t0, t1;
+
+    if (pipe(fds) < 0) {
+        fprintf(2, "copybench: pipe failed\n");
+        exit(1);
+    }
+    pid = fork();
+    if (pid < 0) {
+        fprintf(2, "copybench: fork failed\n");
+        exit(1);
+    }
+    if (pid == 0) {
+        close(fds[1]);
+        while ((n = read(fds[0], buf, size)) > 0)
+            ;
+        exit(0);
+    }
+    close(fds[0]);
+    t0 = uptime();
+    for (n = 0; n < total; n += size) {
+        if (write(fds[1], buf, size) != size) {
+            fprintf(2, "copybench: write failed\n");
+            exit(1);
+        }
+    }
+    close(fds[1]);
+    wait(0);
+    t1 = uptime();
+    return t1 - t0;
+}
+
+int main(int argc, char* argv[]) {
+    static int sizes[] = {1, 16, 128, 512, 4096};
+    struct sysinfo before, after;
+    int i, size, total, t;
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        size = sizes[i];
+        total = size == 1 ? TOTAL / 64 : TOTAL; // 单字节太慢，少传一些
+        info(&before);
+        t = run(size, total);
+        info(&after);
+        if (t == 0)
+            t = 1;
+        printf("%d-byte syscalls: %d KB in %d ticks, %d KB/tick, cache hits %ld, misses %ld\n",
+               size, total / 1024, t, total / 1024 / t,
+               after.copyhit - before.copyhit, after.copymiss - before.copymiss);
+    }
+    exit(0);
+}
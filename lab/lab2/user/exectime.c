@@ -0,0 +1,50 @@
+// 运行一个命令，报告期间 exec 的次数、exec 到第一条用户指令的平均延迟，
+// 以及按需从可执行文件读入的页数。
+// 比如 exectime usertests -q；grind 不会退出，可以 grind & 之后用 freemem 查看。
+
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/sysinfo.h"
+#include "user/user.h"
+
+#define CYCLES_PER_US 10 // qemu 的 time 是 10MHz
+
+static void info(struct sysinfo* si) {
+    if (sysinfo(si) < 0) {
+        fprintf(2, "exectime: sysinfo failed\n");
+        exit(1);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    struct sysinfo before, after;
+    uint64 n;
+    int pid;
+
+    if (argc < 2) {
+        fprintf(2, "Usage: exectime command [args...]\n");
+        exit(1);
+    }
+
+    info(&before);
+    pid = fork();
+    if (pid < 0) {
+        fprintf(2, "exectime: fork failed\n");
+        exit(1);
+    }
+    if (pid == 0) {
+        exec(argv[1], argv + 1);
+        fprintf(2, "exectime: exec %s failed\n", argv[1]);
+        exit(1);
+    }
+    wait(0);
+    info(&after);
+
+    n = after.execs - before.execs;
+    printf("%s: %ld execs", argv[1], n);
+    if (n > 0)
+        printf(", avg %ld us to first instruction",
+               (after.execcycles - before.execcycles) / n / CYCLES_PER_US);
+    printf(", %ld pages read on demand\n", after.pagein - before.pagein);
+    exit(0);
+}
@@ -0,0 +1,77 @@
+// 测量大堆进程 fork 的延迟和内存占用
+
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "kernel/sysinfo.h"
+#include "user/user.h"
+
+#define HEAPMB 16
+#define NFORK 50
+
+static void info(struct sysinfo* si) {
+    if (sysinfo(si) < 0) {
+        fprintf(2, "forkbench: sysinfo failed\n");
+        exit(1);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    struct sysinfo before, during, after;
+    int heap = HEAPMB * 1024 * 1024;
+    int i, pid, t0, t1, fds[2];
+    char* p;
+    char c;
+
+    if (argc > 1)
+        heap = atoi(argv[1]) * 1024 * 1024;
+
+    p = sbrk(heap);
+    if (p == (char*)-1) {
+        fprintf(2, "forkbench: sbrk %d failed\n", heap);
+        exit(1);
+    }
+    for (i = 0; i < heap; i += PGSIZE)
+        p[i] = i;
+
+    // 子进程存活期间的内存占用
+    info(&before);
+    if (pipe(fds) < 0) {
+        fprintf(2, "forkbench: pipe failed\n");
+        exit(1);
+    }
+    pid = fork();
+    if (pid < 0) {
+        fprintf(2, "forkbench: fork failed\n");
+        exit(1);
+    }
+    if (pid == 0) {
+        close(fds[1]);
+        read(fds[0], &c, 1);
+        exit(0);
+    }
+    close(fds[0]);
+    info(&during);
+    close(fds[1]);
+    wait(0);
+    printf("heap %d KB: fork used %ld KB\n", heap / 1024,
+           (before.freemem - during.freemem) / 1024);
+
+    // fork + exit + wait 的平均延迟
+    info(&before);
+    t0 = uptime();
+    for (i = 0; i < NFORK; i++) {
+        pid = fork();
+        if (pid < 0) {
+            fprintf(2, "forkbench: fork failed\n");
+            exit(1);
+        }
+        if (pid == 0)
+            exit(0);
+        wait(0);
+    }
+    t1 = uptime();
+    info(&after);
+    printf("%d forks: %d ticks, cow faults %ld, cow copies %ld\n", NFORK, t1 - t0,
+           after.cowfault - before.cowfault, after.cowcopy - before.cowcopy);
+    exit(0);
+}
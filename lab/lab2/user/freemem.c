@@ -1,9 +1,52 @@
-
 #include "kernel/types.h"
+#include "kernel/sysinfo.h"
 #include "user/user.h"
 
+#define SUPERORDER 9 // 2MB 的块
+
 int main() {
-    int freebytes = freemem();
-    printf("Free memory: %d bytes (%d KB)\n", freebytes, freebytes / 1024);
+    struct sysinfo info;
+    uint64 inblk = 0, big = 0;
+    int k;
+
+    if (sysinfo(&info) < 0) {
+        fprintf(2, "freemem: sysinfo failed\n");
+        exit(1);
+    }
+    printf("Free memory: %ld bytes (%ld KB)\n", info.freemem, info.freemem / 1024);
+    printf("Used memory: %ld KB, peak: %ld KB\n", info.usedmem / 1024, info.peakmem / 1024);
+
+    // 碎片报告：各阶空闲块数，以及能满足 2MB 分配的空闲内存占比
+    printf("order  blocks\n");
+    for (k = 0; k <= MAXORDER; k++) {
+        printf("%d\t%ld\n", k, info.freeblk[k]);
+        inblk += info.freeblk[k] << k;
+        if (k >= SUPERORDER)
+            big += info.freeblk[k] << k;
+    }
+    printf("per-cpu cached: %ld pages\n", info.freemem / 4096 - inblk - info.zeropool);
+    printf("pre-zeroed: %ld pages, hits: %ld, misses: %ld\n",
+           info.zeropool, info.zerohit, info.zeromiss);
+    if (info.freemem > 0)
+        printf("free memory in >=2MB blocks: %ld%%\n", big * 4096 * 100 / info.freemem);
+    printf("cow faults: %ld (copies %ld), lazy faults: %ld\n",
+           info.cowfault, info.cowcopy, info.lazyfault);
+    if (info.execs > 0)
+        printf("execs: %ld, avg %ld cycles to first instruction, pages read on demand: %ld\n",
+               info.execs, info.execcycles / info.execs, info.pagein);
+    printf("page cache: %ld pages mapped %ld times, hits: %ld, misses: %ld\n",
+           info.pcpages, info.pcmaps, info.pchit, info.pcmiss);
+    printf("swap: %ld/%ld pages used, page-outs: %ld, page-ins: %ld, major faults: %ld\n",
+           info.swapused, info.swapsize, info.pageout, info.swappagein, info.majfault);
+    printf("ASIDs: %ld, returns to user: %ld, TLB flushes: %ld\n",
+           info.nasid, info.uret, info.tlbflush);
+    printf("clock interrupts: %ld, IPIs: %ld\n", info.nclock, info.nipi);
+    printf("scheduler: %s\n", info.schedpolicy ? "mlfq" : "round robin");
+    if (info.nsched > 0)
+        printf("scheduled %ld times, avg wait %ld us, steals: %ld\n",
+               info.nsched, info.schedwait / info.nsched / 10, info.steal); // time 是 10MHz
+    printf("copyin/copyout pages: %ld cached, %ld looked up\n", info.copyhit, info.copymiss);
+    printf("kmem locks: %ld, contended: %ld, steals: %ld\n",
+           info.kmem_lock, info.kmem_contend, info.kmem_steal);
     exit(0);
 }
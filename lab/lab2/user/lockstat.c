@@ -0,0 +1,46 @@
+// 列出争用最多的几类自旋锁：lockstat [n]，默认 10 类。
+// 同名的锁算作一类，按等待时读锁的次数排序。之后列出各类睡眠锁，
+// 等待中只靠自旋就拿到锁的次数是 CONTEND 减去 SLEEP。
+
+#include "kernel/types.h"
+#include "kernel/sysinfo.h"
+#include "user/user.h"
+
+#define NCLASS 80
+#define CYCLES_PER_US 10 // qemu 的 time 是 10MHz
+
+static char* tab(char* name) {
+    return strlen(name) < 8 ? "\t" : "";
+}
+
+int main(int argc, char* argv[]) {
+    static struct lockstat ls[NCLASS];
+    struct lockstat t;
+    int i, j, n, nspin, top;
+
+    top = argc > 1 ? atoi(argv[1]) : 10;
+    if ((n = lockstat(ls, NCLASS)) < 0) {
+        fprintf(2, "lockstat: lockstat failed\n");
+        exit(1);
+    }
+    for (nspin = 0; nspin < n && !ls[nspin].sleeplock; nspin++)
+        ;
+    // 插入排序，类不多
+    for (i = 1; i < nspin; i++) {
+        t = ls[i];
+        for (j = i; j > 0 && ls[j - 1].nspin < t.nspin; j--)
+            ls[j] = ls[j - 1];
+        ls[j] = t;
+    }
+    printf("NAME\t\tACQUIRE\tCONTEND\tSPIN\tHOLD(us)\n");
+    for (i = 0; i < nspin && i < top; i++)
+        printf("%s\t%s%ld\t%ld\t%ld\t%ld\n", ls[i].name, tab(ls[i].name), ls[i].nacquire,
+               ls[i].ncontend, ls[i].nspin, ls[i].holdtime / CYCLES_PER_US);
+
+    printf("\nSLEEP LOCK\tACQUIRE\tCONTEND\tSLEEP\tWAIT(us)\tHOLD(us)\n");
+    for (i = nspin; i < n; i++)
+        printf("%s\t%s%ld\t%ld\t%ld\t%ld\t\t%ld\n", ls[i].name, tab(ls[i].name), ls[i].nacquire,
+               ls[i].ncontend, ls[i].nsleep, ls[i].waittime / CYCLES_PER_US,
+               ls[i].holdtime / CYCLES_PER_US);
+    exit(0);
+}
@@ -0,0 +1,58 @@
+// 两个进程通过一对管道来回传一个字节，测量上下文切换的开销
+// 以及回到用户态时清除 TLB 的次数
+
+#include "kernel/types.h"
+#include "kernel/sysinfo.h"
+#include "user/user.h"
+
+#define N 10000
+
+static void info(struct sysinfo* si) {
+    if (sysinfo(si) < 0) {
+        fprintf(2, "pingpong: sysinfo failed\n");
+        exit(1);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    struct sysinfo before, after;
+    int n = N, i, pid, t0, t1;
+    int p2c[2], c2p[2];
+    char c = 'A';
+
+    if (argc > 1)
+        n = atoi(argv[1]);
+    if (pipe(p2c) < 0 || pipe(c2p) < 0) {
+        fprintf(2, "pingpong: pipe failed\n");
+        exit(1);
+    }
+    pid = fork();
+    if (pid < 0) {
+        fprintf(2, "pingpong: fork failed\n");
+        exit(1);
+    }
+    if (pid == 0) {
+        for (i = 0; i < n; i++) {
+            if (read(p2c[0], &c, 1) != 1 || write(c2p[1], &c, 1) != 1)
+                exit(1);
+        }
+        exit(0);
+    }
+
+    info(&before);
+    t0 = uptime();
+    for (i = 0; i < n; i++) {
+        if (write(p2c[1], &c, 1) != 1 || read(c2p[0], &c, 1) != 1) {
+            fprintf(2, "pingpong: round trip %d failed\n", i);
+            exit(1);
+        }
+    }
+    t1 = uptime();
+    info(&after);
+    wait(0);
+
+    printf("%d round trips: %d ticks\n", n, t1 - t0);
+    printf("ASIDs: %ld, returns to user: %ld, TLB flushes: %ld\n", after.nasid,
+           after.uret - before.uret, after.tlbflush - before.tlbflush);
+    exit(0);
+}
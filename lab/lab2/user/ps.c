@@ -0,0 +1,28 @@
+// 列出进程及其内存占用：驻留内存、页表页和缺页次数
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/sysinfo.h"
+#include "user/user.h"
+
+static char* states[] = {"unused", "used", "sleep", "runble", "run", "zombie"};
+
+int main(int argc, char* argv[]) {
+    static struct procinfo pi[NPROC];
+    int i, n;
+    char* state;
+
+    if ((n = procinfo(pi, NPROC)) < 0) {
+        fprintf(2, "ps: procinfo failed\n");
+        exit(1);
+    }
+    printf("PID\tSTATE\tSZ(KB)\tRSS(KB)\tPT\tMINFLT\tMAJFLT\tNAME\n");
+    for (i = 0; i < n; i++) {
+        state = pi[i].state >= 0 && pi[i].state < sizeof(states) / sizeof(states[0])
+                    ? states[pi[i].state]
+                    : "???";
+        printf("%d\t%s\t%ld\t%ld\t%ld\t%ld\t%ld\t%s\n", pi[i].pid, state, pi[i].sz / 1024,
+               pi[i].rss * 4, pi[i].ptpages, pi[i].minflt, pi[i].majflt, pi[i].name);
+    }
+    exit(0);
+}
@@ -0,0 +1,86 @@
+// 多线程求和：1、2、4、8 个线程(clone)把同一个数组分段求和，报告用时和
+// 相对单线程的加速比。线程共用地址空间，数组只分配、填写一次。
+// 用 make CPUS=8 qemu 运行。
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+#define N (2 * 1024 * 1024) // 数组元素个数，16MB
+#define ROUNDS 4            // 每个线程把自己的一段求和的遍数
+#define MAXT 8
+
+// 每个线程的一段和结果，各占一个 cache line，免得互相干扰
+struct part {
+    uint64* a;
+    int lo, hi;
+    uint64 sum;
+    char pad[40];
+};
+
+static struct part parts[MAXT];
+
+static void sum(void* arg) {
+    struct part* pt = arg;
+    uint64 s = 0;
+
+    for (int r = 0; r < ROUNDS; r++)
+        for (int i = pt->lo; i < pt->hi; i++)
+            s += pt->a[i];
+    pt->sum = s;
+}
+
+// k 个线程求和，返回用时(ns)，和存入 *total
+static uint64 run(uint64* a, int k, uint64* total) {
+    int tids[MAXT];
+    uint64 t0, t1;
+    int i;
+
+    t0 = nanouptime();
+    for (i = 0; i < k; i++) {
+        parts[i].a = a;
+        parts[i].lo = (uint64)N * i / k;
+        parts[i].hi = (uint64)N * (i + 1) / k;
+        // 第 0 段由当前线程自己算
+        if (i > 0 && (tids[i] = thread_create(sum, &parts[i])) < 0) {
+            fprintf(2, "psum: thread_create failed\n");
+            exit(1);
+        }
+    }
+    sum(&parts[0]);
+    *total = parts[0].sum;
+    for (i = 1; i < k; i++) {
+        if (thread_join(tids[i]) != tids[i]) {
+            fprintf(2, "psum: thread_join failed\n");
+            exit(1);
+        }
+        *total += parts[i].sum;
+    }
+    t1 = nanouptime();
+    return t1 - t0;
+}
+
+int main(void) {
+    uint64 *a, total, want, base = 0, t;
+    int i, k;
+
+    if ((a = (uint64*)sbrkeager(N * sizeof(uint64))) == (uint64*)-1) {
+        fprintf(2, "psum: out of memory\n");
+        exit(1);
+    }
+    for (i = 0; i < N; i++)
+        a[i] = i;
+    want = (uint64)N * (N - 1) / 2 * ROUNDS;
+
+    printf("threads\tms\tspeedup\n");
+    for (k = 1; k <= MAXT; k *= 2) {
+        t = run(a, k, &total);
+        if (total != want) {
+            fprintf(2, "psum: %d threads: sum %ld, want %ld\n", k, total, want);
+            exit(1);
+        }
+        if (k == 1)
+            base = t;
+        printf("%d\t%ld\t%ld.%ld\n", k, t / 1000000, base / t, base * 10 / t % 10);
+    }
+    exit(0);
+}
@@ -0,0 +1,77 @@
+// 只读系统调用的并行扩展性：1、2、4、8 个进程同时反复调用 kill(不存在的
+// pid)、uptime 和 sysinfo，报告每毫秒完成的总调用数。这些调用只读进程表
+// 和文件页缓存，总吞吐量应随进程数增长。用 make CPUS=8 qemu 运行。
+
+#include "kernel/types.h"
+#include "kernel/sysinfo.h"
+#include "user/user.h"
+
+#define NCALL 20000      // 每个进程的调用次数
+#define NOPID 0x7fffffff // 不存在的 pid
+
+static void dokill(void) {
+    if (kill(NOPID) != -1) {
+        fprintf(2, "rwbench: kill(%d) succeeded\n", NOPID);
+        exit(1);
+    }
+}
+
+static void douptime(void) {
+    uptime();
+}
+
+static void dosysinfo(void) {
+    struct sysinfo si;
+
+    if (sysinfo(&si) < 0) {
+        fprintf(2, "rwbench: sysinfo failed\n");
+        exit(1);
+    }
+}
+
+// k 个进程各调用 NCALL 次 call()，返回每毫秒完成的总调用数
+static uint64 run(void (*call)(void), int k) {
+    uint64 t0, t1;
+    int i, pid;
+
+    t0 = nanouptime();
+    for (i = 0; i < k; i++) {
+        pid = fork();
+        if (pid < 0) {
+            fprintf(2, "rwbench: fork failed\n");
+            exit(1);
+        }
+        if (pid == 0) {
+            for (int j = 0; j < NCALL; j++)
+                call();
+            exit(0);
+        }
+    }
+    for (i = 0; i < k; i++)
+        wait(0);
+    t1 = nanouptime();
+    return (uint64)k * NCALL * 1000000 / (t1 - t0 + 1);
+}
+
+int main(void) {
+    static struct {
+        char* name;
+        void (*call)(void);
+    } ops[] = {
+        {"kill", dokill},
+        {"uptime", douptime},
+        {"sysinfo", dosysinfo},
+    };
+    int i, k;
+
+    printf("calls/ms\t1\t2\t4\t8\n");
+    for (i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+        printf("%s\t", ops[i].name);
+        if (strlen(ops[i].name) < 8)
+            printf("\t");
+        for (k = 1; k <= 8; k *= 2)
+            printf("%ld\t", run(ops[i].call, k));
+        printf("\n");
+    }
+    exit(0);
+}
@@ -0,0 +1,110 @@
+// 调度器的吞吐量和延迟：几个进程并行地 fork+exit+wait，几个进程并行地
+// 计算，报告用的 tick 数、平均调度延迟和偷取次数。给出命令时改为报告
+// 运行这个命令期间的调度统计，比如 schedbench usertests -q。
+// 在不同的 CPU 数下比较：make CPUS=1 qemu、make CPUS=4 qemu、make CPUS=8 qemu；
+// 和全局队列比较时在 CFLAGS 中加上 -DRUNQGLOBAL 重新编译内核(见 proc.c)。
+
+#include "kernel/types.h"
+#include "kernel/sysinfo.h"
+#include "user/user.h"
+
+#define CYCLES_PER_US 10 // qemu 的 time 是 10MHz
+#define NWORKER 8        // 并行的进程数
+#define NFORK 100        // 每个进程 fork 的次数
+#define NSPIN 20000000   // 每个计算进程的循环次数
+
+static void info(struct sysinfo* si) {
+    if (sysinfo(si) < 0) {
+        fprintf(2, "schedbench: sysinfo failed\n");
+        exit(1);
+    }
+}
+
+static void report(char* what, int ticks, struct sysinfo* before, struct sysinfo* after) {
+    uint64 n = after->nsched - before->nsched;
+
+    printf("%s: %d ticks, %ld dispatches, avg wait %ld us, steals %ld\n", what, ticks, n,
+           n ? (after->schedwait - before->schedwait) / n / CYCLES_PER_US : 0,
+           after->steal - before->steal);
+}
+
+// NWORKER 个进程并行运行 work()，等它们都结束
+static void parallel(void (*work)(void)) {
+    int i, pid;
+
+    for (i = 0; i < NWORKER; i++) {
+        pid = fork();
+        if (pid < 0) {
+            fprintf(2, "schedbench: fork failed\n");
+            exit(1);
+        }
+        if (pid == 0) {
+            work();
+            exit(0);
+        }
+    }
+    for (i = 0; i < NWORKER; i++)
+        wait(0);
+}
+
+static void forker(void) {
+    int pid;
+
+    for (int i = 0; i < NFORK; i++) {
+        pid = fork();
+        if (pid < 0) {
+            fprintf(2, "schedbench: fork failed\n");
+            exit(1);
+        }
+        if (pid == 0)
+            exit(0);
+        wait(0);
+    }
+}
+
+static void spinner(void) {
+    volatile int x = 0;
+
+    for (int i = 0; i < NSPIN; i++)
+        x += i;
+}
+
+static void run(char* what, void (*work)(void)) {
+    struct sysinfo before, after;
+    int t0, t1;
+
+    info(&before);
+    t0 = uptime();
+    parallel(work);
+    t1 = uptime();
+    info(&after);
+    report(what, t1 - t0, &before, &after);
+}
+
+int main(int argc, char* argv[]) {
+    struct sysinfo before, after;
+    int pid, t0;
+
+    if (argc < 2) {
+        run("fork+exit+wait", forker);
+        run("compute", spinner);
+        exit(0);
+    }
+
+    info(&before);
+    t0 = uptime();
+    pid = fork();
+    if (pid < 0) {
+        fprintf(2, "schedbench: fork failed\n");
+        exit(1);
+    }
+    if (pid == 0) {
+        exec(argv[1], argv + 1);
+        fprintf(2, "schedbench: exec %s failed\n", argv[1]);
+        exit(1);
+    }
+    wait(0);
+    info(&after);
+    report(argv[1], uptime() - t0, &before, &after);
+    exit(0);
+}
@@ -13,7 +13,7 @@ sinfo(struct sysinfo *info) {
 }
 
 //
-// use sbrk() to count how many free physical memory pages there are.
+// use sbrkeager() to count how many free physical memory pages there are.
 //
 int
 countfree()
@@ -23,7 +23,7 @@ countfree()
   int n = 0;
 
   while(1){
-    if((uint64)sbrk(PGSIZE) == 0xffffffffffffffff){
+    if((uint64)sbrkeager(PGSIZE) == 0xffffffffffffffff){
       break;
     }
     n += PGSIZE;
@@ -50,7 +50,7 @@ testmem() {
     exit(1);
   }
   
-  if((uint64)sbrk(PGSIZE) == 0xffffffffffffffff){
+  if((uint64)sbrkeager(PGSIZE) == 0xffffffffffffffff){
     printf("sbrk failed");
     exit(1);
   }
@@ -0,0 +1,206 @@
+// threads on top of clone() and join().
+// every thread runs on its own malloc()ed stack, which
+// thread_join() frees. malloc() and free() are not
+// thread-safe, so thread_create() and thread_join() call
+// them under a private lock; threads that allocate memory
+// themselves must do the same.
+//
+// struct lock spins. mutexes, condition variables and
+// barriers sleep in the kernel with futex_wait() when they
+// have to wait, and only use atomic instructions otherwise.
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "user/user.h"
+
+#define TSTACK (4*4096) // 每个线程的栈
+
+// 放在线程栈顶，start() 由它找到要运行的函数
+struct start {
+  void (*fn)(void*);
+  void *arg;
+};
+
+static struct lock tlock;
+static struct {
+  int tid;
+  char *stack;
+} stacks[NPROC];
+
+void
+lock_init(struct lock *lk)
+{
+  lk->locked = 0;
+}
+
+void
+lock_acquire(struct lock *lk)
+{
+  while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
+    ;
+  __sync_synchronize();
+}
+
+void
+lock_release(struct lock *lk)
+{
+  __sync_synchronize();
+  __sync_lock_release(&lk->locked);
+}
+
+static void
+start(void *a)
+{
+  struct start *s = a;
+
+  s->fn(s->arg);
+  exit(0);
+}
+
+// run fn(arg) in a new thread. returns its thread id, or -1.
+int
+thread_create(void (*fn)(void*), void *arg)
+{
+  struct start *s;
+  char *stack;
+  int i, tid = -1;
+
+  // 持有 tlock 直到记下栈，thread_join() 不会找不到它
+  lock_acquire(&tlock);
+  for(i = 0; i < NPROC; i++)
+    if(stacks[i].stack == 0)
+      break;
+  if(i < NPROC && (stack = malloc(TSTACK)) != 0){
+    s = (struct start*)(stack + TSTACK) - 1;
+    s->fn = fn;
+    s->arg = arg;
+    if((tid = clone(start, s, s)) < 0){
+      free(stack);
+    } else {
+      stacks[i].tid = tid;
+      stacks[i].stack = stack;
+    }
+  }
+  lock_release(&tlock);
+  return tid;
+}
+
+// wait for thread tid (any thread if tid is 0) to exit
+// and free its stack. returns its thread id, or -1.
+int
+thread_join(int tid)
+{
+  int i;
+
+  if((tid = join(tid, 0)) < 0)
+    return -1;
+  lock_acquire(&tlock);
+  for(i = 0; i < NPROC; i++){
+    if(stacks[i].stack != 0 && stacks[i].tid == tid){
+      free(stacks[i].stack);
+      stacks[i].stack = 0;
+      break;
+    }
+  }
+  lock_release(&tlock);
+  return tid;
+}
+
+// mutex after Drepper, "Futexes Are Tricky": unlock only
+// calls futex_wake() when state 2 says someone may sleep.
+void
+mutex_init(struct mutex *m)
+{
+  m->state = 0;
+}
+
+void
+mutex_lock(struct mutex *m)
+{
+  int c = 0;
+
+  if(__atomic_compare_exchange_n(&m->state, &c, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    return;
+  // 有竞争：标记为有等待者再睡眠，醒来后同样以 2 获取
+  if(c != 2)
+    c = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+  while(c != 0){
+    futex_wait(&m->state, 2);
+    c = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+  }
+}
+
+void
+mutex_unlock(struct mutex *m)
+{
+  if(__atomic_fetch_sub(&m->state, 1, __ATOMIC_RELEASE) != 1){
+    __atomic_store_n(&m->state, 0, __ATOMIC_RELEASE);
+    futex_wake(&m->state, 1);
+  }
+}
+
+void
+cond_init(struct cond *c)
+{
+  c->seq = 0;
+  c->nwait = 0;
+}
+
+// atomically release m and wait for a signal, then
+// reacquire m. wakeups may be spurious; recheck the
+// condition in a loop.
+void
+cond_wait(struct cond *c, struct mutex *m)
+{
+  int seq;
+
+  // 放开 m 之前读出 seq：之后的 signal 都会改变它，futex_wait 不会错过
+  seq = __atomic_load_n(&c->seq, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&c->nwait, 1, __ATOMIC_SEQ_CST);
+  mutex_unlock(m);
+  futex_wait(&c->seq, seq);
+  __atomic_sub_fetch(&c->nwait, 1, __ATOMIC_RELAXED);
+  mutex_lock(m);
+}
+
+void
+cond_signal(struct cond *c)
+{
+  __atomic_add_fetch(&c->seq, 1, __ATOMIC_SEQ_CST);
+  if(__atomic_load_n(&c->nwait, __ATOMIC_SEQ_CST) > 0)
+    futex_wake(&c->seq, 1);
+}
+
+void
+cond_broadcast(struct cond *c)
+{
+  __atomic_add_fetch(&c->seq, 1, __ATOMIC_SEQ_CST);
+  if(__atomic_load_n(&c->nwait, __ATOMIC_SEQ_CST) > 0)
+    futex_wake(&c->seq, NPROC);
+}
+
+void
+barrier_init(struct barrier *b, int n)
+{
+  b->n = n;
+  b->count = 0;
+  b->gen = 0;
+}
+
+// wait until n threads have called barrier_wait() in this
+// round. the last one to arrive starts the next round.
+void
+barrier_wait(struct barrier *b)
+{
+  int gen = __atomic_load_n(&b->gen, __ATOMIC_ACQUIRE);
+
+  if(__atomic_add_fetch(&b->count, 1, __ATOMIC_ACQ_REL) == b->n){
+    __atomic_store_n(&b->count, 0, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&b->gen, 1, __ATOMIC_RELEASE);
+    if(b->n > 1)
+      futex_wake(&b->gen, b->n - 1);
+    return;
+  }
+  while(__atomic_load_n(&b->gen, __ATOMIC_ACQUIRE) == gen)
+    futex_wait(&b->gen, gen);
+}
@@ -0,0 +1,60 @@
+// 比较 4KB 页和 2MB 大页映射同一块堆内存时的访问速度。
+// 每一轮按页的步长访问整块内存一次，访问的页数远多于 TLB 的表项数。
+// 用法：tlbbench [MB [轮数]]
+
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define MB (1024 * 1024)
+
+// 把堆顶对齐到 2MB，这样之后的分配才能用上大页
+static void align(void) {
+    uint64 top = (uint64)sbrk(0);
+
+    if (top % SUPERPGSIZE != 0 && sbrk(SUPERPGROUNDUP(top) - top) == (char*)-1) {
+        fprintf(2, "tlbbench: sbrk failed\n");
+        exit(1);
+    }
+}
+
+static int run(char* p, int size, int rounds) {
+    volatile char* q = p;
+    int t0, r, i;
+
+    t0 = uptime();
+    for (r = 0; r < rounds; r++)
+        for (i = 0; i < size; i += PGSIZE)
+            q[i]++;
+    return uptime() - t0;
+}
+
+int main(int argc, char* argv[]) {
+    int size = 16 * MB, rounds = 200;
+    int t4k, t2m;
+    char* p;
+
+    if (argc > 1)
+        size = atoi(argv[1]) * MB;
+    if (argc > 2)
+        rounds = atoi(argv[2]);
+
+    align();
+    if ((p = sbrkeager(size)) == (char*)-1) {
+        fprintf(2, "tlbbench: sbrkeager %d failed\n", size);
+        exit(1);
+    }
+    t4k = run(p, size, rounds);
+    sbrk(-size);
+
+    if ((p = sbrksuper(size)) == (char*)-1) {
+        fprintf(2, "tlbbench: sbrksuper %d failed\n", size);
+        exit(1);
+    }
+    t2m = run(p, size, rounds);
+    sbrk(-size);
+
+    printf("%d MB x %d rounds: 4KB pages %d ticks, 2MB pages %d ticks\n",
+           size / MB, rounds, t4k, t2m);
+    exit(0);
+}
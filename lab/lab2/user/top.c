@@ -0,0 +1,72 @@
+// 每秒显示一次各进程的 MLFQ 优先级和 CPU 占用。CPU 占用是这一秒内的运行
+// 时间占一个 CPU 的百分比，WAIT 是这一秒内在运行队列中等待的时间。
+// top [次数]，默认显示 5 次。
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/sysinfo.h"
+#include "user/user.h"
+
+#define CYCLES_PER_MS 10000 // qemu 的 time 是 10MHz
+#define INTERVAL 10         // 采样间隔 (tick)
+
+static char* states[] = {"unused", "used", "sleep", "runble", "run", "zombie"};
+
+static struct procinfo cur[NPROC], prev[NPROC];
+static int ncur, nprev;
+
+static void sample(void) {
+    memmove(prev, cur, sizeof(cur[0]) * ncur);
+    nprev = ncur;
+    if ((ncur = procinfo(cur, NPROC)) < 0) {
+        fprintf(2, "top: procinfo failed\n");
+        exit(1);
+    }
+}
+
+// 上一次采样中的同一个进程，新出现的进程返回 0
+static struct procinfo* before(int pid) {
+    for (int i = 0; i < nprev; i++)
+        if (prev[i].pid == pid)
+            return &prev[i];
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    struct sysinfo si;
+    struct procinfo *p, *b;
+    int i, n, t0, t1;
+    uint64 run, wait, span;
+    char* state;
+
+    n = argc > 1 ? atoi(argv[1]) : 5;
+    if (sysinfo(&si) < 0) {
+        fprintf(2, "top: sysinfo failed\n");
+        exit(1);
+    }
+    sample();
+    t0 = uptime();
+    while (n-- > 0) {
+        sleep(INTERVAL);
+        sample();
+        t1 = uptime();
+        span = (uint64)(t1 - t0) * TICKCYCLES;
+        t0 = t1;
+
+        printf("\n%s, %d processes\n", si.schedpolicy ? "mlfq" : "round robin", ncur);
+        printf("PID\tSTATE\tLEVEL\t%%CPU\tWAIT(ms)\tRUN(ms)\tNAME\n");
+        for (i = 0; i < ncur; i++) {
+            p = &cur[i];
+            b = before(p->pid);
+            run = p->runtime - (b ? b->runtime : 0);
+            wait = p->waittime - (b ? b->waittime : 0);
+            state = p->state >= 0 && p->state < sizeof(states) / sizeof(states[0])
+                        ? states[p->state]
+                        : "???";
+            printf("%d\t%s\t%d\t%ld\t%ld\t\t%ld\t%s\n", p->pid, state, p->level,
+                   span ? run * 100 / span : 0, wait / CYCLES_PER_MS,
+                   p->runtime / CYCLES_PER_MS, p->name);
+        }
+    }
+    exit(0);
+}
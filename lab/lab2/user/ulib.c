@@ -1,8 +1,15 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "kernel/fcntl.h"
+#include "kernel/syscall.h"
 #include "user/user.h"
 
+// memset/memmove/memcmp/strlen 按 8 字节的字处理，和 kernel/string.c 一样；
+// 用 make BYTESTRING=1 编译时改用逐字节的循环。
+#define ONES 0x0101010101010101UL
+#define HASZERO(w) (((w) - ONES) & ~(w) & (ONES << 7))
+#define ALIGNED(p) (((uint64)(p) & 7) == 0)
+
 //
 // wrapper so that it's OK if main() does not call exit().
 //
@@ -36,21 +43,48 @@ strcmp(const char *p, const char *q)
 uint
 strlen(const char *s)
 {
+#ifdef BYTESTRING
   int n;
 
   for(n = 0; s[n]; n++)
     ;
   return n;
+#else
+  const char *p = s;
+
+  for(; !ALIGNED(p); p++)
+    if(*p == 0)
+      return p - s;
+  for(; !HASZERO(*(uint64*)p); p += 8)
+    ;
+  for(; *p; p++)
+    ;
+  return p - s;
+#endif
 }
 
 void*
 memset(void *dst, int c, uint n)
 {
   char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
+#ifndef BYTESTRING
+  uint64 w = (uchar)c * ONES;
+
+  if(n >= 8){
+    for(; !ALIGNED(cdst); n--)
+      *cdst++ = c;
+    for(; n >= 32; n -= 32, cdst += 32){
+      ((uint64*)cdst)[0] = w;
+      ((uint64*)cdst)[1] = w;
+      ((uint64*)cdst)[2] = w;
+      ((uint64*)cdst)[3] = w;
+    }
+    for(; n >= 8; n -= 8, cdst += 8)
+      *(uint64*)cdst = w;
   }
+#endif
+  while(n-- > 0)
+    *cdst++ = c;
   return dst;
 }
 
@@ -114,12 +148,58 @@ memmove(void *vdst, const void *vsrc, int n)
 
   dst = vdst;
   src = vsrc;
+#ifndef BYTESTRING
+  // 两边对 8 的余数相同时按字复制，每次先读出 4 个字再写
+  uint64 w0, w1, w2, w3;
+  int words = n >= 8 && ((uint64)src & 7) == ((uint64)dst & 7);
+#endif
   if (src > dst) {
+#ifndef BYTESTRING
+    if(words){
+      for(; !ALIGNED(dst); n--)
+        *dst++ = *src++;
+      for(; n >= 32; n -= 32, dst += 32, src += 32){
+        w0 = ((uint64*)src)[0];
+        w1 = ((uint64*)src)[1];
+        w2 = ((uint64*)src)[2];
+        w3 = ((uint64*)src)[3];
+        ((uint64*)dst)[0] = w0;
+        ((uint64*)dst)[1] = w1;
+        ((uint64*)dst)[2] = w2;
+        ((uint64*)dst)[3] = w3;
+      }
+      for(; n >= 8; n -= 8, dst += 8, src += 8)
+        *(uint64*)dst = *(uint64*)src;
+    }
+#endif
     while(n-- > 0)
       *dst++ = *src++;
   } else {
     dst += n;
     src += n;
+#ifndef BYTESTRING
+    if(words){
+      for(; !ALIGNED(dst); n--)
+        *--dst = *--src;
+      for(; n >= 32; n -= 32){
+        dst -= 32;
+        src -= 32;
+        w0 = ((uint64*)src)[0];
+        w1 = ((uint64*)src)[1];
+        w2 = ((uint64*)src)[2];
+        w3 = ((uint64*)src)[3];
+        ((uint64*)dst)[3] = w3;
+        ((uint64*)dst)[2] = w2;
+        ((uint64*)dst)[1] = w1;
+        ((uint64*)dst)[0] = w0;
+      }
+      for(; n >= 8; n -= 8){
+        dst -= 8;
+        src -= 8;
+        *(uint64*)dst = *(uint64*)src;
+      }
+    }
+#endif
     while(n-- > 0)
       *--dst = *--src;
   }
@@ -130,6 +210,16 @@ int
 memcmp(const void *s1, const void *s2, uint n)
 {
   const char *p1 = s1, *p2 = s2;
+#ifndef BYTESTRING
+  // 跳过相同的字，再逐字节找出第一个不同的字节
+  if(n >= 8 && ((uint64)p1 & 7) == ((uint64)p2 & 7)){
+    for(; !ALIGNED(p1) && *p1 == *p2; n--)
+      p1++, p2++;
+    if(ALIGNED(p1))
+      for(; n >= 8 && *(uint64*)p1 == *(uint64*)p2; n -= 8)
+        p1 += 8, p2 += 8;
+  }
+#endif
   while (n-- > 0) {
     if (*p1 != *p2) {
       return *p1 - *p2;
@@ -145,3 +235,44 @@ memcpy(void *dst, const void *src, uint n)
 {
   return memmove(dst, src, n);
 }
+
+// grow the heap lazily: pages are allocated on first touch.
+char *
+sbrk(int n)
+{
+  return sys_sbrk(n, SBRK_LAZY);
+}
+
+// grow the heap and allocate the pages now, so that running
+// out of memory shows up as a failed sbrkeager().
+char *
+sbrkeager(int n)
+{
+  return sys_sbrk(n, SBRK_EAGER);
+}
+
+// like sbrkeager(), but the 2MB-aligned parts of the new memory
+// are mapped with superpages when possible.
+char *
+sbrksuper(int n)
+{
+  return sys_sbrk(n, SBRK_SUPER);
+}
+
+// map the whole of an open regular file read-only and store its
+// size in *size. returns 0 if fd is not a non-empty regular file
+// or the mapping fails; the caller then falls back to read().
+char *
+mapfile(int fd, uint *size)
+{
+  struct stat st;
+  char *p;
+
+  if(fstat(fd, &st) < 0 || st.type != T_FILE || st.size == 0)
+    return 0;
+  p = mmap(0, st.size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if(p == MAP_FAILED)
+    return 0;
+  *size = st.size;
+  return p;
+}
@@ -1,4 +1,28 @@
 struct stat;
+struct sysinfo;
+struct lockstat;
+struct procinfo;
+
+// spinlock for threads, see thread.c
+struct lock {
+  uint locked;
+};
+
+// sleeping synchronization on top of futex_wait/futex_wake, see thread.c
+struct mutex {
+  int state; // 0 unlocked, 1 locked, 2 locked with waiters
+};
+
+struct cond {
+  int seq;   // bumped by every signal
+  int nwait; // waiters, signals skip the kernel when 0
+};
+
+struct barrier {
+  int n;     // threads per round
+  int count; // arrived in this round
+  int gen;   // bumped when a round completes
+};
 
 // system calls
 int fork(void);
@@ -19,11 +43,22 @@ int mkdir(const char*);
 int chdir(const char*);
 int dup(int);
 int getpid(void);
-char* sbrk(int);
+char* sys_sbrk(int, int);
 int sleep(int);
 int uptime(void);
 int freemem(void);
 int trace(int);
+int sysinfo(struct sysinfo*);
+void* mmap(void*, uint64, int, int, int, uint64);
+int munmap(void*, uint64);
+int procinfo(struct procinfo*, int);
+int nanosleep(uint64);
+uint64 nanouptime(void);
+int lockstat(struct lockstat*, int);
+int clone(void (*)(void*), void*, void*);
+int join(int, int*);
+int futex_wait(int*, int);
+int futex_wake(int*, int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -39,6 +74,26 @@ void* memset(void*, int, uint);
 int atoi(const char*);
 int memcmp(const void*, const void*, uint);
 void* memcpy(void*, const void*, uint);
+char* sbrk(int);
+char* sbrkeager(int);
+char* sbrksuper(int);
+char* mapfile(int, uint*);
+
+// thread.c
+int thread_create(void (*)(void*), void*);
+int thread_join(int);
+void lock_init(struct lock*);
+void lock_acquire(struct lock*);
+void lock_release(struct lock*);
+void mutex_init(struct mutex*);
+void mutex_lock(struct mutex*);
+void mutex_unlock(struct mutex*);
+void cond_init(struct cond*);
+void cond_wait(struct cond*, struct mutex*);
+void cond_signal(struct cond*);
+void cond_broadcast(struct cond*);
+void barrier_init(struct barrier*, int);
+void barrier_wait(struct barrier*);
 
 // umalloc.c
 void* malloc(uint);
@@ -7,6 +7,7 @@
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/sysinfo.h"
 
 //
 // Tests xv6 system calls.  usertests without arguments runs them all
@@ -2465,6 +2466,1025 @@ void badarg(char* s) {
     exit(0);
 }
 
+// copy-on-write fork: writes by the child, including writes done
+// by the kernel through copyout(), must not show up in the parent.
+void cowfork(char* s) {
+    enum { N = 16 };
+    char* p = sbrk(N * 4096);
+    int fds[2], i, xstatus;
+
+    if (p == (char*)-1) {
+        printf("%s: sbrk failed\n", s);
+        exit(1);
+    }
+    for (i = 0; i < N * 4096; i += 4096)
+        p[i] = 'p';
+    p[4096 + 1] = 0;
+
+    if (pipe(fds) != 0) {
+        printf("%s: pipe failed\n", s);
+        exit(1);
+    }
+    int pid = fork();
+    if (pid < 0) {
+        printf("%s: fork failed\n", s);
+        exit(1);
+    }
+    if (pid == 0) {
+        for (i = 0; i < N * 4096; i += 4096) {
+            if (p[i] != 'p')
+                exit(1);
+            p[i] = 'c';
+        }
+        // the kernel writes into a shared page
+        write(fds[1], "k", 1);
+        if (read(fds[0], p + 4096 + 1, 1) != 1 || p[4096 + 1] != 'k')
+            exit(1);
+        exit(0);
+    }
+    wait(&xstatus);
+    if (xstatus != 0) {
+        printf("%s: child saw wrong data\n", s);
+        exit(1);
+    }
+    for (i = 0; i < N * 4096; i += 4096) {
+        if (p[i] != 'p' || p[4096 + 1] == 'k') {
+            printf("%s: child's write visible in parent\n", s);
+            exit(1);
+        }
+    }
+    close(fds[0]);
+    close(fds[1]);
+}
+
+// program text is read in from the executable on demand; it must
+// still be read-only, and data the kernel reads from not-yet-touched
+// text (a string literal passed to write) must arrive intact.
+void textwrite(char* s) {
+    static char msg[] = "textwrite";
+    int fds[2], pid, xstatus;
+    char buf[sizeof(msg)];
+
+    if (pipe(fds) < 0) {
+        printf("%s: pipe failed\n", s);
+        exit(1);
+    }
+    if (write(fds[1], "textwrite", sizeof(msg)) != sizeof(msg) ||
+        read(fds[0], buf, sizeof(buf)) != sizeof(buf) || strcmp(buf, msg) != 0) {
+        printf("%s: wrong data through pipe\n", s);
+        exit(1);
+    }
+    close(fds[0]);
+    close(fds[1]);
+
+    pid = fork();
+    if (pid < 0) {
+        printf("%s: fork failed\n", s);
+        exit(1);
+    }
+    if (pid == 0) {
+        volatile int* addr = (int*)textwrite;
+        *addr = 10;
+        exit(1);
+    }
+    wait(&xstatus);
+    if (xstatus != -1) // did the kernel kill the child?
+        exit(1);
+}
+
+// 运行中的程序按需读入代码页，它的文件不能打开来写；
+// 打开来写的文件也不能被 exec。
+void textbusy(char* s) {
+    char* args[] = {"echo", 0};
+    int fd, pid, xstatus;
+
+    if ((fd = open("usertests", O_RDWR)) >= 0) {
+        printf("%s: opened running executable for writing\n", s);
+        exit(1);
+    }
+    if ((fd = open("echo", O_RDWR)) < 0) {
+        printf("%s: open echo failed\n", s);
+        exit(1);
+    }
+    pid = fork();
+    if (pid < 0) {
+        printf("%s: fork failed\n", s);
+        exit(1);
+    }
+    if (pid == 0) {
+        close(1);
+        exec("echo", args);
+        exit(7);
+    }
+    wait(&xstatus);
+    close(fd);
+    if (xstatus != 7) {
+        printf("%s: exec of a file open for writing succeeded\n", s);
+        exit(1);
+    }
+}
+
+// a second run of the same binary should map the text pages the
+// first run read in, instead of reading its own copy.
+void sharedtext(char* s) {
+    struct sysinfo before, after;
+    char* args[] = {"echo", 0};
+    int i, pid, xstatus;
+
+    for (i = 0; i < 2; i++) {
+        if (sysinfo(&before) < 0) {
+            printf("%s: sysinfo failed\n", s);
+            exit(1);
+        }
+        pid = fork();
+        if (pid < 0) {
+            printf("%s: fork failed\n", s);
+            exit(1);
+        }
+        if (pid == 0) {
+            close(1);
+            exec("echo", args);
+            exit(1);
+        }
+        wait(&xstatus);
+        if (xstatus != 0) {
+            printf("%s: exec echo failed\n", s);
+            exit(1);
+        }
+    }
+    if (sysinfo(&after) < 0) {
+        printf("%s: sysinfo failed\n", s);
+        exit(1);
+    }
+    if (after.pchit == before.pchit) {
+        printf("%s: second exec did not share text pages\n", s);
+        exit(1);
+    }
+}
+
+// memory from sbrksuper() is mapped with 2MB pages; it must survive
+// a copy-on-write fork and a shrink that splits a superpage.
+void superpage(char* s) {
+    enum { N = 2 * SUPERPGSIZE };
+    uint64 top = (uint64)sbrk(0);
+    int i, pid, xstatus;
+    char* p;
+
+    if (top % SUPERPGSIZE != 0 && sbrk(SUPERPGROUNDUP(top) - top) == (char*)-1) {
+        printf("%s: sbrk failed\n", s);
+        exit(1);
+    }
+    if ((p = sbrksuper(N)) == (char*)-1) {
+        printf("%s: sbrksuper failed\n", s);
+        exit(1);
+    }
+    for (i = 0; i < N; i += PGSIZE)
+        p[i] = i / PGSIZE;
+
+    pid = fork();
+    if (pid < 0) {
+        printf("%s: fork failed\n", s);
+        exit(1);
+    }
+    if (pid == 0) {
+        for (i = 0; i < N; i += PGSIZE)
+            p[i] = 'c';
+        exit(0);
+    }
+    wait(&xstatus);
+    if (xstatus != 0)
+        exit(1);
+    for (i = 0; i < N; i += PGSIZE) {
+        if (p[i] != (char)(i / PGSIZE)) {
+            printf("%s: child's write visible in parent\n", s);
+            exit(1);
+        }
+    }
+
+    // cut the second superpage in half
+    sbrk(-(SUPERPGSIZE / 2));
+    for (i = 0; i < N - SUPERPGSIZE / 2; i += PGSIZE) {
+        if (p[i] != (char)(i / PGSIZE)) {
+            printf("%s: data lost after shrink\n", s);
+            exit(1);
+        }
+    }
+    sbrk(-(N - SUPERPGSIZE / 2));
+}
+
+// writes through a MAP_SHARED mapping reach the file on munmap and are
+// seen by a forked child; writes to a MAP_PRIVATE mapping are not.
+void mmaptest(char* s) {
+    enum { N = 2 * PGSIZE + 100 };
+    char* f = "mmapfile";
+    char buf[16];
+    int fd, i, pid, xstatus;
+    char* p;
+
+    unlink(f);
+    if ((fd = open(f, O_CREATE | O_RDWR)) < 0) {
+        printf("%s: create %s failed\n", s, f);
+        exit(1);
+    }
+    for (i = 0; i < N; i++) {
+        buf[0] = 'a' + i % 26;
+        if (write(fd, buf, 1) != 1) {
+            printf("%s: write failed\n", s);
+            exit(1);
+        }
+    }
+
+    p = mmap(0, N, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        printf("%s: mmap shared failed\n", s);
+        exit(1);
+    }
+    close(fd);
+    for (i = 0; i < N; i++) {
+        if (p[i] != 'a' + i % 26) {
+            printf("%s: mapped content wrong at %d\n", s, i);
+            exit(1);
+        }
+    }
+    if (p[N] != 0) {
+        printf("%s: bytes past end of file not zero\n", s);
+        exit(1);
+    }
+    p[0] = 'X';
+    p[PGSIZE] = 'Y';
+
+    pid = fork();
+    if (pid < 0) {
+        printf("%s: fork failed\n", s);
+        exit(1);
+    }
+    if (pid == 0) {
+        if (p[0] != 'X')
+            exit(1);
+        p[1] = 'Z';
+        exit(0);
+    }
+    wait(&xstatus);
+    if (xstatus != 0 || p[1] != 'Z') {
+        printf("%s: shared mapping not shared with child\n", s);
+        exit(1);
+    }
+    if (munmap(p, N) < 0) {
+        printf("%s: munmap failed\n", s);
+        exit(1);
+    }
+
+    if ((fd = open(f, O_RDONLY)) < 0) {
+        printf("%s: open %s failed\n", s, f);
+        exit(1);
+    }
+    if (read(fd, buf, 2) != 2 || buf[0] != 'X' || buf[1] != 'Z') {
+        printf("%s: shared writes not written back\n", s);
+        exit(1);
+    }
+
+    // a read-only fd cannot be mapped shared and writable, but can be
+    // mapped private and writable
+    if (mmap(0, N, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) != MAP_FAILED) {
+        printf("%s: writable shared mapping of read-only fd\n", s);
+        exit(1);
+    }
+    p = mmap(0, N, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) {
+        printf("%s: mmap private failed\n", s);
+        exit(1);
+    }
+    if (p[PGSIZE] != 'Y') {
+        printf("%s: shared writes not written back\n", s);
+        exit(1);
+    }
+    p[0] = 'Q';
+    munmap(p, N);
+    close(fd);
+    if ((fd = open(f, O_RDONLY)) < 0 || read(fd, buf, 1) != 1 || buf[0] != 'X') {
+        printf("%s: private write reached the file\n", s);
+        exit(1);
+    }
+    close(fd);
+    unlink(f);
+}
+
+// touch more memory than is free; the excess must go to the swap area
+// and come back intact.
+void swaptest(char* s) {
+    struct sysinfo before, after;
+    int i, n;
+    char* p;
+
+    if (sysinfo(&before) < 0) {
+        printf("%s: sysinfo failed\n", s);
+        exit(1);
+    }
+    if (before.swapsize - before.swapused < 512) {
+        printf("%s: not enough swap space, skipping\n", s);
+        return;
+    }
+    n = before.freemem + 1024 * 1024;
+    if ((p = sbrk(n)) == (char*)-1) {
+        printf("%s: sbrk %d failed\n", s, n);
+        exit(1);
+    }
+    for (i = 0; i < n; i += PGSIZE)
+        *(int*)(p + i) = i;
+    for (i = 0; i < n; i += PGSIZE) {
+        if (*(int*)(p + i) != i) {
+            printf("%s: page at %d lost its contents\n", s, i);
+            exit(1);
+        }
+    }
+    if (sysinfo(&after) < 0) {
+        printf("%s: sysinfo failed\n", s);
+        exit(1);
+    }
+    if (after.pageout == before.pageout || after.majfault == before.majfault) {
+        printf("%s: nothing was swapped\n", s);
+        exit(1);
+    }
+    sbrk(-n);
+}
+
+// copyin/copyout 按字复制：各种对齐、跨页的缓冲区经过管道后内容不变，
+// 跨页的路径名能被 copyinstr 正确读入
+void copyaligntest(char* s) {
+    static char name[] = "copyalignfile";
+    int fds[2], src, dst, len, fd, i;
+    char *buf, *out;
+
+    buf = sbrk(3 * PGSIZE);
+    if (buf == (char*)-1) {
+        printf("%s: sbrk failed\n", s);
+        exit(1);
+    }
+    buf = (char*)PGROUNDUP((uint64)buf);
+    out = buf + PGSIZE;
+    if (pipe(fds) < 0) {
+        printf("%s: pipe failed\n", s);
+        exit(1);
+    }
+    for (src = 0; src < 8; src++) {
+        for (dst = 0; dst < 8; dst++) {
+            for (len = 1; len <= 300; len += 37) {
+                // 源缓冲区跨越 buf 和 out 之间的页边界
+                char* from = out - 150 + src;
+                for (i = 0; i < len; i++)
+                    from[i] = src * 31 + dst * 7 + i;
+                if (write(fds[1], from, len) != len) {
+                    printf("%s: write failed\n", s);
+                    exit(1);
+                }
+                char* to = buf + dst;
+                memset(to, 0, len + 8);
+                if (read(fds[0], to, len) != len) {
+                    printf("%s: read failed\n", s);
+                    exit(1);
+                }
+                for (i = 0; i < len; i++) {
+                    if (to[i] != (char)(src * 31 + dst * 7 + i)) {
+                        printf("%s: src %d dst %d len %d: byte %d wrong\n", s, src, dst, len, i);
+                        exit(1);
+                    }
+                }
+                if (to[len] != 0) {
+                    printf("%s: wrote past the end\n", s);
+                    exit(1);
+                }
+            }
+        }
+    }
+    close(fds[0]);
+    close(fds[1]);
+
+    for (src = 0; src < sizeof(name); src++) {
+        char* path = out - src;
+        strcpy(path, name);
+        if ((fd = open(path, O_CREATE | O_RDWR)) < 0) {
+            printf("%s: open failed with the name %d bytes before a page boundary\n", s, src);
+            exit(1);
+        }
+        close(fd);
+        if ((fd = open(name, O_RDONLY)) < 0) {
+            printf("%s: file created under the wrong name\n", s);
+            exit(1);
+        }
+        close(fd);
+        unlink(name);
+    }
+    sbrk(-3 * PGSIZE);
+}
+
+// ulib 中按字处理的 memset/memmove/memcmp/strlen 在各种对齐、长度和重叠下
+// 和逐字节的结果一致
+void ulibstringtest(char* s) {
+    static char a[512], b[512];
+    int x, y, n, i;
+
+    for (n = 0; n < 200; n += 13) {
+        for (x = 0; x < 8; x++) {
+            for (y = 0; y < 8; y++) {
+                for (i = 0; i < sizeof(a); i++)
+                    a[i] = b[i] = i * 7 + x;
+                memmove(a + 16 + x, a + 40 + y, n);
+                for (i = 0; i < n; i++)
+                    b[16 + x + i] = b[40 + y + i];
+                memmove(a + 280 + y, a + 256 + x, n);
+                for (i = n - 1; i >= 0; i--)
+                    b[280 + y + i] = b[256 + x + i];
+                for (i = 0; i < sizeof(a); i++) {
+                    if (a[i] != b[i]) {
+                        printf("%s: memmove(%d, %d, %d) wrong at %d\n", s, x, y, n, i);
+                        exit(1);
+                    }
+                }
+                if (memcmp(a + x, b + x, n) != 0) {
+                    printf("%s: memcmp of equal buffers\n", s);
+                    exit(1);
+                }
+                if (n > 0) {
+                    b[x + (n * 3 + y) % n] ^= 1;
+                    if (memcmp(a + x, b + x, n) == 0) {
+                        printf("%s: memcmp missed a difference\n", s);
+                        exit(1);
+                    }
+                }
+            }
+            memset(a + x, 'z', n);
+            a[x + n] = 0;
+            for (i = 0; i < n; i++) {
+                if (a[x + i] != 'z') {
+                    printf("%s: memset(%d, %d) wrong\n", s, x, n);
+                    exit(1);
+                }
+            }
+            if (strlen(a + x) != n) {
+                printf("%s: strlen(%d, %d) wrong\n", s, x, n);
+                exit(1);
+            }
+        }
+    }
+}
+
+// 本进程在 procinfo() 中的统计
+static void myprocinfo(char* s, struct procinfo* me) {
+    static struct procinfo pi[NPROC];
+    int i, n, pid = getpid();
+
+    if ((n = procinfo(pi, NPROC)) < 0) {
+        printf("%s: procinfo failed\n", s);
+        exit(1);
+    }
+    for (i = 0; i < n; i++) {
+        if (pi[i].pid == pid) {
+            *me = pi[i];
+            return;
+        }
+    }
+    printf("%s: procinfo did not list pid %d\n", s, pid);
+    exit(1);
+}
+
+// 访问懒分配的堆使驻留页数和次缺页数增加，释放后驻留页数回落
+void procinfotest(char* s) {
+    struct procinfo before, touched, after;
+    int i, n = 64 * PGSIZE;
+    char* p;
+
+    myprocinfo(s, &before);
+    if (before.rss == 0 || before.ptpages < 3) {
+        printf("%s: rss %ld, page-table pages %ld\n", s, before.rss, before.ptpages);
+        exit(1);
+    }
+    if ((p = sbrk(n)) == (char*)-1) {
+        printf("%s: sbrk failed\n", s);
+        exit(1);
+    }
+    for (i = 0; i < n; i += PGSIZE)
+        p[i] = i;
+    p[n - 1] = 1; // 旧的堆顶不按页对齐时，新的 64 页中最后一页只在这里访问到
+    myprocinfo(s, &touched);
+    if (touched.rss < before.rss + 64 || touched.minflt < before.minflt + 64) {
+        printf("%s: rss %ld -> %ld, minor faults %ld -> %ld\n", s, before.rss, touched.rss,
+               before.minflt, touched.minflt);
+        exit(1);
+    }
+    sbrk(-n);
+    myprocinfo(s, &after);
+    if (after.rss != touched.rss - 64) {
+        printf("%s: rss %ld after freeing 64 pages of %ld\n", s, after.rss, touched.rss);
+        exit(1);
+    }
+}
+
+// 多个进程争用同一个 inode 的睡眠锁和日志空间。释放睡眠锁、结束文件系统
+// 操作时只唤醒一个等待者，所有进程仍应该依次拿到锁并完成。
+void sleeplocktest(char* s) {
+    enum { NCHILD = 8,
+           N = 20,
+           SZ = 2 * BSIZE };
+    char* name = "slfile";
+    int fd, i, j, pid, xstatus;
+
+    unlink(name);
+    if ((fd = open(name, O_CREATE | O_RDWR)) < 0) {
+        printf("%s: create failed\n", s);
+        exit(1);
+    }
+    memset(buf, 'x', SZ);
+    if (write(fd, buf, SZ) != SZ) {
+        printf("%s: write failed\n", s);
+        exit(1);
+    }
+    close(fd);
+
+    for (i = 0; i < NCHILD; i++) {
+        if ((pid = fork()) < 0) {
+            printf("%s: fork failed\n", s);
+            exit(1);
+        }
+        if (pid == 0) {
+            for (j = 0; j < N; j++) {
+                // 所有进程写入相同的内容，读到的总是完整的 SZ 个 'x'
+                if ((fd = open(name, O_RDONLY)) < 0 || read(fd, buf, SZ) != SZ ||
+                    buf[0] != 'x' || buf[SZ - 1] != 'x') {
+                    printf("%s: read failed\n", s);
+                    exit(1);
+                }
+                close(fd);
+                memset(buf, 'x', SZ);
+                if ((fd = open(name, O_WRONLY)) < 0 || write(fd, buf, SZ) != SZ) {
+                    printf("%s: write failed\n", s);
+                    exit(1);
+                }
+                close(fd);
+            }
+            exit(0);
+        }
+    }
+    for (i = 0; i < NCHILD; i++) {
+        wait(&xstatus);
+        if (xstatus != 0)
+            exit(xstatus);
+    }
+    unlink(name);
+}
+
+// 计算的进程应该累计运行时间；MLFQ 调度时它用完最高级的时间片后会降级。
+void schedacct(char* s) {
+    struct procinfo before, me;
+    struct sysinfo si;
+    int start = uptime();
+    volatile int i;
+
+    if (sysinfo(&si) < 0) {
+        printf("%s: sysinfo failed\n", s);
+        exit(1);
+    }
+    myprocinfo(s, &before);
+    do {
+        for (i = 0; i < 1000000; i++)
+            ;
+        myprocinfo(s, &me);
+    } while (uptime() - start < 20 && (me.level == 0 || uptime() - start < 3));
+    if (me.runtime <= before.runtime || me.level < 0 || me.level >= NMLFQ) {
+        printf("%s: runtime %ld -> %ld, level %d\n", s, before.runtime, me.runtime, me.level);
+        exit(1);
+    }
+    if (si.schedpolicy == 0 && me.level != 0) {
+        printf("%s: level %d under round robin\n", s, me.level);
+        exit(1);
+    }
+    if (si.schedpolicy == 1 && me.level == 0) {
+        printf("%s: still at the top level after spinning for 2 seconds\n", s);
+        exit(1);
+    }
+}
+
+// nanosleep 至少睡眠要求的时间；定时器按 r_time() 到期，短的睡眠不会
+// 被拖到下一个 tick。sleep(1) 仍然是一个 tick。
+void nanosleeptest(char* s) {
+    uint64 t0, t1;
+    int i;
+
+    for (i = 0; i < 10; i++) {
+        t0 = nanouptime();
+        if (nanosleep(2000000) < 0) {
+            printf("%s: nanosleep failed\n", s);
+            exit(1);
+        }
+        t1 = nanouptime();
+        if (t1 - t0 < 2000000) {
+            printf("%s: nanosleep(2ms) returned after %ld ns\n", s, t1 - t0);
+            exit(1);
+        }
+        if (t1 - t0 < 50000000) // 50ms
+            break;
+    }
+    if (i == 10) {
+        printf("%s: nanosleep(2ms) took %ld ns every time\n", s, t1 - t0);
+        exit(1);
+    }
+
+    t0 = nanouptime();
+    sleep(1);
+    t1 = nanouptime();
+    if (t1 - t0 < 100000000) {
+        printf("%s: sleep(1) returned after %ld ns\n", s, t1 - t0);
+        exit(1);
+    }
+}
+
+// lockstat() 列出各类自旋锁的统计，进程锁一定被获取过、持有过一段时间
+void lockstattest(char* s) {
+    static struct lockstat ls[64];
+    int i, n;
+
+    if ((n = lockstat(ls, 64)) <= 0) {
+        printf("%s: lockstat returned %d\n", s, n);
+        exit(1);
+    }
+    for (i = 0; i < n; i++)
+        if (strcmp(ls[i].name, "proc") == 0)
+            break;
+    if (i == n) {
+        printf("%s: no proc lock class\n", s);
+        exit(1);
+    }
+    if (ls[i].nacquire == 0 || ls[i].holdtime == 0 || ls[i].ncontend > ls[i].nacquire) {
+        printf("%s: proc locks acquired %ld, contended %ld, held %ld\n", s, ls[i].nacquire,
+               ls[i].ncontend, ls[i].holdtime);
+        exit(1);
+    }
+    if (lockstat(ls, 1) != 1) {
+        printf("%s: lockstat ignored the array size\n", s);
+        exit(1);
+    }
+}
+
+// kill() 不加锁查找进程，nproc 不加锁计数：不存在的 pid 返回 -1，
+// 子进程算在进程数里，退出并被回收后不再算
+void killpidtest(char* s) {
+    struct sysinfo before, during, after;
+    int fds[2], pid;
+    char c;
+
+    if (kill(0) != -1 || kill(-1) != -1 || kill(0x7fffffff) != -1) {
+        printf("%s: kill of a nonexistent pid succeeded\n", s);
+        exit(1);
+    }
+    if (pipe(fds) < 0) {
+        printf("%s: pipe failed\n", s);
+        exit(1);
+    }
+    sysinfo(&before);
+    pid = fork();
+    if (pid < 0) {
+        printf("%s: fork failed\n", s);
+        exit(1);
+    }
+    if (pid == 0) {
+        close(fds[1]);
+        read(fds[0], &c, 1); // 等被 kill
+        exit(0);
+    }
+    close(fds[0]);
+    sysinfo(&during);
+    if (during.nproc != before.nproc + 1) {
+        printf("%s: nproc %ld with a child, %ld before\n", s, during.nproc, before.nproc);
+        exit(1);
+    }
+    if (kill(pid) != 0) {
+        printf("%s: kill(%d) failed\n", s, pid);
+        exit(1);
+    }
+    wait(0);
+    close(fds[1]);
+    sysinfo(&after);
+    if (after.nproc != before.nproc) {
+        printf("%s: nproc %ld after wait, %ld before\n", s, after.nproc, before.nproc);
+        exit(1);
+    }
+    if (kill(pid) != -1) {
+        printf("%s: kill of a reaped pid succeeded\n", s);
+        exit(1);
+    }
+}
+
+// 几个进程同时读写同一个文件，争用它的 inode 锁。睡眠锁的统计列在
+// 自旋锁之后，等待中睡眠的次数不超过等待的次数。
+void sleeplockstattest(char* s) {
+    static struct lockstat ls[80];
+    struct stat st;
+    char buf[64];
+    int i, n, fd, pid;
+
+    unlink("slstat");
+    for (i = 0; i < 4; i++) {
+        pid = fork();
+        if (pid < 0) {
+            printf("%s: fork failed\n", s);
+            exit(1);
+        }
+        if (pid == 0) {
+            if ((fd = open("slstat", O_CREATE | O_RDWR)) < 0) {
+                printf("%s: open failed\n", s);
+                exit(1);
+            }
+            for (int j = 0; j < 200; j++) {
+                write(fd, buf, sizeof(buf));
+                fstat(fd, &st);
+            }
+            close(fd);
+            exit(0);
+        }
+    }
+    for (i = 0; i < 4; i++)
+        wait(0);
+    unlink("slstat");
+
+    if ((n = lockstat(ls, 80)) <= 0) {
+        printf("%s: lockstat returned %d\n", s, n);
+        exit(1);
+    }
+    for (i = 0; i < n; i++)
+        if (ls[i].sleeplock && strcmp(ls[i].name, "inode") == 0)
+            break;
+    if (i == n) {
+        printf("%s: no inode sleep lock class\n", s);
+        exit(1);
+    }
+    if (ls[i].nacquire < 4 * 200 || ls[i].nsleep > ls[i].ncontend ||
+        ls[i].ncontend > ls[i].nacquire || (ls[i].ncontend > 0 && ls[i].waittime == 0)) {
+        printf("%s: inode locks acquired %ld, contended %ld, slept %ld, waited %ld\n", s,
+               ls[i].nacquire, ls[i].ncontend, ls[i].nsleep, ls[i].waittime);
+        exit(1);
+    }
+    for (; i < n; i++) {
+        if (!ls[i].sleeplock) {
+            printf("%s: spin lock class %s after the sleep locks\n", s, ls[i].name);
+            exit(1);
+        }
+    }
+}
+
+// clone() 出的线程共用地址空间和文件描述符表：线程写的全局变量、线程 sbrk
+// 的内存、线程打开的文件主线程都看得到；join() 返回线程号和退出状态；
+// wait() 不回收线程；有其他线程时 exec 失败
+static volatile int threadval;
+static char* volatile threadmem;
+static int threadfds[2];
+static struct lock threadlock;
+static int threadcount;
+
+static void threadset(void* arg) {
+    threadval = (int)(uint64)arg;
+    threadmem = sbrk(PGSIZE);
+    threadmem[0] = 'x';
+    if (pipe(threadfds) < 0)
+        exit(1);
+    exit(7);
+}
+
+static void threadspin(void* arg) {
+    while (threadval != 0)
+        ;
+    exit(0);
+}
+
+static void threadadd(void* arg) {
+    for (int i = 0; i < 1000; i++) {
+        lock_acquire(&threadlock);
+        threadcount++;
+        lock_release(&threadlock);
+    }
+}
+
+void threadtest(char* s) {
+    static char stack[PGSIZE];
+    char* echoargv[] = {"echo", "OK", 0};
+    int tid, tids[4], i, st;
+    char c;
+
+    tid = clone(threadset, (void*)42, stack + sizeof(stack));
+    if (tid < 0) {
+        printf("%s: clone failed\n", s);
+        exit(1);
+    }
+    if (wait(0) != -1) {
+        printf("%s: wait reaped a thread\n", s);
+        exit(1);
+    }
+    st = 0;
+    if (join(tid, &st) != tid || st != 7) {
+        printf("%s: join returned status %d\n", s, st);
+        exit(1);
+    }
+    if (threadval != 42 || threadmem == 0 || threadmem[0] != 'x' || sbrk(0) < threadmem + PGSIZE) {
+        printf("%s: thread's writes or sbrk not visible\n", s);
+        exit(1);
+    }
+    if (join(tid, 0) != -1 || join(0, 0) != -1) {
+        printf("%s: join of a reaped thread succeeded\n", s);
+        exit(1);
+    }
+    if (write(threadfds[1], "t", 1) != 1 || read(threadfds[0], &c, 1) != 1 || c != 't') {
+        printf("%s: pipe opened by a thread not usable\n", s);
+        exit(1);
+    }
+    close(threadfds[0]);
+    close(threadfds[1]);
+
+    if ((tid = clone(threadspin, 0, stack + sizeof(stack))) < 0) {
+        printf("%s: clone failed\n", s);
+        exit(1);
+    }
+    if (exec("echo", echoargv) != -1) {
+        printf("%s: exec succeeded with another thread\n", s);
+        exit(1);
+    }
+    threadval = 0;
+    if (join(0, 0) != tid) {
+        printf("%s: join(0) failed\n", s);
+        exit(1);
+    }
+
+    lock_init(&threadlock);
+    for (i = 0; i < 4; i++) {
+        if ((tids[i] = thread_create(threadadd, 0)) < 0) {
+            printf("%s: thread_create failed\n", s);
+            exit(1);
+        }
+    }
+    for (i = 0; i < 4; i++) {
+        if (thread_join(tids[i]) != tids[i]) {
+            printf("%s: thread_join failed\n", s);
+            exit(1);
+        }
+    }
+    if (threadcount != 4000) {
+        printf("%s: count %d, want 4000\n", s, threadcount);
+        exit(1);
+    }
+}
+
+// futex_wait 在值已经改变时立即返回；没有等待者时 futex_wake 唤醒 0 个；
+// 基于 futex 的互斥锁、条件变量和屏障在多个线程间正确同步
+static struct mutex futexmutex;
+static struct cond futexcond;
+static struct barrier futexbarrier;
+static int futexcount, futexqueue, futexbad;
+
+static void futexworker(void* arg) {
+    for (int i = 0; i < 1000; i++) {
+        mutex_lock(&futexmutex);
+        futexcount++;
+        mutex_unlock(&futexmutex);
+    }
+    for (int r = 1; r <= 20; r++) {
+        barrier_wait(&futexbarrier);
+        if (__atomic_load_n(&futexcount, __ATOMIC_RELAXED) != 4000 + (r - 1) * 4)
+            futexbad = 1; // 屏障没有等齐所有线程
+        barrier_wait(&futexbarrier);
+        mutex_lock(&futexmutex);
+        futexcount++;
+        mutex_unlock(&futexmutex);
+        barrier_wait(&futexbarrier);
+    }
+    for (int i = 0; i < 100; i++) {
+        mutex_lock(&futexmutex);
+        while (futexqueue == 0)
+            cond_wait(&futexcond, &futexmutex);
+        futexqueue--;
+        mutex_unlock(&futexmutex);
+    }
+}
+
+void futextest(char* s) {
+    static int word;
+    int i, tids[4];
+
+    word = 1;
+    if (futex_wait(&word, 0) != -1) {
+        printf("%s: futex_wait slept on a changed value\n", s);
+        exit(1);
+    }
+    if (futex_wake(&word, 1) != 0) {
+        printf("%s: futex_wake woke a thread without waiters\n", s);
+        exit(1);
+    }
+    if (futex_wait((int*)((char*)&word + 1), 0) != -1) {
+        printf("%s: futex_wait accepted an unaligned address\n", s);
+        exit(1);
+    }
+
+    mutex_init(&futexmutex);
+    cond_init(&futexcond);
+    barrier_init(&futexbarrier, 4);
+    for (i = 0; i < 4; i++) {
+        if ((tids[i] = thread_create(futexworker, 0)) < 0) {
+            printf("%s: thread_create failed\n", s);
+            exit(1);
+        }
+    }
+    for (i = 0; i < 400; i++) {
+        mutex_lock(&futexmutex);
+        futexqueue++;
+        cond_signal(&futexcond);
+        mutex_unlock(&futexmutex);
+    }
+    for (i = 0; i < 4; i++) {
+        if (thread_join(tids[i]) != tids[i]) {
+            printf("%s: thread_join failed\n", s);
+            exit(1);
+        }
+    }
+    if (futexbad || futexcount != 4000 + 20 * 4 || futexqueue != 0) {
+        printf("%s: count %d queue %d\n", s, futexcount, futexqueue);
+        exit(1);
+    }
+}
+
+// 等待者睡眠期间 fork() 使这一页变成写时复制，之后的写把字换到新的
+// 物理页上，唤醒仍然要找到等待者；只读映射的字上也能等待
+static int futexword;
+static volatile int futexdone;
+
+static void futexwaiter(void* arg) {
+    while (__atomic_load_n(&futexword, __ATOMIC_ACQUIRE) == 0)
+        futex_wait(&futexword, 0);
+    futexdone = 1;
+}
+
+void futexkeytest(char* s) {
+    char* f = "futexfile";
+    int tid, i, fd, pid, xstatus;
+    int *ro, *rw;
+
+    if ((tid = thread_create(futexwaiter, 0)) < 0) {
+        printf("%s: thread_create failed\n", s);
+        exit(1);
+    }
+    sleep(2); // 让线程睡下
+    if ((pid = fork()) < 0) {
+        printf("%s: fork failed\n", s);
+        exit(1);
+    }
+    if (pid == 0)
+        exit(0);
+    wait(0);
+    __atomic_store_n(&futexword, 1, __ATOMIC_RELEASE);
+    for (i = 0; i < 20 && !futexdone; i++) {
+        futex_wake(&futexword, 1);
+        sleep(1);
+    }
+    if (!futexdone) {
+        printf("%s: waiter lost its wakeup after fork\n", s);
+        exit(1);
+    }
+    thread_join(tid);
+
+    unlink(f);
+    if ((fd = open(f, O_CREATE | O_RDWR)) < 0 || write(fd, &i, sizeof(i)) != sizeof(i)) {
+        printf("%s: create %s failed\n", s, f);
+        exit(1);
+    }
+    ro = mmap(0, sizeof(int), PROT_READ, MAP_SHARED, fd, 0);
+    if (ro == MAP_FAILED) {
+        printf("%s: mmap failed\n", s);
+        exit(1);
+    }
+    xstatus = *(volatile int*)ro; // 先让页映射上，fork 之后两边是同一页
+    if ((pid = fork()) < 0) {
+        printf("%s: fork failed\n", s);
+        exit(1);
+    }
+    if (pid == 0) {
+        rw = mmap(0, sizeof(int), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (rw == MAP_FAILED)
+            exit(1);
+        for (i = 0; i < 100; i++) {
+            if (futex_wake(rw, 1) == 1)
+                exit(0);
+            sleep(1);
+        }
+        exit(1);
+    }
+    if (futex_wait(ro, xstatus) != 0) {
+        printf("%s: futex_wait on a read-only word failed\n", s);
+        exit(1);
+    }
+    wait(&xstatus);
+    close(fd);
+    unlink(f);
+    if (xstatus != 0) {
+        printf("%s: waker failed\n", s);
+        exit(1);
+    }
+}
+
 struct test {
     void (*f)(char*);
     char* s;
@@ -2529,6 +3549,25 @@ struct test {
     {sbrklast, "sbrklast"},
     {sbrk8000, "sbrk8000"},
     {badarg, "badarg"},
+    {cowfork, "cowfork"},
+    {textwrite, "textwrite"},
+    {sharedtext, "sharedtext"},
+    {textbusy, "textbusy"},
+    {superpage, "superpage"},
+    {mmaptest, "mmaptest"},
+    {swaptest, "swaptest"},
+    {copyaligntest, "copyaligntest"},
+    {ulibstringtest, "ulibstringtest"},
+    {procinfotest, "procinfotest"},
+    {sleeplocktest, "sleeplocktest"},
+    {schedacct, "schedacct"},
+    {nanosleeptest, "nanosleeptest"},
+    {lockstattest, "lockstattest"},
+    {killpidtest, "killpidtest"},
+    {sleeplockstattest, "sleeplockstattest"},
+    {threadtest, "threadtest"},
+    {futextest, "futextest"},
+    {futexkeytest, "futexkeytest"},
 
     {0, 0},
 };
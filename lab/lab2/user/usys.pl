@@ -6,10 +6,13 @@ print "# generated by usys.pl - do not edit\n";
 
 print "#include \"kernel/syscall.h\"\n";
 
+# entry("name") defines name(); entry("name", "sym") defines the stub as sym()
+# for syscalls that user.h wraps in C (see ulib.c).
 sub entry {
     my $name = shift;
-    print ".global $name\n";
-    print "${name}:\n";
+    my $sym = shift || $name;
+    print ".global $sym\n";
+    print "${sym}:\n";
     print " li a7, SYS_${name}\n";
     print " ecall\n";
     print " ret\n";
@@ -33,8 +36,19 @@ entry("mkdir");
 entry("chdir");
 entry("dup");
 entry("getpid");
-entry("sbrk");
+entry("sbrk", "sys_sbrk");
 entry("sleep");
 entry("uptime");
 entry("freemem");
 entry("trace");
+entry("sysinfo");
+entry("mmap");
+entry("munmap");
+entry("procinfo");
+entry("nanosleep");
+entry("nanouptime");
+entry("lockstat");
+entry("clone");
+entry("join");
+entry("futex_wait");
+entry("futex_wake");